@@ -0,0 +1,392 @@
+#include "ast_cache.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "source.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <interpreter/interpreter.hpp>
+#include <interpreter/optimizer.hpp>
+
+// Micro- and macro-benchmarks for every stage of the pipeline. Each result
+// is one JSON object per line on stdout:
+//   {"bench":"fib","engine":"vm","unit":"call","ops":..,"ns_per_op":..,"allocs_per_op":..}
+// Sources are generated deterministically, so runs are comparable between
+// commits. Pass a substring to run only the benchmarks whose name has it,
+// and --runs=N to change how many times each one is repeated.
+
+// Per thread, so counting does not serialize the multi-interpreter bench.
+static thread_local size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+     allocations++;
+     if (void *p = std::malloc(size ? size : 1))
+          return p;
+     throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+     std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+     std::free(p);
+}
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+struct Measurement
+{
+     double ns = 0;
+     size_t allocs = 0;
+};
+
+void report(const std::string &bench, const char *engine, const char *unit, double ops, const Measurement &m)
+{
+     std::printf("{\"bench\":\"%s\",\"engine\":\"%s\",\"unit\":\"%s\",\"ops\":%.0f,\"ns_per_op\":%.3f,\"allocs_per_op\":%.4f}\n",
+                 bench.c_str(), engine, unit, ops, m.ns / ops, static_cast<double>(m.allocs) / ops);
+     std::fflush(stdout);
+}
+
+template <typename F>
+Measurement measure(F &&body)
+{
+     size_t allocs_before = allocations;
+     auto start = Clock::now();
+     body();
+     auto elapsed = Clock::now() - start;
+     return {std::chrono::duration<double, std::nano>(elapsed).count(), allocations - allocs_before};
+}
+
+// A few MB of assignments, conditionals, loops and comments, roughly like
+// a generated script.
+std::string generated_source(size_t target_bytes)
+{
+     std::string out;
+     out.reserve(target_bytes + 256);
+     for (size_t i = 0; out.size() < target_bytes; ++i)
+     {
+          std::string n = std::to_string(i);
+          out += "# block " + n + "\n";
+          out += "value_" + n + " = " + n + " * 3 + (" + n + " - 1) / 2;\n";
+          out += "name_" + n + " = 'item number " + n + "';\n";
+          out += "if (value_" + n + " > 10) (\n    flag_" + n + " = true;\n)\n";
+          out += "for (k_" + n + " = 0; 3) (\n    total_" + n + " = k_" + n + " + 1.5;\n)\n";
+     }
+     return out;
+}
+
+void bench_lexer(int runs)
+{
+     auto source = SourceBuffer::from_string(generated_source(4 << 20));
+     size_t tokens = 0;
+     Measurement m = measure([&]
+                             {
+          for (int r = 0; r < runs; ++r)
+          {
+               Lexer lexer(source);
+               while (lexer.next_token().type != TokenType::EndOfFile)
+                    tokens++;
+          } });
+     report("lex", "-", "token", static_cast<double>(tokens), m);
+     double mb = static_cast<double>(source->text().size()) * runs / (1 << 20);
+     std::printf("{\"bench\":\"lex_throughput\",\"engine\":\"-\",\"unit\":\"MB/s\",\"value\":%.1f}\n",
+                 mb / (m.ns / 1e9));
+}
+
+void bench_parser(int runs)
+{
+     auto source = SourceBuffer::from_string(generated_source(1 << 20));
+     size_t nodes = 0;
+     Measurement m = measure([&]
+                             {
+          for (int r = 0; r < runs; ++r)
+          {
+               Parser parser{Lexer(source)};
+               nodes += parser.parse().size();
+          } });
+     report("parse", "-", "node", static_cast<double>(nodes), m);
+}
+
+// The same source as the parse bench, read back from an AST cache file;
+// compare the two node rates.
+void bench_cache_load(int runs)
+{
+     auto source = SourceBuffer::from_string(generated_source(1 << 20));
+     Parser parser{Lexer(source)};
+     Ast parsed = parser.parse();
+     AstCacheKey key = ast_cache_key(source->text(), 0);
+     std::string path = (std::filesystem::temp_directory_path() / "karamel_bench.krmc").string();
+     save_ast_cache(path, parsed, key);
+
+     size_t nodes = 0;
+     Measurement m = measure([&]
+                             {
+          for (int r = 0; r < runs; ++r)
+          {
+               std::optional<Ast> ast = load_ast_cache(path, key);
+               if (!ast)
+                    throw std::runtime_error("cache bench: cache file rejected");
+               nodes += ast->size();
+          } });
+     std::remove(path.c_str());
+     report("cache_load", "-", "node", static_cast<double>(nodes), m);
+}
+
+// `ops` is how many units of work one run of the script performs.
+struct ScriptBench
+{
+     const char *name;
+     const char *unit;
+     double ops;
+     const char *source;
+};
+
+const ScriptBench script_benches[] = {
+    {"fib", "call", 21891, R"(
+fn fib(n: num) num (
+    if (n < 2) (
+        return n;
+    )
+    return fib(n - 1) + fib(n - 2);
+)
+r = fib(20);
+)"},
+    {"fact", "call", 12000, R"(
+fn fact(n: num) num (
+    if (n <= 1) (
+        return 1;
+    )
+    return n * fact(n - 1);
+)
+for (i = 0; 1000) (
+    r = fact(12);
+)
+)"},
+    {"for_loop", "iteration", 200000, R"(
+s = 0;
+for (i = 0; 200000) (
+    s = s + i;
+)
+)"},
+    {"pfor_sum", "iteration", 200000, R"(
+s = 0;
+pfor (i = 0; 200000) (
+    s = s + i;
+)
+)"},
+    {"array_index", "index", 100000, R"(
+a = [1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20];
+for (j = 0; 5000) (
+    for (i = 0; a) (
+        x = a[i];
+    )
+)
+)"},
+    {"array_build", "element", 100000, R"(
+a = [];
+for (i = 0; 100000) (
+    push(a, i);
+)
+for (i = 0; a) (
+    a[i] = i * 2;
+)
+)"},
+    {"string_concat", "concat", 5000, R"(
+s = '';
+for (i = 0; 5000) (
+    s = s + 'x';
+)
+)"},
+    {"cout", "line", 20000, R"(
+for (i = 0; 20000) (
+    cout('value ', i, ' ', 1.5);
+)
+)"},
+};
+
+// Aggregations over a 64K-element array, so the native kernels dominate
+// rather than the loop around them.
+std::string kernel_source(const char *call, bool floats)
+{
+     std::string out = "a = [";
+     for (size_t i = 0; i < 65536; ++i)
+     {
+          if (i > 0)
+               out += ", ";
+          out += std::to_string(i % 1000);
+          if (floats)
+               out += ".5";
+     }
+     out += "];\nfor (i = 0; 1000) (\n    r = ";
+     out += call;
+     out += ";\n)\n";
+     return out;
+}
+
+// Each run re-resolves and re-compiles the script, which is a small,
+// fixed cost next to executing it.
+void bench_script(const ScriptBench &bench, ExecutionMode mode, int runs)
+{
+     Parser parser{Lexer(bench.source)};
+     auto ast = std::make_shared<const Ast>(Optimizer(2).run(parser.parse()));
+
+     // Output goes to a discarded buffer so terminal speed does not count.
+     std::ostringstream sink;
+     std::streambuf *saved = std::cout.rdbuf(sink.rdbuf());
+
+     Interpreter interpreter(mode);
+     interpreter.interpret(ast);
+     sink.str(std::string());
+     Measurement m = measure([&]
+                             {
+          for (int r = 0; r < runs; ++r)
+          {
+               interpreter.interpret(ast);
+               sink.str(std::string());
+          } });
+
+     interpreter.output().flush();
+     std::cout.rdbuf(saved);
+     report(bench.name, mode == ExecutionMode::Bytecode ? "vm" : "tree", bench.unit, bench.ops * runs, m);
+}
+
+class NullSink : public OutputSink
+{
+public:
+     void write(std::string_view) override {}
+};
+
+const char *multi_source = R"(
+fn fib(n: num) num (
+    if (n < 2) (
+        return n;
+    )
+    return fib(n - 1) + fib(n - 2);
+)
+s = '';
+for (i = 0; 50) (
+    s = s + 'x';
+)
+r = fib(12) + sum([1, 2, 3, 4]);
+cout(r, ' ', s);
+)";
+
+// Many short scripts at once: every thread builds a fresh interpreter per
+// script, all over one shared AST. ns_per_op is wall time per script, so
+// it falls with the thread count for as long as throughput scales.
+void bench_multi_interpreter(ExecutionMode mode, int runs)
+{
+     Parser parser{Lexer(multi_source)};
+     const Ast ast = Optimizer(2).run(parser.parse());
+     const size_t scripts_per_thread = 100 * static_cast<size_t>(runs);
+     const char *engine = mode == ExecutionMode::Bytecode ? "vm" : "tree";
+
+     size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+     std::vector<size_t> counts;
+     for (size_t n = 1; n < hardware; n *= 2)
+          counts.push_back(n);
+     counts.push_back(hardware);
+
+     for (size_t threads : counts)
+     {
+          std::atomic<bool> go{false};
+          std::atomic<size_t> allocs{0};
+          std::vector<std::thread> workers;
+          for (size_t t = 0; t < threads; ++t)
+               workers.emplace_back([&]
+                                    {
+                    while (!go.load(std::memory_order_acquire))
+                         std::this_thread::yield();
+                    size_t before = allocations;
+                    for (size_t i = 0; i < scripts_per_thread; ++i)
+                    {
+                         Interpreter interpreter(mode);
+                         interpreter.output().set_sink(std::make_unique<NullSink>());
+                         interpreter.interpret(ast);
+                    }
+                    allocs.fetch_add(allocations - before, std::memory_order_relaxed); });
+
+          auto start = Clock::now();
+          go.store(true, std::memory_order_release);
+          for (std::thread &worker : workers)
+               worker.join();
+          double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+          double ops = static_cast<double>(scripts_per_thread * threads);
+          std::printf("{\"bench\":\"multi_interpreter\",\"engine\":\"%s\",\"unit\":\"script\",\"threads\":%zu,"
+                      "\"ops\":%.0f,\"ns_per_op\":%.3f,\"allocs_per_op\":%.4f}\n",
+                      engine, threads, ops, ns / ops, static_cast<double>(allocs.load()) / ops);
+          std::fflush(stdout);
+     }
+}
+}
+
+int main(int argc, char **argv)
+{
+     std::string filter;
+     int runs = 5;
+     for (int i = 1; i < argc; ++i)
+     {
+          std::string arg = argv[i];
+          if (arg.rfind("--runs=", 0) == 0)
+               runs = std::max(1, std::atoi(arg.c_str() + 7));
+          else
+               filter = arg;
+     }
+     auto selected = [&](const std::string &name)
+     { return filter.empty() || name.find(filter) != std::string::npos; };
+
+     if (selected("lex"))
+          bench_lexer(runs);
+     if (selected("parse"))
+          bench_parser(runs);
+     if (selected("cache"))
+          bench_cache_load(runs);
+     const std::string kernel_sources[] = {
+         kernel_source("sum(a)", false),
+         kernel_source("sum(a)", true),
+         kernel_source("dot(a, a)", true),
+         kernel_source("max(a)", false),
+     };
+     if (selected("multi_interpreter"))
+     {
+          bench_multi_interpreter(ExecutionMode::Bytecode, runs);
+          bench_multi_interpreter(ExecutionMode::TreeWalker, runs);
+     }
+
+     const ScriptBench kernel_benches[] = {
+         {"kernel_sum_num", "element", 65536.0 * 1000, kernel_sources[0].c_str()},
+         {"kernel_sum_flo", "element", 65536.0 * 1000, kernel_sources[1].c_str()},
+         {"kernel_dot_flo", "element", 65536.0 * 1000, kernel_sources[2].c_str()},
+         {"kernel_max_num", "element", 65536.0 * 1000, kernel_sources[3].c_str()},
+     };
+
+     for (const ScriptBench &bench : script_benches)
+     {
+          if (!selected(bench.name))
+               continue;
+          bench_script(bench, ExecutionMode::Bytecode, runs);
+          bench_script(bench, ExecutionMode::TreeWalker, runs);
+     }
+     for (const ScriptBench &bench : kernel_benches)
+     {
+          if (selected(bench.name))
+               bench_script(bench, ExecutionMode::Bytecode, runs);
+     }
+     return 0;
+}
@@ -0,0 +1,208 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "token.hpp"
+
+enum class NodeType : uint8_t
+{
+     FunctionDecl,
+     FunctionCall,
+     Return,
+     If,
+     For,
+     ParallelFor,
+     Identifier,
+     Number,
+     DecimalNumber,
+     String,
+     Boolean,
+     Array,
+     ArrayItem,
+     BinaryOp,
+     Assignment,
+     ItemAssignment,
+     ParamList,
+     ForLoop,
+     While,
+     Constant,
+};
+
+inline std::string to_string(NodeType type)
+{
+     switch (type)
+     {
+     case NodeType::FunctionDecl:
+          return "FunctionDecl";
+     case NodeType::FunctionCall:
+          return "FunctionCall";
+     case NodeType::Return:
+          return "Return";
+     case NodeType::If:
+          return "If";
+     case NodeType::For:
+          return "For";
+     case NodeType::ParallelFor:
+          return "ParallelFor";
+     case NodeType::Identifier:
+          return "Identifier";
+     case NodeType::Number:
+          return "Number";
+     case NodeType::String:
+          return "String";
+     case NodeType::Boolean:
+          return "Boolean";
+     case NodeType::BinaryOp:
+          return "BinaryOp";
+     case NodeType::Assignment:
+          return "Assignment";
+     case NodeType::ItemAssignment:
+          return "ItemAssignment";
+     case NodeType::Constant:
+          return "Constant";
+     case NodeType::DecimalNumber:
+          return "DecimalNumber";
+     case NodeType::Array:
+          return "Array";
+     case NodeType::ArrayItem:
+          return "ArrayItem";
+     case NodeType::ParamList:
+          return "ParamList";
+     case NodeType::ForLoop:
+          return "ForLoop";
+     case NodeType::While:
+          return "While";
+     default:
+          return "Unknown";
+     }
+}
+
+using NodeId = uint32_t;
+using SymbolId = uint32_t;
+
+constexpr SymbolId no_symbol = UINT32_MAX;
+
+// Interns strings into fixed-size blocks that never move, so the views it
+// hands out stay valid for the lifetime of the table.
+class SymbolTable
+{
+public:
+     SymbolId intern(std::string_view text);
+     SymbolId find(std::string_view text) const;
+     std::string_view view(SymbolId id) const { return symbols[id]; }
+     size_t size() const { return symbols.size(); }
+     void reserve(size_t count)
+     {
+          symbols.reserve(count);
+          index.reserve(count);
+     }
+
+private:
+     static constexpr size_t block_size = 64 * 1024;
+
+     std::vector<std::unique_ptr<char[]>> blocks;
+     char *current_block = nullptr;
+     size_t block_used = block_size;
+     std::vector<std::string_view> symbols;
+     std::unordered_map<std::string_view, SymbolId> index;
+
+     const char *store(std::string_view text);
+};
+
+// A literal decoded ahead of time. String literals keep their text in the
+// symbol table.
+struct Literal
+{
+     enum class Kind : uint8_t
+     {
+          None,
+          Int,
+          Float,
+          Bool,
+          String,
+     };
+
+     Kind kind = Kind::None;
+     union
+     {
+          int64_t int_val;
+          double float_val;
+          bool bool_val;
+          SymbolId str;
+     };
+
+     Literal() : int_val(0) {}
+};
+
+// `value` is the node's interned text, except for Constant nodes where it
+// indexes the literal pool. `op` is set on BinaryOp nodes only.
+struct Node
+{
+     NodeType type;
+     Operator op;
+     SymbolId value;
+     uint32_t first_child;
+     uint32_t child_count;
+     uint32_t line;
+     uint32_t column;
+};
+
+struct NodeRange
+{
+     const NodeId *first;
+     const NodeId *last;
+
+     const NodeId *begin() const { return first; }
+     const NodeId *end() const { return last; }
+     size_t size() const { return static_cast<size_t>(last - first); }
+     bool empty() const { return first == last; }
+     NodeId operator[](size_t i) const { return first[i]; }
+     NodeId back() const { return last[-1]; }
+};
+
+// A parsed program. Nodes live in one array and refer to their children
+// through a contiguous range of a shared index array, so a whole script
+// costs a few vector growths instead of one allocation per node.
+class Ast
+{
+public:
+     NodeId add(NodeType type, SymbolId value, uint32_t line, uint32_t column,
+                const NodeId *children, size_t count, Operator op = Operator::None);
+     void add_root(NodeId id) { root_ids.push_back(id); }
+     uint32_t add_literal(const Literal &literal);
+     void reserve(size_t node_count, size_t child_count, size_t literal_count)
+     {
+          nodes.reserve(node_count);
+          child_ids.reserve(child_count);
+          literal_pool.reserve(literal_count);
+     }
+
+     const Node &node(NodeId id) const { return nodes[id]; }
+     NodeType type(NodeId id) const { return nodes[id].type; }
+     Operator op(NodeId id) const { return nodes[id].op; }
+     std::string_view text(NodeId id) const { return symbol_table.view(nodes[id].value); }
+     NodeRange children(NodeId id) const
+     {
+          const NodeId *first = child_ids.data() + nodes[id].first_child;
+          return {first, first + nodes[id].child_count};
+     }
+     NodeId child(NodeId id, size_t i) const { return child_ids[nodes[id].first_child + i]; }
+     const Literal &literal(NodeId id) const { return literal_pool[nodes[id].value]; }
+     const std::vector<Literal> &literals() const { return literal_pool; }
+
+     const std::vector<NodeId> &roots() const { return root_ids; }
+     size_t size() const { return nodes.size(); }
+
+     SymbolTable &symbols() { return symbol_table; }
+     const SymbolTable &symbols() const { return symbol_table; }
+
+private:
+     std::vector<Node> nodes;
+     std::vector<NodeId> child_ids;
+     std::vector<NodeId> root_ids;
+     std::vector<Literal> literal_pool;
+     SymbolTable symbol_table;
+};
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include "ast.hpp"
+
+// Parsed (and optimized) scripts saved to disk so later runs can skip the
+// lexer, parser and optimizer. A cache file holds one Ast in flat sections
+// that mirror its arrays, behind a header naming the format version and
+// the source it was built from and a checksum of the sections. Loading
+// maps the file and refills the Ast in one validating pass over them.
+//
+// Bump cache_format_version whenever NodeType, Operator, Literal or the
+// section layout changes; files written by another version are ignored.
+constexpr uint32_t cache_format_version = 3;
+
+// Identifies the source a cache file was built from.
+struct AstCacheKey
+{
+     uint64_t source_hash = 0;
+     uint64_t source_size = 0;
+     uint32_t opt_level = 0;
+};
+
+AstCacheKey ast_cache_key(std::string_view source, int opt_level);
+
+// `dir`/<hash>-O<level>.krmc
+std::string ast_cache_path(const std::string &dir, const AstCacheKey &key);
+
+// Writes through a temporary file and a rename, so concurrent runs never
+// see a partial file. Throws std::runtime_error when the file cannot be
+// written.
+void save_ast_cache(const std::string &path, const Ast &ast, const AstCacheKey &key);
+
+// Empty when the file is missing, was built from other source or by
+// another format version, or fails validation.
+std::optional<Ast> load_ast_cache(const std::string &path, const AstCacheKey &key);
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Numeric loops over packed array storage. Each instruction set fills in a
+// table of these; array_kernels() picks the widest one the CPU supports the
+// first time it is called. Integer kernels that can overflow return false
+// instead of a result, and sum and dot only fail when the exact total does
+// not fit. Float reductions may add in a different order than a script
+// loop would, so their last bits can differ from one.
+struct ArrayKernels
+{
+     const char *name;
+
+     bool (*sum_int)(const int64_t *, size_t, int64_t *);
+     double (*sum_float)(const double *, size_t);
+     // min/max require n > 0.
+     int64_t (*min_int)(const int64_t *, size_t);
+     double (*min_float)(const double *, size_t);
+     int64_t (*max_int)(const int64_t *, size_t);
+     double (*max_float)(const double *, size_t);
+     bool (*dot_int)(const int64_t *, const int64_t *, size_t, int64_t *);
+     double (*dot_float)(const double *, const double *, size_t);
+     bool (*scale_int)(const int64_t *, size_t, int64_t, int64_t *);
+     void (*scale_float)(const double *, size_t, double, double *);
+     bool (*add_int)(const int64_t *, const int64_t *, size_t, int64_t *);
+     void (*add_float)(const double *, const double *, size_t, double *);
+};
+
+const ArrayKernels &array_kernels();
+// Every table this CPU can run, the portable scalar one first, so tests
+// can check the others against it.
+std::vector<const ArrayKernels *> all_array_kernels();
@@ -1,5 +1,25 @@
 #pragma once
 #include <vector>
+#include "output.hpp"
 #include "value.hpp"
 
-Value builtin_cout(const std::vector<Value> &args);
\ No newline at end of file
+Value builtin_cout(Output &out, const std::vector<Value> &args);
+
+// Numeric array library. Packed num and flo arrays are read in place by
+// the kernels in array_kernels.hpp; arrays that mix num and flo are
+// widened to flo first.
+Value builtin_sum(const std::vector<Value> &args);
+Value builtin_min(const std::vector<Value> &args);
+Value builtin_max(const std::vector<Value> &args);
+Value builtin_dot(const std::vector<Value> &args);
+Value builtin_scale(const std::vector<Value> &args);
+Value builtin_add(const std::vector<Value> &args);
+Value builtin_prefix_sum(const std::vector<Value> &args);
+Value builtin_argmax(const std::vector<Value> &args);
+
+// Update the array variable passed as the first argument in place;
+// `target` is its value and `args` the remaining arguments. Storage grows
+// geometrically, so appending with push is amortized O(1).
+Value builtin_push(Value &target, const std::vector<Value> &args);
+Value builtin_pop(Value &target, const std::vector<Value> &args);
+Value builtin_reserve(Value &target, const std::vector<Value> &args);
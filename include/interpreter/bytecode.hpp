@@ -0,0 +1,125 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "value.hpp"
+
+enum class OpCode : uint8_t
+{
+     Constant,
+     Nil,
+     Pop,
+
+     LoadGlobal,
+     StoreGlobal,
+     LoadLocal,
+     StoreLocal,
+
+     Add,
+     Sub,
+     Mul,
+     Div,
+     Equal,
+     NotEqual,
+     Less,
+     LessEqual,
+     Greater,
+     GreaterEqual,
+     And,
+     Or,
+
+     MakeArray,
+     Index,
+     // Pops a value and an index and stores the value into that element of
+     // the array in slot `arg`, in place unless the array is shared.
+     StoreItemGlobal,
+     StoreItemLocal,
+
+     Jump,
+     JumpIfFalse,
+     ForTestGlobal,
+     ForTestLocal,
+     ForNextGlobal,
+     ForNextLocal,
+     // Loops with an invariant limit keep it and the counter on the stack
+     // as nums. FOR_ENTER replaces the limit with both, reading the counter
+     // from slot `arg`; FOR_LOOP jumps to `arg` once the counter reaches
+     // the limit; FOR_STEP increments the counter and stores it in slot `arg`.
+     ForEnterGlobal,
+     ForEnterLocal,
+     ForLoop,
+     ForStepGlobal,
+     ForStepLocal,
+     // Hands the pfor statement at node `arg` to run_parallel_for; the
+     // limit is on the stack and the loop variable is already assigned.
+     ParallelFor,
+
+     DefineFunction,
+     Call,
+     TailCall,
+     // Calls the native update `function` with the variable in slot `arg`
+     // and `aux` arguments from the stack.
+     UpdateGlobal,
+     UpdateLocal,
+     Return,
+     Halt,
+};
+
+// `aux` carries a small secondary operand: the argument count of a call,
+// the store_* flags of a store, whether both operands of an arithmetic or
+// comparison instruction are proven to be num, or whether a return is an
+// explicit `return` statement that must match the declared type.
+// `function` is the callee of an update, whose `arg` is its target slot,
+// and on a call, the serial of the function its arguments are proven
+// against (0 if they are not).
+struct Instruction
+{
+     OpCode op;
+     uint8_t aux;
+     uint16_t function;
+     uint32_t arg;
+};
+
+// A store leaves its value on the stack for the enclosing expression.
+constexpr uint8_t store_keep = 1;
+// The slot is proven to only ever hold the stored value's type.
+constexpr uint8_t store_unchecked = 2;
+
+struct Chunk
+{
+     std::vector<Instruction> code;
+     std::vector<Value> constants;
+};
+
+struct FunctionProto
+{
+     std::string name;
+     uint32_t id = 0;
+     std::vector<Value::Type> param_types;
+     bool has_return_type = false;
+     Value::Type return_type = Value::Type::None;
+     std::vector<std::string> local_names;
+     // Declaration node, so the function can also be registered for the
+     // tree-walking evaluators that run pfor bodies.
+     uint32_t decl = 0;
+     // Numbers the functions one compiler produces, from 1, so calls can
+     // name the function their arguments were proven against; 0 once the
+     // numbers no longer fit in Instruction::function.
+     uint16_t serial = 0;
+     Chunk chunk;
+};
+
+struct Script;
+
+struct Program
+{
+     const Script *script = nullptr;
+     FunctionProto main;
+     std::vector<std::unique_ptr<FunctionProto>> functions;
+     std::vector<std::string> global_names;
+     std::vector<std::string> function_names;
+};
+
+std::string to_string(OpCode op);
+std::string disassemble(const FunctionProto &function);
@@ -0,0 +1,61 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <ast.hpp>
+#include "bytecode.hpp"
+#include "script.hpp"
+
+class FunctionManager;
+
+// Lowers resolved statements into bytecode for the VM. Variable slots come
+// from Resolver; the function name table persists across compile() calls,
+// so programs compiled by the same compiler can share one VM.
+class Compiler
+{
+public:
+     explicit Compiler(const FunctionManager &functions);
+
+     std::unique_ptr<Program> compile(const Script &script, const std::vector<std::string> &global_names);
+
+private:
+     const FunctionManager &natives;
+     std::unordered_map<std::string, uint32_t> functions;
+     std::vector<std::string> function_names;
+     uint32_t serials = 0;
+
+     const Ast *ast = nullptr;
+     const Resolution *resolution = nullptr;
+     const std::vector<StaticType> *types = nullptr;
+     const std::vector<bool> *invariant_limits = nullptr;
+     const std::vector<Value> *constants = nullptr;
+     Program *program = nullptr;
+     FunctionProto *current = nullptr;
+
+     struct CallSite
+     {
+          FunctionProto *caller;
+          size_t at;
+          NodeId node;
+     };
+     std::vector<CallSite> calls;
+
+     uint32_t function_id(const std::string &name);
+
+     size_t emit(OpCode op, uint32_t arg = 0, uint8_t aux = 0);
+     uint32_t add_constant(const Value &value);
+     void patch_jump(size_t at);
+
+     void compile_node(NodeId node, bool keep);
+     void compile_block(NodeId block, bool keep);
+     void compile_load(NodeId var);
+     void compile_store(NodeId var, bool keep, bool checked);
+     size_t emit_slot(NodeId var, OpCode global_op, OpCode local_op, uint8_t aux = 0);
+     void compile_call(NodeId node, OpCode op);
+     void compile_update(NodeId node);
+     void compile_for(NodeId node);
+     void compile_parallel_for(NodeId node);
+     void compile_function(NodeId node);
+     void mark_proven_calls();
+};
@@ -2,44 +2,136 @@
 #include <memory>
 #include <vector>
 #include "value.hpp"
-#include <parser.hpp>
+#include <ast.hpp>
 #include "scope_manager.hpp"
+#include "script.hpp"
 
 class FunctionManager;
+class Profiler;
+class ThreadPool;
 
-struct ReturnSignal
-{
-     Value value;
-     explicit ReturnSignal(Value v) : value(std::move(v)) {}
-};
+// The tree-walker recurses on the native stack for every script call, so
+// its default limit is far below the VM's. A higher --max-depth is still
+// cut short where the thread's stack runs out (see native_stack.hpp).
+constexpr size_t default_tree_call_depth = 2000;
+
+struct ItemWriteLog;
 
 class Evaluator
 {
 public:
      Evaluator(FunctionManager &func_mgr);
 
-     Value evaluate(const std::shared_ptr<ASTNode> &node);
-     Value evaluate_block(const std::shared_ptr<ASTNode> &block);
+     Value evaluate(NodeId node);
+     Value evaluate_block(NodeId block);
+
+     // A `return` statement stores its value and sets the returning state
+     // instead of unwinding; blocks and loops stop as soon as it is set and
+     // the enclosing call takes the value, which clears it again.
+     bool returning() const { return flow == Flow::Return; }
+     Value take_return();
+
+     // `return f(...)` inside a call evaluates the arguments and hands the
+     // target back to FunctionManager::call, which runs it in the same
+     // native frame instead of recursing.
+     bool tail_calling() const { return flow == Flow::TailCall; }
+     const FunctionEntry *take_tail_call(std::vector<Value> &args);
+     void clear_flow();
+
+     // The user function being run, and the result type check it inherited
+     // from the functions that tail-called into it.
+     struct ActiveCall
+     {
+          const FunctionEntry *function;
+          bool check_result = false;
+          Value::Type result_type = Value::Type::None;
+     };
 
-     void push_scope();
-     void pop_scope();
+     ActiveCall *enter_call(ActiveCall *call);
 
-     void define_variable(const std::string &name, const Value &value);
-     void set_variable(const std::string &name, const Value &value);
-     Value get_variable(const std::string &name) const;
+     // Switches the script whose nodes are being evaluated and returns the
+     // previous one, so calls into functions from other scripts can restore it.
+     const Script *set_script(const Script *script);
+     const Script *current_script() const;
+
+     // Attaches a profiler, or detaches it when null. Node hits are only
+     // counted if the profiler asks for them when it is attached.
+     void set_profiler(Profiler *profiler);
+     Profiler *profiler() const { return call_profiler; }
+
+     // Where pfor statements spread their iterations; without a pool they
+     // run on the calling thread under the same rules.
+     void set_thread_pool(ThreadPool *pool);
+     // A buffer for the arguments of native calls, so they need not
+     // allocate one each; a call nested in the arguments of another finds
+     // it taken and starts from an empty vector.
+     std::vector<Value> take_spare_args() { return std::move(spare_args); }
+     void give_back_spare_args(std::vector<Value> args)
+     {
+          args.clear();
+          spare_args = std::move(args);
+     }
+     // Where a pfor worker records its writes to shared arrays, or null.
+     void set_item_log(ItemWriteLog *log);
+
+     // Starts from copies of another engine's variables; used by pfor
+     // workers. `frame` is the current function frame, or null.
+     void load_scope(const std::vector<Slot> &globals, const Slot *frame, size_t frame_size);
+     Slot &slot(const VarRef &ref) { return scope_mgr.slot(ref.depth, ref.slot); }
+     // The value of the defined variable `var` of the current script, for
+     // updating it in place.
+     Value &variable(NodeId var);
+
+     void resize_globals(size_t count);
+     void set_max_call_depth(size_t depth);
+     // Frames a call made now may still push before hitting the limit.
+     size_t call_depth_left() const;
+     void push_frame(size_t size);
+     void pop_frame();
+     void define_local(uint32_t slot, Value value);
+
+     // Dispatches on the operand types first, then on the operator.
+     static Value eval_binary_op(Operator op, const Value &lhs, const Value &rhs);
+     static bool is_true(const Value &val);
+     [[noreturn]] static void throw_overflow(Operator op, int64_t lhs, int64_t rhs);
+     // `array[index] = item`, in place unless the array is shared.
+     static void store_item(Value &array, const Value &index, Value item);
 
 private:
+     enum class Flow : uint8_t
+     {
+          Normal,
+          Return,
+          TailCall,
+     };
+
      ScopeManager scope_mgr;
      FunctionManager &function_manager;
+     const Script *script = nullptr;
+     size_t max_call_depth = default_tree_call_depth;
+     Flow flow = Flow::Normal;
+     Value return_value;
+     const FunctionEntry *tail_target = nullptr;
+     std::vector<Value> tail_args;
+     std::vector<Value> spare_args;
+     ActiveCall *active_call = nullptr;
+     Profiler *call_profiler = nullptr;
+     Profiler *node_profiler = nullptr;
+     ThreadPool *pool = nullptr;
+     ItemWriteLog *item_log = nullptr;
 
-     Value eval_binary_op(const std::string &op, const Value &lhs, const Value &rhs);
-     Value eval_bool_op(const Value &lhs, const std::string &op, const Value &rhs);
-     Value eval_string_op(const Value &lhs, const std::string &op, const Value &rhs);
-     Value eval_number_op(const Value &lhs, const std::string &op, const Value &rhs);
+     const FunctionEntry &call_target(NodeId call);
+     bool carry_result_check();
+     Value evaluate_return(NodeId node);
 
-     Value execute_for(const std::shared_ptr<ASTNode> &node);
-     Value execute_for_loop(const std::shared_ptr<ASTNode> &body, const std::shared_ptr<ASTNode> &limit, const std::string &var_name);
-     Value execute_while(const std::shared_ptr<ASTNode> &condition, const std::shared_ptr<ASTNode> &body);
+     static Value eval_int_op(Operator op, int64_t lhs, int64_t rhs);
+     static Value eval_float_op(Operator op, double lhs, double rhs);
+     static Value eval_bool_op(Operator op, bool lhs, bool rhs);
+     static Value eval_string_op(Operator op, const Value &lhs, const Value &rhs);
 
-     bool is_true(const Value &val) const;
+     Value execute_for(NodeId node);
+     Value execute_for_loop(NodeId body, NodeId limit, NodeId var);
+     Value execute_counted_loop(NodeId body, NodeId limit, NodeId var);
+     Value execute_while(NodeId condition, NodeId body);
+     Value execute_parallel_for(NodeId node);
 };
@@ -4,23 +4,82 @@
 #include <memory>
 #include <vector>
 #include <functional>
+#include <utility>
 #include "value.hpp"
+#include "jit.hpp"
+#include "script.hpp"
 
 class Evaluator;
-class ASTNode;
+
+std::pair<std::string, std::string> extract_name_and_type(const std::string &s);
+
+using NativeFunction = std::function<Value(const std::vector<Value> &)>;
+// A native that updates the variable passed as its first argument in
+// place, given that variable's value and the remaining arguments.
+using NativeUpdate = std::function<Value(Value &target, const std::vector<Value> &args)>;
+
+// Parameter and return types of a user function, decoded once when the
+// declaration is registered.
+struct FunctionSignature
+{
+     std::vector<uint32_t> param_slots;
+     std::vector<Value::Type> param_types;
+     bool has_return_type = false;
+     Value::Type return_type = Value::Type::None;
+     uint32_t frame_size = 0;
+};
+
+// Everything registered under one name. Entries never move once created
+// and a redefinition updates the entry in place, so call sites can keep a
+// pointer to it. A user function shadows a native of the same name once
+// it is declared, so library names stay free for scripts; updates are
+// part of the language and cannot be redeclared.
+struct FunctionEntry
+{
+     std::string name;
+     NativeFunction native;
+     NativeUpdate update;
+     const Script *script = nullptr;
+     NodeId decl = 0;
+     NodeId body = 0;
+     FunctionSignature signature;
+     mutable JitState jit;
+
+     bool is_native() const { return native && !script; }
+};
 
 class FunctionManager
 {
 public:
-     using NativeFunc = std::function<Value(const std::vector<Value> &)>;
+     using NativeFunc = NativeFunction;
 
-     void register_function(const std::string &name, const std::shared_ptr<ASTNode> &func_def);
+     // Redefining a function drops all compiled code, since callers were
+     // compiled against the old signature.
+     const FunctionEntry &register_function(const std::string &name, const Script &script, NodeId func_def);
      void register_native(const std::string &name, NativeFunc func);
-     Value call(const std::string &name, const std::vector<std::shared_ptr<ASTNode>> &args, Evaluator &evaluator);
+     // The first argument of every call to an update must be a variable;
+     // Resolver makes it a local of the calling function, like an assignment.
+     void register_update(const std::string &name, NativeUpdate func);
+     const FunctionEntry &resolve(const std::string &name) const;
+     Value call(const FunctionEntry &function, NodeRange args, Evaluator &evaluator);
+     // Evaluates and type-checks the arguments of a call to a user function.
+     std::vector<Value> bind_args(const FunctionEntry &function, NodeRange args, Evaluator &evaluator);
+     const NativeFunc *find_native(const std::string &name) const;
+     const NativeUpdate *find_update(const std::string &name) const;
+
+     // Counts a call to a user function whose arguments are already
+     // checked, compiles the function once it is hot, and runs its native
+     // code if there is any. False means the caller has to interpret the
+     // call. `depth_left` is how many frames the call may still nest.
+     bool run_native(const FunctionEntry &function, const Value *args, size_t depth_left, Value &result);
+     void set_jit(bool enabled);
 
 private:
-     std::unordered_map<std::string, std::shared_ptr<ASTNode>> user_functions;
-     std::unordered_map<std::string, NativeFunc> native_functions;
+     std::unordered_map<std::string, FunctionEntry> functions;
+     Jit jit;
+     bool jit_enabled = Jit::supported();
 
-     std::vector<Value> evaluate_args(const std::vector<std::shared_ptr<ASTNode>> &args, Evaluator &evaluator);
+     FunctionEntry &entry(const std::string &name);
+     std::vector<Value> evaluate_args(NodeRange args, Evaluator &evaluator);
+     Value invoke(const FunctionEntry &function, std::vector<Value> args, Evaluator &evaluator);
 };
@@ -1,17 +1,77 @@
 #pragma once
+#include <chrono>
 #include <vector>
 #include <memory>
 #include "evaluator.hpp"
 #include "function_manager.hpp"
+#include "output.hpp"
+#include "compiler.hpp"
+#include "resolver.hpp"
+#include "script.hpp"
+#include "thread_pool.hpp"
+#include "type_checker.hpp"
+#include "vm.hpp"
 
+enum class ExecutionMode
+{
+     Bytecode,
+     TreeWalker,
+};
+
+// Where the time of the last interpret() call went. The tree-walker has
+// no compile phase.
+struct InterpretStats
+{
+     std::chrono::nanoseconds resolve{0};
+     std::chrono::nanoseconds check{0};
+     std::chrono::nanoseconds compile{0};
+     std::chrono::nanoseconds execute{0};
+     size_t instructions = 0;
+};
+
+// One interpreter is used by one thread at a time. Interpreters share no
+// mutable state with each other, so separate threads may run their own
+// interpreters over the same Ast at once.
 class Interpreter
 {
 public:
-     Interpreter();
+     explicit Interpreter(ExecutionMode mode = ExecutionMode::Bytecode);
 
-     void interpret(const std::vector<std::shared_ptr<ASTNode>> &nodes);
+     void interpret(std::shared_ptr<const Ast> ast);
+     // Borrows `ast`, which must outlive the interpreter: functions it
+     // declares keep pointing into it.
+     void interpret(const Ast &ast);
+     void set_dump_bytecode(bool enabled);
+     // Limits script call nesting on both engines. Deep limits are only
+     // safe on the VM; the tree-walker uses the native stack.
+     void set_max_call_depth(size_t depth);
+     const InterpretStats &last_stats() const;
+     // Script output; writes to std::cout until given another sink.
+     Output &output();
+     // Attaches a profiler to both engines; null detaches it. Call
+     // Profiler::set_count_nodes first to also count tree-walker node hits.
+     void set_profiler(Profiler *profiler);
+     // Number of threads pfor statements use, counting the calling one;
+     // 0 means one per hardware thread, which is the default.
+     void set_threads(size_t threads);
+     // Compiles hot numeric functions to native code where the platform
+     // allows; on by default.
+     void set_jit(bool enabled);
 
 private:
+     ExecutionMode mode;
+     bool dump_bytecode = false;
+     InterpretStats stats;
+     Output script_output;
      FunctionManager function_manager;
      Evaluator evaluator;
+     Resolver resolver;
+     TypeChecker checker;
+     Compiler compiler;
+     VM vm;
+     std::vector<std::unique_ptr<Script>> scripts;
+     std::vector<std::unique_ptr<Program>> programs;
+     std::unique_ptr<ThreadPool> pool;
+
+     void run(std::unique_ptr<Script> script);
 };
@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "value.hpp"
+
+struct FunctionEntry;
+class FunctionManager;
+
+// Calls a user function makes before the JIT tries to compile it, and how
+// many times its native code may give up before it is dropped for good.
+constexpr uint32_t jit_call_threshold = 100;
+constexpr uint32_t jit_bailout_limit = 8;
+
+// Shared by every native frame of one call from the interpreter. Field
+// offsets are baked into the generated code.
+struct JitContext
+{
+     uint64_t bailed = 0;
+     int64_t depth_left = 0;
+     uintptr_t stack_floor = 0;
+     const FunctionEntry *bailed_in = nullptr;
+};
+
+// Arguments and the result are raw payloads: the int's 64 bits, the
+// double's bits, or 0/1 for a bool.
+using JitFunction = uint64_t (*)(const uint64_t *args, JitContext *context);
+
+// Per-function tier-up state. Atomic because pfor workers call functions
+// concurrently.
+struct JitState
+{
+     std::atomic<uint32_t> calls{0};
+     std::atomic<uint32_t> bailouts{0};
+     std::atomic<JitFunction> code{nullptr};
+
+     void reset();
+};
+
+// Compiles hot user functions to x86-64 machine code. Only functions
+// whose parameters and declared result are num, flo or bool qualify, and
+// their bodies may only use locals, literals, arithmetic, comparisons,
+// `if`, loops, `return` and calls to other functions that qualify. Such
+// functions cannot touch anything but their own frame, so native code
+// that meets a case it does not handle (a flo result that narrows to num,
+// an int overflow, a type error, an undefined local, running out of call
+// depth) just gives up, and the interpreter runs the whole call again
+// from the start.
+class Jit
+{
+public:
+     Jit() = default;
+     ~Jit();
+
+     Jit(const Jit &) = delete;
+     Jit &operator=(const Jit &) = delete;
+
+     // False on targets without a code generator.
+     static bool supported();
+
+     // Compiles `function` and everything it calls. On failure the
+     // function stays interpreted; its call count is already past the
+     // threshold, so this is not retried.
+     bool compile(const FunctionEntry &function, const FunctionManager &functions);
+
+     // Runs native code for one call. `args` must already match the
+     // parameter types. False if the code gave up; `result` is untouched.
+     static bool run(const FunctionEntry &function, JitFunction code, const Value *args, size_t depth_left,
+                     Value &result);
+
+private:
+     std::mutex mutex;
+     std::vector<std::pair<void *, size_t>> regions;
+
+     bool build(const FunctionEntry &function, const FunctionManager &functions,
+                std::vector<const FunctionEntry *> &active);
+     JitFunction install(const std::vector<uint8_t> &code);
+};
@@ -0,0 +1,14 @@
+#pragma once
+#include <vector>
+#include <ast.hpp>
+#include "script.hpp"
+
+class FunctionManager;
+
+// Marks every `for` loop whose limit has the same value on each
+// iteration, indexed by node id. Such a limit is built only from literals,
+// operators, indexing and variables that neither the body nor the loop
+// itself assigns or updates in place. Every name a function assigns is one
+// of its own locals, so calls in the body cannot change the limit; a call
+// in the limit might have side effects, so such limits are never marked.
+std::vector<bool> find_invariant_limits(const Script &script, const FunctionManager &functions);
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+
+// The tree-walker and JIT code recurse on the thread's own stack, which
+// the call depth limit alone cannot keep them inside: a frame's size
+// depends on the script. Both stop once the stack pointer gets below this
+// address, which leaves native_stack_reserve bytes free for throwing and
+// unwinding. Where the thread's stack bounds cannot be asked for, the
+// floor is a fixed distance below the first frame that asks.
+constexpr uintptr_t native_stack_reserve = 256 * 1024;
+
+uintptr_t native_stack_floor();
+
+// Roughly the current stack pointer.
+inline uintptr_t native_stack_position()
+{
+     char marker;
+     return reinterpret_cast<uintptr_t>(&marker);
+}
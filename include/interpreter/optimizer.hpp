@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+#include <ast.hpp>
+#include "value.hpp"
+
+// Rewrites a parsed AST before it is interpreted.
+//   -O0  no changes
+//   -O1  literals are decoded once into Constant nodes
+//   -O2  also folds constant binary operations and drops `if`/`for`
+//        statements whose condition is a known constant
+class Optimizer
+{
+public:
+     explicit Optimizer(int level);
+
+     Ast run(const Ast &source);
+
+private:
+     int level;
+     const Ast *in = nullptr;
+     Ast out;
+     std::vector<NodeId> pending;
+
+     NodeId make_node(NodeId original, size_t mark);
+     NodeId make_constant(NodeId original, const Literal &literal);
+     bool constant_value(NodeId node, Value &value) const;
+     bool to_literal(const Value &value, Literal &literal);
+
+     NodeId rewrite(NodeId node);
+     NodeId rewrite_literal(NodeId node);
+     NodeId rewrite_binary(NodeId node);
+     NodeId rewrite_function(NodeId node);
+     NodeId rewrite_block(NodeId block, bool keeps_value);
+     void rewrite_statement(NodeId stmt, bool is_last);
+};
+
+Value literal_to_value(const Literal &literal, const SymbolTable &symbols);
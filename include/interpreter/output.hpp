@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include "value.hpp"
+
+// Where script output ends up.
+class OutputSink
+{
+public:
+     virtual ~OutputSink() = default;
+     virtual void write(std::string_view data) = 0;
+     virtual void flush() {}
+};
+
+class StreamSink : public OutputSink
+{
+public:
+     explicit StreamSink(std::ostream &out) : out(out) {}
+
+     void write(std::string_view data) override { out.write(data.data(), static_cast<std::streamsize>(data.size())); }
+     void flush() override { out.flush(); }
+
+private:
+     std::ostream &out;
+};
+
+// When buffered output is handed to the sink:
+//   Line  after every completed line, like std::endl did
+//   Size  whenever the buffer is full
+//   Exit  only on flush() or destruction; the buffer grows as needed
+enum class FlushPolicy
+{
+     Line,
+     Size,
+     Exit,
+};
+
+// Buffers script output in front of a sink. Values are formatted straight
+// into the buffer, so printing never builds intermediate strings. Every
+// call takes a lock, and write_line emits a whole line under one lock, so
+// lines printed from pfor workers never interleave.
+class Output
+{
+public:
+     static constexpr size_t default_capacity = 64 * 1024;
+
+     explicit Output(std::unique_ptr<OutputSink> sink, size_t capacity = default_capacity);
+     ~Output();
+
+     Output(const Output &) = delete;
+     Output &operator=(const Output &) = delete;
+
+     void set_sink(std::unique_ptr<OutputSink> sink);
+     void set_policy(FlushPolicy policy);
+     void set_capacity(size_t capacity);
+
+     void write(std::string_view text);
+     void write(const Value &value);
+     void end_line();
+     void write_line(const std::vector<Value> &values);
+     void flush();
+
+private:
+     std::mutex mutex;
+     std::unique_ptr<OutputSink> sink;
+     std::string buffer;
+     size_t capacity;
+     FlushPolicy policy = FlushPolicy::Size;
+
+     void finish_line();
+     void flush_buffer();
+     void drain_if_full();
+};
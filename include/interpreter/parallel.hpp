@@ -0,0 +1,68 @@
+#pragma once
+#include <vector>
+#include <ast.hpp>
+#include "scope_manager.hpp"
+#include "script.hpp"
+
+class FunctionManager;
+class ThreadPool;
+
+// The variables a `pfor` statement runs against, owned by whichever engine
+// reached it. `frame` is the current function frame, or null at top level.
+struct ParallelScope
+{
+     std::vector<Slot> *globals;
+     Slot *frame;
+     size_t frame_size;
+};
+
+// Item assignments a worker made to shared arrays, tagged with the
+// iteration that made them. `shared` holds the ItemAssignment nodes whose
+// writes are recorded, sorted.
+struct ItemWriteLog
+{
+     struct Write
+     {
+          size_t iteration;
+          NodeId node;
+          Value index;
+          Value item;
+     };
+
+     std::vector<NodeId> shared;
+     size_t iteration = 0;
+     std::vector<Write> writes;
+
+     void record(NodeId node, const Value &index, const Value &item);
+};
+
+struct ParallelContext
+{
+     const Script *script;
+     FunctionManager *functions;
+     ThreadPool *pool;
+     size_t max_call_depth;
+     // The log of the worker running this pfor, when it is nested in another.
+     ItemWriteLog *item_log;
+};
+
+// Runs the body of the `pfor` statement `node` for every index from the
+// loop variable's current value up to `limit`, which both engines evaluate
+// before calling this. Each worker runs the body in a tree-walking
+// evaluator over its own copy of the variables, so:
+//   - outer variables are read as they were when the loop started;
+//   - a variable whose every assignment in the body has the form
+//     `x = x + e` or `x = x * e`, and which the body reads nowhere else,
+//     is a reduction: each worker accumulates from 0 or 1 and the partial
+//     results are folded into the outer value in worker order;
+//   - `a[k] = e` on an array the body never assigns as a whole writes
+//     through to the outer array: each worker records its item writes
+//     and they are replayed on the outer array in iteration order, so it
+//     ends as after a sequential loop. Until then a worker only sees its
+//     own writes. `push`, `pop` and `reserve` on such an array are an
+//     error, since they would change its length under the other workers;
+//   - every other write, including writes to globals made by called
+//     functions, stays private to the worker and is dropped afterwards.
+// The loop variable ends at the limit, as after a `for`. Float reductions
+// can round differently than a sequential loop.
+void run_parallel_for(const ParallelContext &context, ParallelScope scope, NodeId node, Value limit);
@@ -0,0 +1,107 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <ast.hpp>
+
+// Records where script time goes. Calls build a tree keyed by the chain of
+// function names leading to them, which is written out in collapsed-stack
+// format for flamegraph tools; per-function totals are kept alongside.
+// Engines only call into it when one is attached, so an interpreter
+// without a profiler pays one null check per call.
+//
+// A Profiler is not thread-safe, so pfor workers run without one: calls
+// and node hits inside a pfor body are not recorded, and the loop's whole
+// time counts as exclusive time of the function that runs it.
+class Profiler
+{
+public:
+     using Clock = std::chrono::steady_clock;
+
+     Profiler();
+
+     void enter(const std::string &function);
+     void leave();
+     // Leaves every call above `depth`; used when an error unwinds calls.
+     void unwind(size_t depth);
+     size_t depth() const { return stack.size(); }
+
+     void set_count_nodes(bool enabled) { count_nodes = enabled; }
+     bool counts_nodes() const { return count_nodes; }
+     void hit(const Ast &ast, NodeId node);
+
+     // "main;outer;inner <exclusive ns>" per call path.
+     void write_collapsed(std::ostream &out) const;
+     // Calls, inclusive and exclusive time per function, slowest first.
+     void write_summary(std::ostream &out) const;
+     // "script:line:column type hits" per evaluated node, hottest first.
+     void write_node_hits(std::ostream &out) const;
+
+private:
+     struct PathNode
+     {
+          PathNode(uint32_t function, uint32_t parent) : function(function), parent(parent) {}
+
+          uint32_t function;
+          uint32_t parent;
+          std::unordered_map<uint32_t, uint32_t> children;
+          uint64_t calls = 0;
+          Clock::duration exclusive{0};
+     };
+
+     struct FunctionStats
+     {
+          std::string name;
+          uint64_t calls = 0;
+          uint32_t active = 0;
+          Clock::duration inclusive{0};
+          Clock::duration exclusive{0};
+     };
+
+     struct Activation
+     {
+          uint32_t path;
+          Clock::time_point start;
+          Clock::duration children{0};
+     };
+
+     struct NodeHits
+     {
+          const Ast *ast;
+          std::vector<uint64_t> counts;
+     };
+
+     std::vector<PathNode> paths;
+     std::vector<FunctionStats> functions;
+     std::unordered_map<std::string, uint32_t> function_ids;
+     std::vector<Activation> stack;
+     std::vector<NodeHits> node_hits;
+     bool count_nodes = false;
+
+     uint32_t function_id(const std::string &name);
+     std::string path_name(uint32_t path) const;
+};
+
+// Brackets one call on an optional profiler.
+class ProfileScope
+{
+public:
+     ProfileScope(Profiler *profiler, const std::string &function) : profiler(profiler)
+     {
+          if (profiler)
+               profiler->enter(function);
+     }
+     ~ProfileScope()
+     {
+          if (profiler)
+               profiler->leave();
+     }
+     ProfileScope(const ProfileScope &) = delete;
+     ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+     Profiler *profiler;
+};
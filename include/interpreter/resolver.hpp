@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <ast.hpp>
+#include "script.hpp"
+
+class FunctionManager;
+
+// Assigns every variable reference a (depth, slot) pair before execution.
+// Functions get one frame holding their parameters followed by every name
+// they assign, store an element of, or pass to a native update such as
+// push; anything else they mention lives in the global frame.
+// Function frames nest directly in the global frame, so depth is 0 for
+// the current frame and 1 for globals seen from inside a function.
+// Global slots persist across scripts resolved by the same resolver.
+class Resolver
+{
+public:
+     explicit Resolver(const FunctionManager &functions);
+
+     Resolution resolve(const Ast &ast);
+
+     size_t global_count() const;
+     const std::vector<std::string> &global_names() const;
+
+private:
+     struct LocalMap
+     {
+          std::unordered_map<SymbolId, uint32_t> slots;
+          uint32_t size = 0;
+
+          void declare(SymbolId name);
+     };
+
+     const FunctionManager &functions;
+     std::unordered_map<std::string, uint32_t> globals;
+     std::vector<std::string> names;
+
+     const Ast *ast = nullptr;
+     Resolution *out = nullptr;
+     LocalMap *locals = nullptr;
+
+     uint32_t global_slot(std::string_view name);
+     void declare_locals(NodeId node, LocalMap &frame);
+     bool is_update(NodeId node) const;
+
+     void resolve_node(NodeId node);
+     void resolve_block(NodeId block);
+     void resolve_variable(NodeId node);
+     void resolve_function(NodeId node);
+     void check_parallel_body(NodeId node);
+};
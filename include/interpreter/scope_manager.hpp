@@ -1,22 +1,42 @@
 #pragma once
+#include <cstdint>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <vector>
 #include "value.hpp"
 
+struct Slot
+{
+     Value value;
+     bool defined = false;
+     // Skips the type check on reassignment. Set on pfor reduction
+     // partials, which may pass through whole values a flo sum never hits.
+     bool untyped = false;
+
+     void assign(Value v);
+};
+
 class ScopeManager
 {
 public:
-     void push_scope();
-     void pop_scope();
+     void resize_globals(size_t count);
+     void push_frame(size_t size);
+     void pop_frame();
+     size_t depth() const { return frames.size(); }
+
+     Slot &slot(uint32_t depth, uint32_t index);
+     const Value &get(uint32_t depth, uint32_t index, std::string_view name);
 
-     bool has(const std::string &name) const;
-     bool has_in_current(const std::string &name) const;
+     // The innermost frame, or null at top level.
+     std::vector<Slot> &global_slots() { return globals; }
+     Slot *frame_slots() { return frames.empty() ? nullptr : locals.data() + frames.back(); }
+     size_t frame_size() const { return frames.empty() ? 0 : locals.size() - frames.back(); }
 
-     void define(const std::string &name, const Value &value);
-     void set(const std::string &name, const Value &value);
-     Value get(const std::string &name) const;
+     // Replaces every frame with copies of the given slots.
+     void load(const std::vector<Slot> &global_copy, const Slot *frame, size_t frame_size);
 
 private:
-     std::vector<std::unordered_map<std::string, Value>> scopes;
+     std::vector<Slot> globals;
+     std::vector<Slot> locals;
+     std::vector<size_t> frames;
 };
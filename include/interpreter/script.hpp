@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <ast.hpp>
+#include "value.hpp"
+
+// Resolver output for one node: frame distance and slot of a variable
+// reference, or the frame size (in `slot`) of a function declaration.
+struct VarRef
+{
+     uint32_t depth = 0;
+     uint32_t slot = 0;
+};
+
+using Resolution = std::vector<VarRef>;
+
+// What TypeChecker proved about the values a node evaluates to. Number is
+// num or flo, since flo arithmetic gives a num when the result is whole;
+// Never means the node cannot produce a value at all.
+enum class StaticType : uint8_t
+{
+     Unknown,
+     Int,
+     Float,
+     Number,
+     Bool,
+     String,
+     Array,
+     Never,
+};
+
+// True when every value of a node typed `known` has type `type`, so the
+// runtime check against `type` can be skipped.
+inline bool proves(StaticType known, Value::Type type)
+{
+     switch (known)
+     {
+     case StaticType::Int:
+          return type == Value::Type::Int;
+     case StaticType::Float:
+          return type == Value::Type::Float;
+     case StaticType::Bool:
+          return type == Value::Type::Bool;
+     case StaticType::String:
+          return type == Value::Type::String;
+     case StaticType::Array:
+          return type == Value::Type::Array;
+     default:
+          return false;
+     }
+}
+
+// True for types that name exactly one runtime type.
+inline bool is_exact(StaticType type)
+{
+     return type != StaticType::Unknown && type != StaticType::Number && type != StaticType::Never;
+}
+
+struct FunctionEntry;
+
+// A parsed AST together with one interpreter's slot assignment for it and
+// its literal pool decoded into values. The AST itself is never modified
+// after parsing, so any number of interpreters may share it. `owner` is
+// empty when the caller keeps the AST alive itself, which spares a
+// reference count update on a cache line every sharing thread touches.
+// `call_targets` caches, per FunctionCall node, the entry the tree-walker
+// resolved the call to; pfor workers fill it concurrently. `types` holds
+// the TypeChecker result for each node, and `invariant_limits` marks the
+// `for` loops whose limit is evaluated once.
+struct Script
+{
+     std::shared_ptr<const Ast> owner;
+     const Ast *ast = nullptr;
+     Resolution resolution;
+     std::vector<StaticType> types;
+     std::vector<bool> invariant_limits;
+     std::vector<Value> constants;
+     mutable std::vector<std::atomic<const FunctionEntry *>> call_targets;
+};
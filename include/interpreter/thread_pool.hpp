@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Runs index ranges on a fixed set of workers. The range is cut into
+// chunks that are dealt out to per-worker queues in contiguous runs; a
+// worker takes its own chunks in order and, once they are gone, steals
+// from the far end of the others' queues. The calling thread is worker 0;
+// the other threads and the queues are only created by the first
+// parallel_for that needs them, so an unused pool costs nothing. One job
+// runs at a time, so parallel_for must not be called from inside a body.
+class ThreadPool
+{
+public:
+     // `workers` counts the calling thread; 0 means one per hardware thread.
+     explicit ThreadPool(size_t workers = 0);
+     ~ThreadPool();
+
+     ThreadPool(const ThreadPool &) = delete;
+     ThreadPool &operator=(const ThreadPool &) = delete;
+
+     size_t size() const { return worker_count; }
+
+     // Calls body(worker, begin, end) over [0, count) and returns once every
+     // chunk is done. After a body throws, chunks not yet started are
+     // skipped and the first exception is rethrown here.
+     using RangeBody = std::function<void(size_t worker, size_t begin, size_t end)>;
+     void parallel_for(size_t count, const RangeBody &body);
+
+private:
+     using Range = std::pair<size_t, size_t>;
+
+     struct Queue
+     {
+          std::mutex mutex;
+          std::deque<Range> ranges;
+     };
+
+     size_t worker_count;
+     std::vector<std::thread> threads;
+     std::vector<std::unique_ptr<Queue>> queues;
+
+     std::mutex mutex;
+     std::condition_variable wake;
+     std::condition_variable done;
+     uint64_t generation = 0;
+     size_t busy = 0;
+     bool stopping = false;
+
+     const RangeBody *job = nullptr;
+     std::mutex error_mutex;
+     std::exception_ptr error;
+     std::atomic<bool> failed{false};
+
+     void start();
+     void worker_loop(size_t worker);
+     void drain(size_t worker);
+     bool take(size_t worker, Range &range);
+};
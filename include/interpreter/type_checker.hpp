@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <ast.hpp>
+#include "script.hpp"
+
+class FunctionManager;
+
+// Infers a static type for every expression from literals and the types
+// declared on function signatures, and rejects a script before it runs if
+// it contains an operation that fails whenever it is reached: a call with
+// an argument of the wrong type or count, a `return` of the wrong type,
+// an assignment to a parameter of another type, an operator applied to
+// types it does not support, or indexing a value that is not an array.
+//
+// Only function locals get types: a local's type is the join of every
+// value assigned to it, since a slot keeps the type of its first value.
+// Globals can be assigned by any later script and stay Unknown. Calls are
+// checked against a signature only while it is the one declaration of
+// that name the checker has seen, and only if no native has that name,
+// since calls made before the declaration still reach the native.
+class TypeChecker
+{
+public:
+     explicit TypeChecker(const FunctionManager &functions);
+
+     // Returns the type of every node of `script`, indexed by node id.
+     std::vector<StaticType> check(const Script &script);
+
+private:
+     struct Signature
+     {
+          std::vector<Value::Type> param_types;
+          bool has_return_type = false;
+          Value::Type return_type = Value::Type::None;
+          uint32_t declarations = 0;
+     };
+
+     // Slot types of the function being checked, and the declared type of
+     // each parameter slot (Unknown for other locals).
+     struct Frame
+     {
+          std::vector<StaticType> slots;
+          std::vector<StaticType> declared;
+     };
+
+     const FunctionManager &functions;
+     std::unordered_map<std::string, Signature> signatures;
+
+     const Ast *ast = nullptr;
+     const Resolution *resolution = nullptr;
+     std::vector<StaticType> *types = nullptr;
+     Frame *frame = nullptr;
+     const Signature *function = nullptr;
+     // Errors are only reported once the local types are final.
+     bool final_pass = true;
+     bool changed = false;
+
+     Signature signature_of(NodeId decl) const;
+     void declare_functions(NodeId node);
+     void check_function(NodeId node);
+     [[noreturn]] void fail(NodeId node, const std::string &message) const;
+
+     StaticType infer(NodeId node);
+     void infer_block(NodeId block);
+     StaticType infer_binary(NodeId node);
+     void infer_call(NodeId node);
+     void infer_return(NodeId node);
+     void assign(NodeId var, StaticType type);
+     void assign_counter(NodeId head);
+};
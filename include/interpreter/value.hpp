@@ -1,12 +1,25 @@
 #pragma once
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <vector>
-#include <variant>
 
+// Header of a heap payload shared between values. Copying a value only
+// bumps the count; writers clone the payload first if it is shared.
+struct RefCounted
+{
+     std::atomic<uint32_t> refs{1};
+};
+
+// A 16-byte tagged value. Scalars are stored inline; strings and arrays
+// are reference-counted, copy-on-write heap payloads. Arrays whose
+// elements all have one scalar type are packed into a contiguous buffer of
+// that type and only widened to generic storage by a write that breaks
+// the pattern.
 class Value
 {
 public:
-     enum class Type
+     enum class Type : uint8_t
      {
           None,
           Int,
@@ -16,25 +29,122 @@ public:
           Array
      };
 
-     Value();
-     Value(int);
-     Value(double);
+     // How an array stores its elements.
+     enum class Elements : uint8_t
+     {
+          Mixed,
+          Int,
+          Float,
+          Bool,
+     };
+
+     Value() : kind(Type::None) { payload.i = 0; }
+     Value(int v) : kind(Type::Int) { payload.i = v; }
+     Value(int64_t v) : kind(Type::Int) { payload.i = v; }
+     Value(double v) : kind(Type::Float) { payload.f = v; }
+     Value(bool v) : kind(Type::Bool) { payload.b = v; }
+     Value(const char *);
      Value(const std::string &);
-     Value(bool);
+     Value(std::string &&);
      Value(const std::vector<Value> &);
+     Value(std::vector<Value> &&);
+     Value(std::vector<int64_t> &&);
+     Value(std::vector<double> &&);
+
+     Value(const Value &other) : payload(other.payload), kind(other.kind)
+     {
+          if (owns_heap())
+               payload.h->refs.fetch_add(1, std::memory_order_relaxed);
+     }
+     Value(Value &&other) noexcept : payload(other.payload), kind(other.kind)
+     {
+          other.kind = Type::None;
+     }
+     Value &operator=(const Value &other)
+     {
+          if (!owns_heap() && !other.owns_heap())
+          {
+               payload = other.payload;
+               kind = other.kind;
+               return *this;
+          }
+          return assign_heap(other);
+     }
+     Value &operator=(Value &&other) noexcept
+     {
+          if (this != &other)
+          {
+               if (owns_heap())
+                    release_heap();
+               payload = other.payload;
+               kind = other.kind;
+               other.kind = Type::None;
+          }
+          return *this;
+     }
+     ~Value()
+     {
+          if (owns_heap())
+               release_heap();
+     }
+
+     Type type() const { return kind; }
+
+     // Reading a payload of another type yields its zero value.
+     int64_t int_val() const { return kind == Type::Int ? payload.i : 0; }
+     double float_val() const { return kind == Type::Float ? payload.f : 0.0; }
+     bool bool_val() const { return kind == Type::Bool && payload.b; }
+     const std::string &str_val() const;
 
-     Type type;
+     // Array reads. `array_at` does not check bounds. The typed pointers
+     // are null unless the array is packed with that element type.
+     size_t array_size() const;
+     Value array_at(size_t index) const;
+     Elements array_elements() const;
+     const int64_t *int_elements() const;
+     const double *float_elements() const;
+     const uint8_t *bool_elements() const;
 
-     int int_val;
-     double float_val;
-     std::string str_val;
-     bool bool_val;
-     std::vector<Value> array_val;
+     // Writable access; detaches the payload first when it is shared.
+     // mutable_array() converts packed arrays to generic storage, while
+     // the others keep them packed if the new element fits. An empty
+     // array takes the element type of its first pushed item.
+     std::string &mutable_str();
+     std::vector<Value> &mutable_array();
+     void set_array_item(size_t index, Value item);
+     void push_array_item(Value item);
+     // Does not check that the array is non-empty.
+     Value pop_array_item();
+     void reserve_array(size_t capacity);
 
      bool is_number() const;
      bool is_array() const;
 
      std::string to_string() const;
+     // Appends the same text to_string() returns, without temporaries.
+     void append_to(std::string &out) const;
      void check_type(Type expected) const;
      static Type string_to_type(const std::string &type_str);
+
+private:
+     struct StringCell;
+     struct ArrayCell;
+
+     union Payload
+     {
+          int64_t i;
+          double f;
+          bool b;
+          RefCounted *h;
+          StringCell *s;
+          ArrayCell *a;
+     } payload;
+     Type kind;
+
+     bool owns_heap() const { return kind == Type::String || kind == Type::Array; }
+     void release_heap();
+     ArrayCell &writable_array();
+     Value &assign_heap(const Value &other);
 };
+
+static_assert(sizeof(Value) <= 16, "Value must stay within two machine words");
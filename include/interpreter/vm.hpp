@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+#include "bytecode.hpp"
+#include "function_manager.hpp"
+#include "scope_manager.hpp"
+
+class Profiler;
+class ThreadPool;
+
+constexpr size_t default_vm_call_depth = 10000;
+
+// Runs compiled programs on heap-allocated frames, so script recursion
+// never grows the native stack. `return f(...)` reuses the caller's frame.
+class VM
+{
+public:
+     explicit VM(FunctionManager &func_mgr);
+
+     void run(const Program &program);
+     void set_max_call_depth(size_t depth);
+     void set_profiler(Profiler *profiler);
+     void set_thread_pool(ThreadPool *pool);
+
+private:
+     struct CallFrame
+     {
+          const FunctionProto *function;
+          size_t ip;
+          size_t locals_base;
+          size_t stack_base;
+          bool check_result = false;
+          Value::Type result_type = Value::Type::None;
+     };
+
+     FunctionManager &function_manager;
+     size_t max_call_depth = default_vm_call_depth;
+     Profiler *profiler = nullptr;
+     ThreadPool *pool = nullptr;
+
+     std::vector<Value> stack;
+     std::vector<Slot> locals;
+     std::vector<Slot> globals;
+     std::vector<CallFrame> frames;
+
+     std::vector<const FunctionProto *> functions;
+     std::vector<const FunctionEntry *> entries;
+     std::vector<const FunctionManager::NativeFunc *> natives;
+     std::vector<const NativeUpdate *> updates;
+     std::vector<Value> native_args;
+
+     void execute(const Program &program);
+     Value pop();
+     Value binary(OpCode op, const Value &lhs, const Value &rhs) const;
+     static Value int_binary(OpCode op, int64_t lhs, int64_t rhs);
+     // The limit of a loop as a num, once both bounds are checked.
+     static int64_t for_limit(const Value &current, Value limit);
+     bool carry_result_check(CallFrame &frame, const FunctionProto &function) const;
+};
@@ -1,29 +1,34 @@
 #pragma once
 
+#include <memory>
 #include <string>
-#include <unordered_set>
+#include <string_view>
+#include "source.hpp"
 #include "token.hpp"
 
+// Token values are views into the source buffer, which the lexer keeps
+// alive; nothing is copied per token.
 class Lexer
 {
 public:
-     static const std::unordered_set<std::string> control_keywords;
-     static const std::unordered_set<std::string> types;
-     static const std::string function_keyword;
+     static const std::string_view function_keyword;
 
      explicit Lexer(std::string source);
+     explicit Lexer(std::shared_ptr<const SourceBuffer> buffer);
 
      Token next_token();
      void reset();
 
 private:
-     std::string source;
+     std::shared_ptr<const SourceBuffer> buffer;
+     std::string_view source;
      size_t pos = 0;
      size_t line = 1;
      size_t column = 1;
 
      char peek() const;
      char get();
+     std::string_view slice(size_t start) const;
      void skip_whitespace();
-     bool is_keyword(const std::string &str) const;
+     static bool is_type_name(std::string_view word);
 };
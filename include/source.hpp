@@ -0,0 +1,30 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Read-only script text. Tokens are views into it, so it has to outlive
+// lexing and parsing; the AST copies what it keeps into its symbol table.
+// Files are mapped with mmap where the platform has it and read into
+// memory otherwise.
+class SourceBuffer
+{
+public:
+     static std::shared_ptr<const SourceBuffer> from_string(std::string text);
+     static std::shared_ptr<const SourceBuffer> map_file(const std::string &path);
+
+     SourceBuffer(const SourceBuffer &) = delete;
+     SourceBuffer &operator=(const SourceBuffer &) = delete;
+     ~SourceBuffer();
+
+     std::string_view text() const { return {data, size}; }
+     bool is_mapped() const { return mapped; }
+
+private:
+     SourceBuffer() = default;
+
+     std::string owned;
+     const char *data = "";
+     size_t size = 0;
+     bool mapped = false;
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <string_view>
 
@@ -18,6 +19,7 @@ enum class TokenType
      OfType,
      Else,
      For,
+     ParallelFor,
      Return,
 
      Operator,
@@ -27,12 +29,37 @@ enum class TokenType
      Unknown
 };
 
+// Operators are decoded once by the lexer; everything downstream
+// dispatches on this enum instead of comparing operator text.
+enum class Operator : uint8_t
+{
+     None,
+     Add,
+     Sub,
+     Mul,
+     Div,
+     Equal,
+     NotEqual,
+     Less,
+     LessEqual,
+     Greater,
+     GreaterEqual,
+     And,
+     Or,
+     Assign,
+     Not,
+};
+
+Operator operator_from_string(std::string_view text);
+const char *to_string(Operator op);
+
 struct Token
 {
      TokenType type;
-     std::string value;
+     std::string_view value;
      size_t line;
      size_t column;
+     Operator op = Operator::None;
 
      std::string to_string() const;
 };
@@ -1,118 +1,302 @@
+#include "ast_cache.hpp"
 #include "lexer.hpp"
 #include "parser.hpp"
+#include "source.hpp"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <vector>
+#include <unistd.h>
 #include <interpreter/interpreter.hpp>
+#include <interpreter/optimizer.hpp>
+#include <interpreter/profiler.hpp>
 
-std::string Token::to_string() const
-{
-     std::string type_str;
-     switch (type)
-     {
-     case TokenType::Identifier:
-          type_str = "Identifier";
-          break;
-     case TokenType::Function:
-          type_str = "Function";
-          break;
-     case TokenType::Type:
-          type_str = "Type";
-          break;
-     case TokenType::If:
-          type_str = "If";
-          break;
-     case TokenType::Else:
-          type_str = "Else";
-          break;
-     case TokenType::For:
-          type_str = "For";
-          break;
-     case TokenType::Return:
-          type_str = "Return";
-          break;
-     case TokenType::Boolean:
-          type_str = "Boolean";
-          break;
-     case TokenType::Integer:
-          type_str = "Integer";
-          break;
-     case TokenType::Float:
-          type_str = "Float";
-          break;
-     case TokenType::String:
-          type_str = "String";
-          break;
-     case TokenType::Operator:
-          type_str = "Operator";
-          break;
-     case TokenType::Punctuation:
-          type_str = "Punctuation";
-          break;
-     case TokenType::EndOfFile:
-          type_str = "EOF";
-          break;
-     case TokenType::OfType:
-          type_str = "OfType";
-          break;
-     case TokenType::Unknown:
-          type_str = "Unknown";
-          break;
-     }
-
-     return type_str + "('" + value + "') at " +
-            std::to_string(line) + ":" + std::to_string(column);
-}
-
-// void print_ast(const std::shared_ptr<ASTNode> &node, int indent = 0)
+// void print_ast(const Ast &ast, NodeId node, int indent = 0)
 // {
 //      std::string pad(indent, ' ');
-//      std::cout << pad << node_type_to_string(node->type);
-//      if (!node->value.empty())
-//           std::cout << ": " << node->value;
+//      std::cout << pad << node_type_to_string(ast.type(node));
+//      if (!ast.text(node).empty())
+//           std::cout << ": " << ast.text(node);
 //      std::cout << "\n";
 
-//      for (const auto &child : node->children)
+//      for (NodeId child : ast.children(node))
 //      {
-//           print_ast(child, indent + 2);
+//           print_ast(ast, child, indent + 2);
 //      }
 // }
 
-int main()
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+     ExecutionMode mode = ExecutionMode::Bytecode;
+     bool dump_bytecode = false;
+     bool time = false;
+     bool stats = false;
+     int opt_level = 2;
+     size_t max_depth = 0;
+     size_t threads = 0;
+     bool jit = true;
+     FlushPolicy flush = FlushPolicy::Size;
+     bool flush_set = false;
+     std::string profile_path;
+     std::string node_profile_path;
+     std::string cache_dir;
+     std::vector<std::string> scripts;
+};
+
+void print_usage(const char *program)
+{
+     std::cerr << "Usage: " << program
+               << " [--engine=vm|tree] [-O0|-O1|-O2] [--max-depth=N] [--threads=N] [--jit=on|off] [--dump-bytecode] [--time] [--stats]"
+                  " [--profile=FILE] [--profile-nodes=FILE] [--flush=line|size|exit] [--cache=DIR]"
+                  " [script... | -]\n"
+                  "Runs each script in order in one interpreter; with no script, or '-', reads stdin.\n"
+                  "--max-depth limits how deeply script calls nest; the default is "
+               << default_vm_call_depth << " on the VM and " << default_tree_call_depth
+               << " on the tree engine,\n"
+                  "which also stops where the thread's native stack runs out.\n"
+                  "--profile writes collapsed call stacks for flamegraphs and prints per-function times;\n"
+                  "--profile-nodes writes per-node hit counts (tree engine only). Neither records pfor bodies.\n"
+                  "--threads sets how many threads pfor loops use; the default is one per hardware thread.\n"
+                  "--jit=off keeps hot numeric functions interpreted instead of compiling them to native code.\n"
+                  "--cache keeps parsed scripts in DIR and reuses them while the source is unchanged.\n"
+                  "--flush picks when script output is written; the default is line on a terminal, size otherwise.\n";
+}
+
+std::shared_ptr<const SourceBuffer> load(const std::string &path)
+{
+     if (path != "-")
+          return SourceBuffer::map_file(path);
+     std::string text(std::istreambuf_iterator<char>(std::cin), {});
+     return SourceBuffer::from_string(std::move(text));
+}
+
+size_t count_tokens(const std::shared_ptr<const SourceBuffer> &source)
+{
+     Lexer lexer(source);
+     size_t count = 0;
+     while (lexer.next_token().type != TokenType::EndOfFile)
+          count++;
+     return count;
+}
+
+void report_time(const char *phase, Clock::duration elapsed)
+{
+     double ms = std::chrono::duration<double, std::milli>(elapsed).count();
+     std::fprintf(stderr, "time\t%-9s\t%.3f ms\n", phase, ms);
+}
+
+void report_stat(const char *name, size_t value)
+{
+     std::fprintf(stderr, "stats\t%-12s\t%zu\n", name, value);
+}
+
+// Lexing normally happens on demand inside the parser; with --time or
+// --stats the source is also lexed once on its own so that phase can be
+// measured separately. With --cache, a hit skips lexing, parsing and
+// optimizing altogether; a miss does them and saves the result.
+void run_script(Interpreter &interpreter, const std::string &path, const Options &options)
 {
-     std::string code = R"(fn mul_nums(x: flo, y: num) num (
-    return (x+y)*2;
-)
-
-fn fact(n: num) num (
-    if (n <= 1) (
-        return 1;
-    )
-    return n*fact(n-1);
-)
-
-fn silly(s: str) (
-     for(i=0; 10) (
-          cout(s);
-     )
-)
-
-x = [15, 2, 3, 4];
-
-for(i=0; x) (
-     cout(x[i]);
-)
-
-cout(x);
-cout(mul_nums(3.0, 2));
-cout(fact(5));
-cout(x[0]);
-silly('mememememe');
-)";
-
-     Lexer lexer(code);
-     Parser parser(lexer);
-     Interpreter interpreter;
-     auto ast = parser.parse();
+     auto start = Clock::now();
+     auto source = load(path);
+     auto loaded = Clock::now();
+
+     AstCacheKey key;
+     std::string cache_path;
+     std::optional<Ast> cached;
+     if (!options.cache_dir.empty())
+     {
+          key = ast_cache_key(source->text(), options.opt_level);
+          cache_path = ast_cache_path(options.cache_dir, key);
+          cached = load_ast_cache(cache_path, key);
+     }
+     auto probed = Clock::now();
+
+     size_t tokens = 0;
+     if (!cached && (options.time || options.stats))
+          tokens = count_tokens(source);
+     auto lexed = Clock::now();
+
+     std::shared_ptr<const Ast> ast;
+     auto parse_done = lexed;
+     if (cached)
+          ast = std::make_shared<const Ast>(std::move(*cached));
+     else
+     {
+          Parser parser{Lexer(source)};
+          Ast parsed = parser.parse();
+          parse_done = Clock::now();
+          if (options.opt_level > 0)
+               parsed = Optimizer(options.opt_level).run(parsed);
+          ast = std::make_shared<const Ast>(std::move(parsed));
+          if (!cache_path.empty())
+          {
+               try
+               {
+                    save_ast_cache(cache_path, *ast, key);
+               }
+               catch (const std::runtime_error &e)
+               {
+                    std::cerr << "warning: " << e.what() << "\n";
+               }
+          }
+     }
+     auto optimized = Clock::now();
+
      interpreter.interpret(ast);
+     auto finished = Clock::now();
+     if (options.time || options.stats)
+          interpreter.output().flush();
+
+     const InterpretStats &run = interpreter.last_stats();
+     if (options.time)
+     {
+          report_time("load", loaded - start);
+          if (!cache_path.empty())
+               report_time("cache", probed - loaded);
+          report_time("lex", lexed - probed);
+          report_time("parse", parse_done - lexed);
+          report_time("optimize", optimized - parse_done);
+          report_time("resolve", run.resolve);
+          report_time("check", run.check);
+          if (options.mode == ExecutionMode::Bytecode)
+               report_time("compile", run.compile);
+          report_time("execute", run.execute);
+          report_time("total", finished - start);
+     }
+     if (options.stats)
+     {
+          report_stat("source_bytes", source->text().size());
+          report_stat("mapped", source->is_mapped() ? 1 : 0);
+          if (!cache_path.empty())
+               report_stat("cache_hit", cached ? 1 : 0);
+          report_stat("tokens", tokens);
+          report_stat("ast_nodes", ast->size());
+          report_stat("symbols", ast->symbols().size());
+          report_stat("literals", ast->literals().size());
+          if (options.mode == ExecutionMode::Bytecode)
+               report_stat("instructions", run.instructions);
+     }
+}
+}
+
+int main(int argc, char **argv)
+{
+     Options options;
+     for (int i = 1; i < argc; ++i)
+     {
+          std::string arg = argv[i];
+          if (arg == "--engine=vm")
+               options.mode = ExecutionMode::Bytecode;
+          else if (arg == "--engine=tree")
+               options.mode = ExecutionMode::TreeWalker;
+          else if (arg == "--dump-bytecode")
+               options.dump_bytecode = true;
+          else if (arg == "--time")
+               options.time = true;
+          else if (arg == "--stats")
+               options.stats = true;
+          else if (arg == "-O0" || arg == "-O1" || arg == "-O2")
+               options.opt_level = arg[2] - '0';
+          else if (arg.rfind("--max-depth=", 0) == 0)
+               options.max_depth = std::strtoul(arg.c_str() + 12, nullptr, 10);
+          else if (arg.rfind("--threads=", 0) == 0)
+               options.threads = std::strtoul(arg.c_str() + 10, nullptr, 10);
+          else if (arg == "--flush=line" || arg == "--flush=size" || arg == "--flush=exit")
+          {
+               options.flush = arg == "--flush=line"   ? FlushPolicy::Line
+                               : arg == "--flush=size" ? FlushPolicy::Size
+                                                       : FlushPolicy::Exit;
+               options.flush_set = true;
+          }
+          else if (arg.rfind("--profile=", 0) == 0)
+               options.profile_path = arg.substr(10);
+          else if (arg.rfind("--profile-nodes=", 0) == 0)
+               options.node_profile_path = arg.substr(16);
+          else if (arg == "--jit=on" || arg == "--jit=off")
+               options.jit = arg == "--jit=on";
+          else if (arg.rfind("--cache=", 0) == 0)
+               options.cache_dir = arg.substr(8);
+          else if (arg == "-h" || arg == "--help")
+          {
+               print_usage(argv[0]);
+               return 0;
+          }
+          else if (arg == "-" || arg[0] != '-')
+               options.scripts.push_back(arg);
+          else
+          {
+               std::cerr << "Unknown option: " << arg << "\n";
+               print_usage(argv[0]);
+               return 1;
+          }
+     }
+     if (options.scripts.empty())
+          options.scripts.push_back("-");
+
+     if (!options.cache_dir.empty())
+     {
+          std::error_code error;
+          std::filesystem::create_directories(options.cache_dir, error);
+     }
+
+     Interpreter interpreter(options.mode);
+     interpreter.set_dump_bytecode(options.dump_bytecode);
+     if (!options.flush_set && isatty(STDOUT_FILENO))
+          options.flush = FlushPolicy::Line;
+     interpreter.output().set_policy(options.flush);
+     if (options.max_depth > 0)
+          interpreter.set_max_call_depth(options.max_depth);
+     if (options.threads > 0)
+          interpreter.set_threads(options.threads);
+     interpreter.set_jit(options.jit);
+
+     Profiler profiler;
+     bool profiling = !options.profile_path.empty() || !options.node_profile_path.empty();
+     if (profiling)
+     {
+          profiler.set_count_nodes(!options.node_profile_path.empty());
+          interpreter.set_profiler(&profiler);
+     }
 
-     return 0;
+     int status = 0;
+     for (const auto &path : options.scripts)
+     {
+          try
+          {
+               run_script(interpreter, path, options);
+          }
+          catch (const std::exception &e)
+          {
+               interpreter.output().flush();
+               std::cerr << (path == "-" ? "<stdin>" : path) << ": error: " << e.what() << "\n";
+               status = 1;
+               break;
+          }
+     }
+
+     interpreter.output().flush();
+     if (profiling)
+     {
+          profiler.write_summary(std::cerr);
+          if (!options.profile_path.empty())
+          {
+               std::ofstream out(options.profile_path);
+               profiler.write_collapsed(out);
+          }
+          if (!options.node_profile_path.empty())
+          {
+               std::ofstream out(options.node_profile_path);
+               profiler.write_node_hits(out);
+          }
+     }
+     return status;
 }
@@ -0,0 +1,453 @@
+#include "interpreter/array_kernels.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define KARAMEL_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace
+{
+// Exact integer totals are kept in 128 bits, which sums of int64 values
+// cannot overflow for any array that fits in memory.
+__extension__ typedef __int128 wide;
+
+bool narrow(wide total, int64_t *out)
+{
+     if (total < INT64_MIN || total > INT64_MAX)
+          return false;
+     *out = static_cast<int64_t>(total);
+     return true;
+}
+
+namespace scalar
+{
+wide exact_sum(const int64_t *p, size_t n)
+{
+     wide total = 0;
+     for (size_t i = 0; i < n; ++i)
+          total += p[i];
+     return total;
+}
+
+bool sum_int(const int64_t *p, size_t n, int64_t *out)
+{
+     return narrow(exact_sum(p, n), out);
+}
+
+double sum_float(const double *p, size_t n)
+{
+     double total = 0;
+     for (size_t i = 0; i < n; ++i)
+          total += p[i];
+     return total;
+}
+
+template <typename T>
+T min_of(const T *p, size_t n)
+{
+     T best = p[0];
+     for (size_t i = 1; i < n; ++i)
+          best = p[i] < best ? p[i] : best;
+     return best;
+}
+
+template <typename T>
+T max_of(const T *p, size_t n)
+{
+     T best = p[0];
+     for (size_t i = 1; i < n; ++i)
+          best = p[i] > best ? p[i] : best;
+     return best;
+}
+
+bool dot_int(const int64_t *a, const int64_t *b, size_t n, int64_t *out)
+{
+     // A product always fits in 128 bits but a few of them summed may not,
+     // so count the times the running total wraps; the exact total is
+     // total + wraps * 2^128, which only fits in 64 bits when wraps is 0.
+     wide total = 0;
+     int64_t wraps = 0;
+     for (size_t i = 0; i < n; ++i)
+     {
+          wide product = wide(a[i]) * b[i];
+          if (__builtin_add_overflow(total, product, &total))
+               wraps += product > 0 ? 1 : -1;
+     }
+     return wraps == 0 && narrow(total, out);
+}
+
+double dot_float(const double *a, const double *b, size_t n)
+{
+     double total = 0;
+     for (size_t i = 0; i < n; ++i)
+          total += a[i] * b[i];
+     return total;
+}
+
+bool scale_int(const int64_t *p, size_t n, int64_t k, int64_t *out)
+{
+     for (size_t i = 0; i < n; ++i)
+          if (__builtin_mul_overflow(p[i], k, &out[i]))
+               return false;
+     return true;
+}
+
+void scale_float(const double *p, size_t n, double k, double *out)
+{
+     for (size_t i = 0; i < n; ++i)
+          out[i] = p[i] * k;
+}
+
+bool add_int(const int64_t *a, const int64_t *b, size_t n, int64_t *out)
+{
+     for (size_t i = 0; i < n; ++i)
+          if (__builtin_add_overflow(a[i], b[i], &out[i]))
+               return false;
+     return true;
+}
+
+void add_float(const double *a, const double *b, size_t n, double *out)
+{
+     for (size_t i = 0; i < n; ++i)
+          out[i] = a[i] + b[i];
+}
+
+const ArrayKernels table = {
+    "scalar",
+    sum_int,
+    sum_float,
+    min_of<int64_t>,
+    min_of<double>,
+    max_of<int64_t>,
+    max_of<double>,
+    dot_int,
+    dot_float,
+    scale_int,
+    scale_float,
+    add_int,
+    add_float,
+};
+}
+
+#ifdef KARAMEL_X86_KERNELS
+// SSE2 is part of the x86-64 baseline, so these need no runtime check.
+// It has no 64-bit multiply or compare, so dot_int, scale_int and the
+// integer min/max stay scalar.
+namespace sse2
+{
+// The sign bit of each lane of a + b = r is set where the add overflowed.
+__m128i overflowed(__m128i a, __m128i b, __m128i r)
+{
+     return _mm_and_si128(_mm_xor_si128(a, r), _mm_xor_si128(b, r));
+}
+
+bool any_sign(__m128i v)
+{
+     return _mm_movemask_pd(_mm_castsi128_pd(v)) != 0;
+}
+
+double lanes_sum(__m128d v)
+{
+     return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+// Partial sums that overflow a lane are redone exactly, since the total
+// may still fit.
+bool sum_int(const int64_t *p, size_t n, int64_t *out)
+{
+     __m128i acc = _mm_setzero_si128(), overflow = _mm_setzero_si128();
+     size_t i = 0;
+     for (; i + 2 <= n; i += 2)
+     {
+          __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+          __m128i next = _mm_add_epi64(acc, v);
+          overflow = _mm_or_si128(overflow, overflowed(acc, v, next));
+          acc = next;
+     }
+     if (any_sign(overflow))
+          return scalar::sum_int(p, n, out);
+     alignas(16) int64_t lanes[2];
+     _mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc);
+     return narrow(wide(lanes[0]) + lanes[1] + scalar::exact_sum(p + i, n - i), out);
+}
+
+double sum_float(const double *p, size_t n)
+{
+     __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+     size_t i = 0;
+     for (; i + 4 <= n; i += 4)
+     {
+          acc0 = _mm_add_pd(acc0, _mm_loadu_pd(p + i));
+          acc1 = _mm_add_pd(acc1, _mm_loadu_pd(p + i + 2));
+     }
+     return lanes_sum(_mm_add_pd(acc0, acc1)) + scalar::sum_float(p + i, n - i);
+}
+
+template <bool Max>
+double extreme_float(const double *p, size_t n)
+{
+     if (n < 2)
+          return p[0];
+     __m128d best = _mm_loadu_pd(p);
+     size_t i = 2;
+     for (; i + 2 <= n; i += 2)
+          best = Max ? _mm_max_pd(best, _mm_loadu_pd(p + i)) : _mm_min_pd(best, _mm_loadu_pd(p + i));
+     alignas(16) double lanes[2];
+     _mm_store_pd(lanes, best);
+     double result = Max ? scalar::max_of(lanes, 2) : scalar::min_of(lanes, 2);
+     for (; i < n; ++i)
+          result = Max ? (p[i] > result ? p[i] : result) : (p[i] < result ? p[i] : result);
+     return result;
+}
+
+double dot_float(const double *a, const double *b, size_t n)
+{
+     __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+     size_t i = 0;
+     for (; i + 4 <= n; i += 4)
+     {
+          acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+          acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+     }
+     return lanes_sum(_mm_add_pd(acc0, acc1)) + scalar::dot_float(a + i, b + i, n - i);
+}
+
+void scale_float(const double *p, size_t n, double k, double *out)
+{
+     __m128d factor = _mm_set1_pd(k);
+     size_t i = 0;
+     for (; i + 2 <= n; i += 2)
+          _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(p + i), factor));
+     scalar::scale_float(p + i, n - i, k, out + i);
+}
+
+bool add_int(const int64_t *a, const int64_t *b, size_t n, int64_t *out)
+{
+     __m128i overflow = _mm_setzero_si128();
+     size_t i = 0;
+     for (; i + 2 <= n; i += 2)
+     {
+          __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+          __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+          __m128i r = _mm_add_epi64(x, y);
+          overflow = _mm_or_si128(overflow, overflowed(x, y, r));
+          _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), r);
+     }
+     return !any_sign(overflow) && scalar::add_int(a + i, b + i, n - i, out + i);
+}
+
+void add_float(const double *a, const double *b, size_t n, double *out)
+{
+     size_t i = 0;
+     for (; i + 2 <= n; i += 2)
+          _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+     scalar::add_float(a + i, b + i, n - i, out + i);
+}
+
+const ArrayKernels table = {
+    "sse2",
+    sum_int,
+    sum_float,
+    scalar::min_of<int64_t>,
+    extreme_float<false>,
+    scalar::max_of<int64_t>,
+    extreme_float<true>,
+    scalar::dot_int,
+    dot_float,
+    scalar::scale_int,
+    scale_float,
+    add_int,
+    add_float,
+};
+}
+
+// Compiled with a per-function target attribute so the rest of the build
+// keeps the baseline instruction set; only reached after a CPU check.
+#define KARAMEL_AVX2 __attribute__((target("avx2")))
+
+// AVX2 has no 64-bit multiply either, so dot_int and scale_int stay scalar.
+namespace avx2
+{
+KARAMEL_AVX2 __m256i overflowed(__m256i a, __m256i b, __m256i r)
+{
+     return _mm256_and_si256(_mm256_xor_si256(a, r), _mm256_xor_si256(b, r));
+}
+
+KARAMEL_AVX2 bool any_sign(__m256i v)
+{
+     return _mm256_movemask_pd(_mm256_castsi256_pd(v)) != 0;
+}
+
+KARAMEL_AVX2 double lanes_sum(__m256d v)
+{
+     __m128d half = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+     return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+}
+
+KARAMEL_AVX2 bool sum_int(const int64_t *p, size_t n, int64_t *out)
+{
+     __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+     __m256i overflow0 = _mm256_setzero_si256(), overflow1 = _mm256_setzero_si256();
+     size_t i = 0;
+     for (; i + 8 <= n; i += 8)
+     {
+          __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+          __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i + 4));
+          __m256i next0 = _mm256_add_epi64(acc0, v0);
+          __m256i next1 = _mm256_add_epi64(acc1, v1);
+          overflow0 = _mm256_or_si256(overflow0, overflowed(acc0, v0, next0));
+          overflow1 = _mm256_or_si256(overflow1, overflowed(acc1, v1, next1));
+          acc0 = next0;
+          acc1 = next1;
+     }
+     if (any_sign(_mm256_or_si256(overflow0, overflow1)))
+          return scalar::sum_int(p, n, out);
+     alignas(32) int64_t lanes[8];
+     _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc0);
+     _mm256_store_si256(reinterpret_cast<__m256i *>(lanes + 4), acc1);
+     return narrow(scalar::exact_sum(lanes, 8) + scalar::exact_sum(p + i, n - i), out);
+}
+
+KARAMEL_AVX2 double sum_float(const double *p, size_t n)
+{
+     __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+     size_t i = 0;
+     for (; i + 8 <= n; i += 8)
+     {
+          acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(p + i));
+          acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(p + i + 4));
+     }
+     return lanes_sum(_mm256_add_pd(acc0, acc1)) + scalar::sum_float(p + i, n - i);
+}
+
+// There is no 64-bit min/max below AVX-512; select through a compare mask.
+template <bool Max>
+KARAMEL_AVX2 int64_t extreme_int(const int64_t *p, size_t n)
+{
+     if (n < 4)
+          return Max ? scalar::max_of(p, n) : scalar::min_of(p, n);
+     __m256i best = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+     size_t i = 4;
+     for (; i + 4 <= n; i += 4)
+     {
+          __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+          __m256i take = Max ? _mm256_cmpgt_epi64(v, best) : _mm256_cmpgt_epi64(best, v);
+          best = _mm256_blendv_epi8(best, v, take);
+     }
+     alignas(32) int64_t lanes[4];
+     _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), best);
+     int64_t result = Max ? scalar::max_of(lanes, 4) : scalar::min_of(lanes, 4);
+     for (; i < n; ++i)
+          result = Max ? (p[i] > result ? p[i] : result) : (p[i] < result ? p[i] : result);
+     return result;
+}
+
+template <bool Max>
+KARAMEL_AVX2 double extreme_float(const double *p, size_t n)
+{
+     if (n < 4)
+          return Max ? scalar::max_of(p, n) : scalar::min_of(p, n);
+     __m256d best = _mm256_loadu_pd(p);
+     size_t i = 4;
+     for (; i + 4 <= n; i += 4)
+          best = Max ? _mm256_max_pd(best, _mm256_loadu_pd(p + i)) : _mm256_min_pd(best, _mm256_loadu_pd(p + i));
+     alignas(32) double lanes[4];
+     _mm256_store_pd(lanes, best);
+     double result = Max ? scalar::max_of(lanes, 4) : scalar::min_of(lanes, 4);
+     for (; i < n; ++i)
+          result = Max ? (p[i] > result ? p[i] : result) : (p[i] < result ? p[i] : result);
+     return result;
+}
+
+KARAMEL_AVX2 double dot_float(const double *a, const double *b, size_t n)
+{
+     __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+     size_t i = 0;
+     for (; i + 8 <= n; i += 8)
+     {
+          acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+          acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+     }
+     return lanes_sum(_mm256_add_pd(acc0, acc1)) + scalar::dot_float(a + i, b + i, n - i);
+}
+
+KARAMEL_AVX2 void scale_float(const double *p, size_t n, double k, double *out)
+{
+     __m256d factor = _mm256_set1_pd(k);
+     size_t i = 0;
+     for (; i + 4 <= n; i += 4)
+          _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(p + i), factor));
+     scalar::scale_float(p + i, n - i, k, out + i);
+}
+
+KARAMEL_AVX2 bool add_int(const int64_t *a, const int64_t *b, size_t n, int64_t *out)
+{
+     __m256i overflow = _mm256_setzero_si256();
+     size_t i = 0;
+     for (; i + 4 <= n; i += 4)
+     {
+          __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+          __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+          __m256i r = _mm256_add_epi64(x, y);
+          overflow = _mm256_or_si256(overflow, overflowed(x, y, r));
+          _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), r);
+     }
+     return !any_sign(overflow) && scalar::add_int(a + i, b + i, n - i, out + i);
+}
+
+KARAMEL_AVX2 void add_float(const double *a, const double *b, size_t n, double *out)
+{
+     size_t i = 0;
+     for (; i + 4 <= n; i += 4)
+          _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+     scalar::add_float(a + i, b + i, n - i, out + i);
+}
+
+const ArrayKernels table = {
+    "avx2",
+    sum_int,
+    sum_float,
+    extreme_int<false>,
+    extreme_float<false>,
+    extreme_int<true>,
+    extreme_float<true>,
+    scalar::dot_int,
+    dot_float,
+    scalar::scale_int,
+    scale_float,
+    add_int,
+    add_float,
+};
+}
+#endif
+
+const ArrayKernels &select_kernels()
+{
+#ifdef KARAMEL_X86_KERNELS
+     __builtin_cpu_init();
+     if (__builtin_cpu_supports("avx2"))
+          return avx2::table;
+     return sse2::table;
+#else
+     return scalar::table;
+#endif
+}
+}
+
+const ArrayKernels &array_kernels()
+{
+     static const ArrayKernels &selected = select_kernels();
+     return selected;
+}
+
+std::vector<const ArrayKernels *> all_array_kernels()
+{
+     std::vector<const ArrayKernels *> tables{&scalar::table};
+#ifdef KARAMEL_X86_KERNELS
+     tables.push_back(&sse2::table);
+     __builtin_cpu_init();
+     if (__builtin_cpu_supports("avx2"))
+          tables.push_back(&avx2::table);
+#endif
+     return tables;
+}
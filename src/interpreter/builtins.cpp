@@ -1,12 +1,280 @@
 #include "interpreter/builtins.hpp"
-#include <iostream>
+#include "interpreter/array_kernels.hpp"
+#include <stdexcept>
+#include <string>
 
-Value builtin_cout(const std::vector<Value> &args)
+Value builtin_cout(Output &out, const std::vector<Value> &args)
 {
-     for (const auto &arg : args)
+     out.write_line(args);
+     return Value();
+}
+
+namespace
+{
+void expect_count(const char *name, size_t given, size_t count)
+{
+     if (given != count)
+          throw std::runtime_error(std::string(name) + " expects " + std::to_string(count) +
+                                   (count == 1 ? " argument" : " arguments"));
+}
+
+void expect_args(const char *name, const std::vector<Value> &args, size_t count)
+{
+     expect_count(name, args.size(), count);
+}
+
+// A num or flo view of an array argument. Packed arrays are borrowed;
+// anything else is copied into `widened_*` once.
+struct NumericArray
+{
+     const int64_t *ints = nullptr;
+     const double *floats = nullptr;
+     size_t size = 0;
+     std::vector<int64_t> widened_ints;
+     std::vector<double> widened_floats;
+
+     NumericArray(const char *name, const Value &value)
+     {
+          if (!value.is_array())
+               throw std::runtime_error(std::string(name) + " expects an array");
+          size = value.array_size();
+          switch (value.array_elements())
+          {
+          case Value::Elements::Int:
+               ints = value.int_elements();
+               return;
+          case Value::Elements::Float:
+               floats = value.float_elements();
+               return;
+          case Value::Elements::Bool:
+               throw std::runtime_error(std::string(name) + " expects an array of numbers");
+          case Value::Elements::Mixed:
+               break;
+          }
+
+          bool all_ints = true;
+          for (size_t i = 0; i < size; ++i)
+          {
+               Value item = value.array_at(i);
+               if (item.type() != Value::Type::Int && item.type() != Value::Type::Float)
+                    throw std::runtime_error(std::string(name) + " expects an array of numbers");
+               all_ints = all_ints && item.type() == Value::Type::Int;
+          }
+          if (all_ints)
+          {
+               for (size_t i = 0; i < size; ++i)
+                    widened_ints.push_back(value.array_at(i).int_val());
+               ints = widened_ints.data();
+               return;
+          }
+          for (size_t i = 0; i < size; ++i)
+          {
+               Value item = value.array_at(i);
+               widened_floats.push_back(item.type() == Value::Type::Int ? static_cast<double>(item.int_val())
+                                                                        : item.float_val());
+          }
+          floats = widened_floats.data();
+     }
+
+     bool is_int() const { return floats == nullptr; }
+
+     const double *as_floats()
+     {
+          if (floats == nullptr)
+          {
+               widened_floats.assign(ints, ints + size);
+               floats = widened_floats.data();
+          }
+          return floats;
+     }
+};
+
+double number_arg(const char *name, const Value &value)
+{
+     if (value.type() == Value::Type::Int)
+          return static_cast<double>(value.int_val());
+     if (value.type() == Value::Type::Float)
+          return value.float_val();
+     throw std::runtime_error(std::string(name) + " expects a number");
+}
+
+template <bool Max>
+Value extreme(const char *name, const std::vector<Value> &args)
+{
+     expect_args(name, args, 1);
+     NumericArray items(name, args[0]);
+     if (items.size == 0)
+          throw std::runtime_error(std::string(name) + " of an empty array");
+     const ArrayKernels &k = array_kernels();
+     if (items.is_int())
+          return Value((Max ? k.max_int : k.min_int)(items.ints, items.size));
+     return Value((Max ? k.max_float : k.min_float)(items.floats, items.size));
+}
+
+[[noreturn]] void overflow(const char *name)
+{
+     throw std::runtime_error(std::string("Integer overflow in ") + name);
+}
+
+void expect_same_length(const char *name, const NumericArray &a, const NumericArray &b)
+{
+     if (a.size != b.size)
+          throw std::runtime_error(std::string(name) + " expects arrays of the same length");
+}
+
+// `count` includes the target, as the script passes it.
+void expect_update(const char *name, const Value &target, const std::vector<Value> &args, size_t count)
+{
+     expect_count(name, args.size() + 1, count);
+     if (!target.is_array())
+          throw std::runtime_error(std::string(name) + " expects an array");
+}
+}
+
+Value builtin_sum(const std::vector<Value> &args)
+{
+     expect_args("sum", args, 1);
+     NumericArray items("sum", args[0]);
+     if (items.is_int())
+     {
+          int64_t total;
+          if (!array_kernels().sum_int(items.ints, items.size, &total))
+               overflow("sum");
+          return Value(total);
+     }
+     return Value(array_kernels().sum_float(items.floats, items.size));
+}
+
+Value builtin_min(const std::vector<Value> &args)
+{
+     return extreme<false>("min", args);
+}
+
+Value builtin_max(const std::vector<Value> &args)
+{
+     return extreme<true>("max", args);
+}
+
+Value builtin_dot(const std::vector<Value> &args)
+{
+     expect_args("dot", args, 2);
+     NumericArray a("dot", args[0]), b("dot", args[1]);
+     expect_same_length("dot", a, b);
+     if (a.is_int() && b.is_int())
+     {
+          int64_t total;
+          if (!array_kernels().dot_int(a.ints, b.ints, a.size, &total))
+               overflow("dot");
+          return Value(total);
+     }
+     return Value(array_kernels().dot_float(a.as_floats(), b.as_floats(), a.size));
+}
+
+Value builtin_scale(const std::vector<Value> &args)
+{
+     expect_args("scale", args, 2);
+     NumericArray items("scale", args[0]);
+     if (items.is_int() && args[1].type() == Value::Type::Int)
+     {
+          std::vector<int64_t> out(items.size);
+          if (!array_kernels().scale_int(items.ints, items.size, args[1].int_val(), out.data()))
+               overflow("scale");
+          return Value(std::move(out));
+     }
+     double factor = number_arg("scale", args[1]);
+     std::vector<double> out(items.size);
+     array_kernels().scale_float(items.as_floats(), items.size, factor, out.data());
+     return Value(std::move(out));
+}
+
+Value builtin_add(const std::vector<Value> &args)
+{
+     expect_args("add", args, 2);
+     NumericArray a("add", args[0]), b("add", args[1]);
+     expect_same_length("add", a, b);
+     if (a.is_int() && b.is_int())
+     {
+          std::vector<int64_t> out(a.size);
+          if (!array_kernels().add_int(a.ints, b.ints, a.size, out.data()))
+               overflow("add");
+          return Value(std::move(out));
+     }
+     std::vector<double> out(a.size);
+     array_kernels().add_float(a.as_floats(), b.as_floats(), a.size, out.data());
+     return Value(std::move(out));
+}
+
+// Each element depends on the previous one, so this stays a plain loop.
+Value builtin_prefix_sum(const std::vector<Value> &args)
+{
+     expect_args("prefix_sum", args, 1);
+     NumericArray items("prefix_sum", args[0]);
+     if (items.is_int())
+     {
+          std::vector<int64_t> out(items.size);
+          int64_t total = 0;
+          for (size_t i = 0; i < items.size; ++i)
+          {
+               if (__builtin_add_overflow(total, items.ints[i], &total))
+                    overflow("prefix_sum");
+               out[i] = total;
+          }
+          return Value(std::move(out));
+     }
+     std::vector<double> out(items.size);
+     double total = 0;
+     for (size_t i = 0; i < items.size; ++i)
+     {
+          total += items.floats[i];
+          out[i] = total;
+     }
+     return Value(std::move(out));
+}
+
+// Index of the first occurrence of the maximum.
+Value builtin_argmax(const std::vector<Value> &args)
+{
+     expect_args("argmax", args, 1);
+     NumericArray items("argmax", args[0]);
+     if (items.size == 0)
+          throw std::runtime_error("argmax of an empty array");
+     const ArrayKernels &k = array_kernels();
+     size_t index = 0;
+     if (items.is_int())
+     {
+          int64_t best = k.max_int(items.ints, items.size);
+          while (items.ints[index] != best)
+               ++index;
+     }
+     else
      {
-          std::cout << arg.to_string();
+          double best = k.max_float(items.floats, items.size);
+          while (index + 1 < items.size && items.floats[index] != best)
+               ++index;
      }
-     std::cout << std::endl;
-     return Value(); 
+     return Value(static_cast<int64_t>(index));
+}
+
+Value builtin_push(Value &target, const std::vector<Value> &args)
+{
+     expect_update("push", target, args, 2);
+     target.push_array_item(args[0]);
+     return Value();
+}
+
+Value builtin_pop(Value &target, const std::vector<Value> &args)
+{
+     expect_update("pop", target, args, 1);
+     if (target.array_size() == 0)
+          throw std::runtime_error("pop from an empty array");
+     return target.pop_array_item();
+}
+
+Value builtin_reserve(Value &target, const std::vector<Value> &args)
+{
+     expect_update("reserve", target, args, 2);
+     if (args[0].type() != Value::Type::Int || args[0].int_val() < 0)
+          throw std::runtime_error("reserve expects a non-negative num");
+     target.reserve_array(static_cast<size_t>(args[0].int_val()));
+     return Value();
 }
@@ -0,0 +1,116 @@
+#include "interpreter/bytecode.hpp"
+
+std::string to_string(OpCode op)
+{
+     switch (op)
+     {
+     case OpCode::Constant:
+          return "CONSTANT";
+     case OpCode::Nil:
+          return "NIL";
+     case OpCode::Pop:
+          return "POP";
+     case OpCode::LoadGlobal:
+          return "LOAD_GLOBAL";
+     case OpCode::StoreGlobal:
+          return "STORE_GLOBAL";
+     case OpCode::LoadLocal:
+          return "LOAD_LOCAL";
+     case OpCode::StoreLocal:
+          return "STORE_LOCAL";
+     case OpCode::Add:
+          return "ADD";
+     case OpCode::Sub:
+          return "SUB";
+     case OpCode::Mul:
+          return "MUL";
+     case OpCode::Div:
+          return "DIV";
+     case OpCode::Equal:
+          return "EQUAL";
+     case OpCode::NotEqual:
+          return "NOT_EQUAL";
+     case OpCode::Less:
+          return "LESS";
+     case OpCode::LessEqual:
+          return "LESS_EQUAL";
+     case OpCode::Greater:
+          return "GREATER";
+     case OpCode::GreaterEqual:
+          return "GREATER_EQUAL";
+     case OpCode::And:
+          return "AND";
+     case OpCode::Or:
+          return "OR";
+     case OpCode::MakeArray:
+          return "MAKE_ARRAY";
+     case OpCode::Index:
+          return "INDEX";
+     case OpCode::StoreItemGlobal:
+          return "STORE_ITEM_GLOBAL";
+     case OpCode::StoreItemLocal:
+          return "STORE_ITEM_LOCAL";
+     case OpCode::Jump:
+          return "JUMP";
+     case OpCode::JumpIfFalse:
+          return "JUMP_IF_FALSE";
+     case OpCode::ForTestGlobal:
+          return "FOR_TEST_GLOBAL";
+     case OpCode::ForTestLocal:
+          return "FOR_TEST_LOCAL";
+     case OpCode::ForNextGlobal:
+          return "FOR_NEXT_GLOBAL";
+     case OpCode::ForNextLocal:
+          return "FOR_NEXT_LOCAL";
+     case OpCode::ForEnterGlobal:
+          return "FOR_ENTER_GLOBAL";
+     case OpCode::ForEnterLocal:
+          return "FOR_ENTER_LOCAL";
+     case OpCode::ForLoop:
+          return "FOR_LOOP";
+     case OpCode::ForStepGlobal:
+          return "FOR_STEP_GLOBAL";
+     case OpCode::ForStepLocal:
+          return "FOR_STEP_LOCAL";
+     case OpCode::ParallelFor:
+          return "PARALLEL_FOR";
+     case OpCode::DefineFunction:
+          return "DEFINE_FUNCTION";
+     case OpCode::Call:
+          return "CALL";
+     case OpCode::TailCall:
+          return "TAIL_CALL";
+     case OpCode::UpdateGlobal:
+          return "UPDATE_GLOBAL";
+     case OpCode::UpdateLocal:
+          return "UPDATE_LOCAL";
+     case OpCode::Return:
+          return "RETURN";
+     case OpCode::Halt:
+          return "HALT";
+     }
+     return "???";
+}
+
+std::string disassemble(const FunctionProto &function)
+{
+     std::string out = "== " + (function.name.empty() ? std::string("<main>") : function.name) + " ==\n";
+     for (size_t i = 0; i < function.chunk.code.size(); ++i)
+     {
+          const auto &ins = function.chunk.code[i];
+          out += std::to_string(i) + "\t" + to_string(ins.op) + "\t" + std::to_string(ins.arg);
+          if (ins.aux)
+               out += " (" + std::to_string(ins.aux) + ")";
+          if (ins.op == OpCode::UpdateGlobal || ins.op == OpCode::UpdateLocal ||
+              ((ins.op == OpCode::Call || ins.op == OpCode::TailCall) && ins.function))
+               out += " #" + std::to_string(ins.function);
+          if (ins.op == OpCode::Constant)
+               out += "\t; " + function.chunk.constants[ins.arg].to_string();
+          if (ins.op == OpCode::LoadLocal || ins.op == OpCode::StoreLocal ||
+              ins.op == OpCode::ForTestLocal || ins.op == OpCode::ForNextLocal || ins.op == OpCode::ForEnterLocal ||
+              ins.op == OpCode::ForStepLocal || ins.op == OpCode::StoreItemLocal || ins.op == OpCode::UpdateLocal)
+               out += "\t; " + function.local_names[ins.arg];
+          out += "\n";
+     }
+     return out;
+}
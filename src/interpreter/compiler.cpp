@@ -0,0 +1,424 @@
+#include "interpreter/compiler.hpp"
+#include "interpreter/function_manager.hpp"
+#include <stdexcept>
+#include <limits>
+
+static OpCode binary_opcode(Operator op)
+{
+     switch (op)
+     {
+     case Operator::Add:
+          return OpCode::Add;
+     case Operator::Sub:
+          return OpCode::Sub;
+     case Operator::Mul:
+          return OpCode::Mul;
+     case Operator::Div:
+          return OpCode::Div;
+     case Operator::Equal:
+          return OpCode::Equal;
+     case Operator::NotEqual:
+          return OpCode::NotEqual;
+     case Operator::Less:
+          return OpCode::Less;
+     case Operator::LessEqual:
+          return OpCode::LessEqual;
+     case Operator::Greater:
+          return OpCode::Greater;
+     case Operator::GreaterEqual:
+          return OpCode::GreaterEqual;
+     case Operator::And:
+          return OpCode::And;
+     case Operator::Or:
+          return OpCode::Or;
+     default:
+          throw std::runtime_error(std::string("Unsupported operator: ") + to_string(op));
+     }
+}
+
+Compiler::Compiler(const FunctionManager &natives) : natives(natives) {}
+
+std::unique_ptr<Program> Compiler::compile(const Script &script, const std::vector<std::string> &global_names)
+{
+     auto result = std::make_unique<Program>();
+     result->script = &script;
+     ast = script.ast;
+     resolution = &script.resolution;
+     types = &script.types;
+     invariant_limits = &script.invariant_limits;
+     constants = &script.constants;
+     program = result.get();
+     current = &result->main;
+
+     for (NodeId node : ast->roots())
+          compile_node(node, false);
+     emit(OpCode::Halt);
+     mark_proven_calls();
+
+     result->global_names = global_names;
+     result->function_names = function_names;
+     ast = nullptr;
+     resolution = nullptr;
+     types = nullptr;
+     invariant_limits = nullptr;
+     constants = nullptr;
+     program = nullptr;
+     current = nullptr;
+     return result;
+}
+
+uint32_t Compiler::function_id(const std::string &name)
+{
+     auto found = functions.find(name);
+     if (found != functions.end())
+          return found->second;
+     uint32_t id = static_cast<uint32_t>(function_names.size());
+     functions.emplace(name, id);
+     function_names.push_back(name);
+     return id;
+}
+
+size_t Compiler::emit(OpCode op, uint32_t arg, uint8_t aux)
+{
+     current->chunk.code.push_back({op, aux, 0, arg});
+     return current->chunk.code.size() - 1;
+}
+
+uint32_t Compiler::add_constant(const Value &value)
+{
+     current->chunk.constants.push_back(value);
+     return static_cast<uint32_t>(current->chunk.constants.size() - 1);
+}
+
+void Compiler::patch_jump(size_t at)
+{
+     current->chunk.code[at].arg = static_cast<uint32_t>(current->chunk.code.size());
+}
+
+// Inside a function body depth 0 is the function frame; at the top level
+// it is the global frame itself.
+void Compiler::compile_load(NodeId var)
+{
+     const VarRef &ref = (*resolution)[var];
+     if (current != &program->main && ref.depth == 0)
+     {
+          current->local_names[ref.slot] = std::string(ast->text(var));
+          emit(OpCode::LoadLocal, ref.slot);
+     }
+     else
+     {
+          emit(OpCode::LoadGlobal, ref.slot);
+     }
+}
+
+void Compiler::compile_store(NodeId var, bool keep, bool checked)
+{
+     const VarRef &ref = (*resolution)[var];
+     uint8_t flags = keep ? store_keep : 0;
+     if (current != &program->main && ref.depth == 0)
+     {
+          current->local_names[ref.slot] = std::string(ast->text(var));
+          emit(OpCode::StoreLocal, ref.slot, checked ? flags : flags | store_unchecked);
+     }
+     else
+     {
+          emit(OpCode::StoreGlobal, ref.slot, flags);
+     }
+}
+
+// Emits `global_op` or `local_op` on the slot of `var`, like compile_load.
+size_t Compiler::emit_slot(NodeId var, OpCode global_op, OpCode local_op, uint8_t aux)
+{
+     const VarRef &ref = (*resolution)[var];
+     if (current != &program->main && ref.depth == 0)
+     {
+          current->local_names[ref.slot] = std::string(ast->text(var));
+          return emit(local_op, ref.slot, aux);
+     }
+     return emit(global_op, ref.slot, aux);
+}
+
+void Compiler::compile_block(NodeId block, bool keep)
+{
+     NodeRange stmts = ast->children(block);
+     if (stmts.empty())
+     {
+          if (keep)
+               emit(OpCode::Nil);
+          return;
+     }
+     for (size_t i = 0; i + 1 < stmts.size(); ++i)
+          compile_node(stmts[i], false);
+     compile_node(stmts.back(), keep);
+}
+
+void Compiler::compile_node(NodeId node, bool keep)
+{
+     NodeRange children = ast->children(node);
+     switch (ast->type(node))
+     {
+     case NodeType::Number:
+          emit(OpCode::Constant, add_constant(Value(static_cast<int64_t>(std::stoll(std::string(ast->text(node)))))));
+          break;
+     case NodeType::DecimalNumber:
+          emit(OpCode::Constant, add_constant(Value(std::stod(std::string(ast->text(node))))));
+          break;
+     case NodeType::String:
+          emit(OpCode::Constant, add_constant(Value(std::string(ast->text(node)))));
+          break;
+     case NodeType::Boolean:
+          emit(OpCode::Constant, add_constant(Value(ast->text(node) == "true")));
+          break;
+     case NodeType::Constant:
+          emit(OpCode::Constant, add_constant((*constants)[ast->node(node).value]));
+          break;
+     case NodeType::Identifier:
+          compile_load(node);
+          break;
+     case NodeType::ArrayItem:
+          compile_load(children[0]);
+          compile_node(children[1], true);
+          emit(OpCode::Index);
+          break;
+     case NodeType::Array:
+          for (NodeId child : children)
+               compile_node(child, true);
+          emit(OpCode::MakeArray, static_cast<uint32_t>(children.size()));
+          break;
+     case NodeType::Assignment:
+     {
+          StaticType type = (*types)[children[0]];
+          compile_node(children[1], true);
+          compile_store(children[0], keep, !is_exact(type) || (*types)[children[1]] != type);
+          return;
+     }
+     case NodeType::ItemAssignment:
+          compile_node(children[1], true);
+          compile_node(children[2], true);
+          emit_slot(children[0], OpCode::StoreItemGlobal, OpCode::StoreItemLocal, keep ? store_keep : 0);
+          return;
+     case NodeType::BinaryOp:
+     {
+          bool ints = (*types)[children[0]] == StaticType::Int && (*types)[children[1]] == StaticType::Int;
+          compile_node(children[0], true);
+          compile_node(children[1], true);
+          emit(binary_opcode(ast->op(node)), 0, ints);
+          break;
+     }
+     case NodeType::FunctionCall:
+          compile_call(node, OpCode::Call);
+          break;
+     case NodeType::If:
+     {
+          compile_node(children[0], true);
+          size_t skip = emit(OpCode::JumpIfFalse);
+          compile_block(children[1], keep);
+          if (keep)
+          {
+               size_t end = emit(OpCode::Jump);
+               patch_jump(skip);
+               emit(OpCode::Nil);
+               patch_jump(end);
+          }
+          else
+          {
+               patch_jump(skip);
+          }
+          return;
+     }
+     case NodeType::For:
+          compile_for(node);
+          if (keep)
+               emit(OpCode::Nil);
+          return;
+     case NodeType::ParallelFor:
+          compile_parallel_for(node);
+          if (keep)
+               emit(OpCode::Nil);
+          return;
+     case NodeType::FunctionDecl:
+          compile_function(node);
+          if (keep)
+               emit(OpCode::Nil);
+          return;
+     case NodeType::Return:
+          // The VM falls back to an ordinary call when it cannot reuse the
+          // frame, so the RETURN after a TAIL_CALL is still needed.
+          if (ast->type(children[0]) == NodeType::FunctionCall)
+               compile_call(children[0], OpCode::TailCall);
+          else
+               compile_node(children[0], true);
+          emit(OpCode::Return, 0, !proves((*types)[children[0]], current->return_type));
+          return;
+     default:
+          throw std::runtime_error("Cannot compile node: " + to_string(ast->type(node)));
+     }
+
+     if (!keep)
+          emit(OpCode::Pop);
+}
+
+void Compiler::compile_call(NodeId node, OpCode op)
+{
+     if (natives.find_update(std::string(ast->text(node))))
+     {
+          compile_update(node);
+          return;
+     }
+     NodeRange args = ast->children(node);
+     if (args.size() > std::numeric_limits<uint8_t>::max())
+          throw std::runtime_error("Too many arguments in call to: " + std::string(ast->text(node)));
+     for (NodeId arg : args)
+          compile_node(arg, true);
+     size_t at = emit(op, function_id(std::string(ast->text(node))), static_cast<uint8_t>(args.size()));
+     calls.push_back({current, at, node});
+}
+
+// Resolver has checked that the first argument is a variable. The update
+// gets the slot's own value, so it is only copied if something shares it.
+void Compiler::compile_update(NodeId node)
+{
+     NodeRange args = ast->children(node);
+     if (args.size() > std::numeric_limits<uint8_t>::max())
+          throw std::runtime_error("Too many arguments in call to: " + std::string(ast->text(node)));
+     uint32_t id = function_id(std::string(ast->text(node)));
+     if (id > std::numeric_limits<uint16_t>::max())
+          throw std::runtime_error("Function table too large for update: " + std::string(ast->text(node)));
+     for (size_t i = 1; i < args.size(); ++i)
+          compile_node(args[i], true);
+     size_t at = emit_slot(args[0], OpCode::UpdateGlobal, OpCode::UpdateLocal, static_cast<uint8_t>(args.size() - 1));
+     current->chunk.code[at].function = static_cast<uint16_t>(id);
+}
+
+void Compiler::compile_for(NodeId node)
+{
+     NodeId first = ast->child(node, 0);
+     NodeId body = ast->child(node, 1);
+
+     if (ast->type(first) == NodeType::While)
+     {
+          size_t top = current->chunk.code.size();
+          compile_node(ast->child(first, 0), true);
+          size_t exit = emit(OpCode::JumpIfFalse);
+          compile_block(body, false);
+          emit(OpCode::Jump, static_cast<uint32_t>(top));
+          patch_jump(exit);
+          return;
+     }
+
+     if (ast->type(first) != NodeType::ForLoop || ast->children(first).size() != 2)
+          throw std::runtime_error("Malformed for loop");
+
+     NodeId init = ast->child(first, 0);
+     if (ast->type(init) != NodeType::Assignment)
+          throw std::runtime_error("Malformed for loop");
+     compile_node(init, false);
+
+     const VarRef &var = (*resolution)[ast->child(init, 0)];
+     bool local = current != &program->main && var.depth == 0;
+     uint32_t slot = var.slot;
+
+     if ((*invariant_limits)[node])
+     {
+          compile_node(ast->child(first, 1), true);
+          emit(local ? OpCode::ForEnterLocal : OpCode::ForEnterGlobal, slot);
+          size_t top = current->chunk.code.size();
+          size_t exit = emit(OpCode::ForLoop);
+          compile_block(body, false);
+          emit(local ? OpCode::ForStepLocal : OpCode::ForStepGlobal, slot);
+          emit(OpCode::Jump, static_cast<uint32_t>(top));
+          patch_jump(exit);
+          emit(OpCode::Pop);
+          emit(OpCode::Pop);
+          return;
+     }
+
+     // The loop keeps the value the variable had when the bound was tested
+     // on the stack, so the increment ignores reassignments in the body just
+     // like the tree-walker does.
+     size_t top = current->chunk.code.size();
+     compile_node(ast->child(first, 1), true);
+     emit(local ? OpCode::ForTestLocal : OpCode::ForTestGlobal, slot);
+     size_t exit = emit(OpCode::JumpIfFalse);
+     compile_block(body, false);
+     emit(local ? OpCode::ForNextLocal : OpCode::ForNextGlobal, slot);
+     emit(OpCode::Jump, static_cast<uint32_t>(top));
+     patch_jump(exit);
+     emit(OpCode::Pop);
+}
+
+void Compiler::compile_parallel_for(NodeId node)
+{
+     NodeId head = ast->child(node, 0);
+     if (ast->type(head) != NodeType::ForLoop || ast->type(ast->child(head, 0)) != NodeType::Assignment)
+          throw std::runtime_error("Malformed pfor loop");
+     compile_node(ast->child(head, 0), false);
+     compile_node(ast->child(head, 1), true);
+     emit(OpCode::ParallelFor, node);
+}
+
+void Compiler::compile_function(NodeId node)
+{
+     NodeRange children = ast->children(node);
+     auto proto = std::make_unique<FunctionProto>();
+     proto->name = std::string(ast->text(node));
+     proto->id = function_id(proto->name);
+     proto->decl = node;
+     if (serials < std::numeric_limits<uint16_t>::max())
+          proto->serial = static_cast<uint16_t>(++serials);
+     proto->local_names.resize((*resolution)[node].slot);
+
+     for (NodeId param : ast->children(children[0]))
+     {
+          auto [param_name, param_type] = extract_name_and_type(std::string(ast->text(param)));
+          proto->local_names[(*resolution)[param].slot] = param_name;
+          proto->param_types.push_back(Value::string_to_type(param_type));
+     }
+     if (children.size() == 3)
+     {
+          proto->has_return_type = true;
+          proto->return_type = Value::string_to_type(extract_name_and_type(std::string(ast->text(children[1]))).second);
+     }
+
+     FunctionProto *saved = current;
+     current = proto.get();
+     compile_block(children.back(), true);
+     emit(OpCode::Return);
+     current = saved;
+
+     uint32_t index = static_cast<uint32_t>(program->functions.size());
+     program->functions.push_back(std::move(proto));
+     emit(OpCode::DefineFunction, index);
+}
+
+// A call whose arguments are proven against the only function of that name
+// in this program records the function's serial. The VM skips the argument
+// checks while that function is still the callee; a redeclaration is a
+// different proto and is checked as usual.
+void Compiler::mark_proven_calls()
+{
+     std::unordered_map<std::string, uint32_t> declared;
+     for (uint32_t i = 0; i < program->functions.size(); ++i)
+     {
+          auto [found, inserted] = declared.emplace(program->functions[i]->name, i);
+          if (!inserted)
+               found->second = std::numeric_limits<uint32_t>::max();
+     }
+
+     for (const CallSite &call : calls)
+     {
+          auto found = declared.find(std::string(ast->text(call.node)));
+          if (found == declared.end() || found->second == std::numeric_limits<uint32_t>::max())
+               continue;
+          const FunctionProto &callee = *program->functions[found->second];
+          NodeRange args = ast->children(call.node);
+          if (args.size() != callee.param_types.size())
+               continue;
+          bool proven = true;
+          for (size_t i = 0; i < args.size() && proven; ++i)
+               proven = proves((*types)[args[i]], callee.param_types[i]);
+          if (proven)
+               call.caller->chunk.code[call.at].function = callee.serial;
+     }
+     calls.clear();
+}
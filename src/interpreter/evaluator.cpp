@@ -1,5 +1,8 @@
 #include "interpreter/evaluator.hpp"
 #include "interpreter/function_manager.hpp"
+#include "interpreter/native_stack.hpp"
+#include "interpreter/parallel.hpp"
+#include "interpreter/profiler.hpp"
 #include <stdexcept>
 #include <cmath>
 #include <iostream>
@@ -7,247 +10,536 @@
 Evaluator::Evaluator(FunctionManager &fn_manager)
     : function_manager(fn_manager)
 {
-     scope_mgr.push_scope();
 }
 
-void Evaluator::push_scope()
+void Evaluator::set_profiler(Profiler *profiler)
 {
-     scope_mgr.push_scope();
+     call_profiler = profiler;
+     node_profiler = profiler && profiler->counts_nodes() ? profiler : nullptr;
 }
 
-void Evaluator::pop_scope()
+void Evaluator::set_thread_pool(ThreadPool *next)
 {
-     scope_mgr.pop_scope();
+     pool = next;
 }
 
-void Evaluator::define_variable(const std::string &name, const Value &value)
+void Evaluator::set_item_log(ItemWriteLog *log)
 {
-     scope_mgr.define(name, value);
+     item_log = log;
 }
 
-void Evaluator::set_variable(const std::string &name, const Value &value)
+void Evaluator::load_scope(const std::vector<Slot> &globals, const Slot *frame, size_t frame_size)
 {
-     scope_mgr.set(name, value);
+     scope_mgr.load(globals, frame, frame_size);
 }
 
-Value Evaluator::get_variable(const std::string &name) const
+void Evaluator::resize_globals(size_t count)
 {
-     return scope_mgr.get(name);
+     scope_mgr.resize_globals(count);
 }
 
-bool Evaluator::is_true(const Value &val) const
+void Evaluator::set_max_call_depth(size_t depth)
 {
-     switch (val.type)
+     max_call_depth = depth;
+}
+
+size_t Evaluator::call_depth_left() const
+{
+     return max_call_depth > scope_mgr.depth() ? max_call_depth - scope_mgr.depth() : 0;
+}
+
+void Evaluator::push_frame(size_t size)
+{
+     if (scope_mgr.depth() >= max_call_depth)
+          throw std::runtime_error("Maximum call depth of " + std::to_string(max_call_depth) + " exceeded");
+     if (native_stack_position() < native_stack_floor())
+          throw std::runtime_error("Native stack exhausted at call depth " + std::to_string(scope_mgr.depth()));
+     scope_mgr.push_frame(size);
+}
+
+void Evaluator::pop_frame()
+{
+     scope_mgr.pop_frame();
+}
+
+void Evaluator::define_local(uint32_t slot, Value value)
+{
+     Slot &target = scope_mgr.slot(0, slot);
+     target.value = std::move(value);
+     target.defined = true;
+}
+
+Value &Evaluator::variable(NodeId var)
+{
+     const VarRef &ref = script->resolution[var];
+     Slot &target = scope_mgr.slot(ref.depth, ref.slot);
+     if (!target.defined)
+          throw std::runtime_error("Undefined variable: " + std::string(script->ast->text(var)));
+     return target.value;
+}
+
+bool Evaluator::is_true(const Value &val)
+{
+     switch (val.type())
      {
      case Value::Type::Bool:
-          return val.bool_val;
+          return val.bool_val();
      case Value::Type::Int:
-          return val.int_val != 0;
+          return val.int_val() != 0;
      case Value::Type::String:
-          return !val.str_val.empty();
+          return !val.str_val().empty();
      default:
           return false;
      }
 }
 
-Value Evaluator::evaluate(const std::shared_ptr<ASTNode> &node)
+Value Evaluator::take_return()
+{
+     flow = Flow::Normal;
+     return std::move(return_value);
+}
+
+const FunctionEntry *Evaluator::take_tail_call(std::vector<Value> &args)
+{
+     flow = Flow::Normal;
+     args = std::move(tail_args);
+     tail_args.clear();
+     return tail_target;
+}
+
+void Evaluator::clear_flow()
+{
+     flow = Flow::Normal;
+     return_value = Value();
+     tail_target = nullptr;
+     tail_args.clear();
+}
+
+Evaluator::ActiveCall *Evaluator::enter_call(ActiveCall *call)
+{
+     ActiveCall *previous = active_call;
+     active_call = call;
+     return previous;
+}
+
+const FunctionEntry &Evaluator::call_target(NodeId call)
+{
+     std::atomic<const FunctionEntry *> &cached = script->call_targets[call];
+     const FunctionEntry *target = cached.load(std::memory_order_acquire);
+     if (!target)
+     {
+          target = &function_manager.resolve(std::string(script->ast->text(call)));
+          cached.store(target, std::memory_order_release);
+     }
+     return *target;
+}
+
+// Same rule as the VM: a tail call moves the current function's return
+// type check to the callee's result, and there is room for one pending
+// check, so two conflicting ones make an ordinary call instead.
+bool Evaluator::carry_result_check()
+{
+     const FunctionSignature &signature = active_call->function->signature;
+     if (!signature.has_return_type)
+          return true;
+     if (active_call->check_result && active_call->result_type != signature.return_type)
+          return false;
+     active_call->check_result = true;
+     active_call->result_type = signature.return_type;
+     return true;
+}
+
+Value Evaluator::evaluate_return(NodeId node)
 {
-     switch (node->type)
+     NodeId result = script->ast->child(node, 0);
+     if (active_call && script->ast->type(result) == NodeType::FunctionCall)
+     {
+          const FunctionEntry &target = call_target(result);
+          if (!target.is_native() && !target.update && carry_result_check())
+          {
+               tail_args = function_manager.bind_args(target, script->ast->children(result), *this);
+               tail_target = &target;
+               flow = Flow::TailCall;
+               return Value();
+          }
+     }
+     return_value = evaluate(result);
+     if (active_call)
+     {
+          const FunctionSignature &signature = active_call->function->signature;
+          if (signature.has_return_type && !proves(script->types[result], signature.return_type))
+               return_value.check_type(signature.return_type);
+     }
+     flow = Flow::Return;
+     return Value();
+}
+
+const Script *Evaluator::set_script(const Script *next)
+{
+     const Script *previous = script;
+     script = next;
+     return previous;
+}
+
+const Script *Evaluator::current_script() const
+{
+     return script;
+}
+
+Value Evaluator::evaluate(NodeId id)
+{
+     const Ast &ast = *script->ast;
+     const Node &node = ast.node(id);
+     if (node_profiler)
+          node_profiler->hit(ast, id);
+     switch (node.type)
      {
      case NodeType::Number:
-          return Value(std::stoi(node->value));
+          return Value(static_cast<int64_t>(std::stoll(std::string(ast.text(id)))));
      case NodeType::DecimalNumber:
-          return Value(std::stod(node->value));
+          return Value(std::stod(std::string(ast.text(id))));
      case NodeType::String:
-          return Value(node->value);
+          return Value(std::string(ast.text(id)));
      case NodeType::Boolean:
-          return Value(node->value == "true");
+          return Value(ast.text(id) == "true");
+     case NodeType::Constant:
+          return script->constants[ast.node(id).value];
      case NodeType::ArrayItem:
      {
-          auto arr = scope_mgr.get(node->children[0]->value);
-          auto be = evaluate(node->children[1]);
-          return arr.array_val[be.int_val];
+          auto be = evaluate(ast.child(id, 1));
+          NodeId var = ast.child(id, 0);
+          const VarRef &ref = script->resolution[var];
+          const auto &arr = scope_mgr.get(ref.depth, ref.slot, ast.text(var));
+          if (!arr.is_array())
+               throw std::runtime_error("Indexing a non-array value");
+          if (be.int_val() < 0 || static_cast<size_t>(be.int_val()) >= arr.array_size())
+               throw std::runtime_error("Array index out of range: " + std::to_string(be.int_val()));
+          return arr.array_at(static_cast<size_t>(be.int_val()));
      }
      case NodeType::Array:
      {
           std::vector<Value> vals;
-          for (const auto &child : node->children)
+          for (NodeId child : ast.children(id))
                vals.push_back(evaluate(child));
-          return Value(vals);
+          return Value(std::move(vals));
      }
      case NodeType::Identifier:
-          return scope_mgr.get(node->value);
+     {
+          const VarRef &ref = script->resolution[id];
+          return scope_mgr.get(ref.depth, ref.slot, ast.text(id));
+     }
      case NodeType::Assignment:
      {
-          auto var_name = node->children[0]->value;
-          auto val = evaluate(node->children[1]);
-
-          if (scope_mgr.has_in_current(var_name))
+          NodeId var = ast.child(id, 0);
+          NodeId value = ast.child(id, 1);
+          auto val = evaluate(value);
+          const VarRef &ref = script->resolution[var];
+          Slot &target = scope_mgr.slot(ref.depth, ref.slot);
+          // A slot proven to only ever hold this type needs no check.
+          StaticType type = script->types[var];
+          if (is_exact(type) && script->types[value] == type)
           {
-               auto found_value = scope_mgr.get(var_name);
-               found_value.check_type(val.type);
-               scope_mgr.set(var_name, val);
+               target.value = val;
+               target.defined = true;
           }
           else
           {
-               scope_mgr.define(var_name, val);
+               target.assign(val);
           }
-
+          return val;
+     }
+     case NodeType::ItemAssignment:
+     {
+          Value index = evaluate(ast.child(id, 1));
+          Value val = evaluate(ast.child(id, 2));
+          store_item(variable(ast.child(id, 0)), index, val);
+          if (item_log)
+               item_log->record(id, index, val);
           return val;
      }
 
      case NodeType::BinaryOp:
      {
-          auto left = evaluate(node->children[0]);
-          auto right = evaluate(node->children[1]);
-          return eval_binary_op(node->value, left, right);
+          auto left = evaluate(ast.child(id, 0));
+          auto right = evaluate(ast.child(id, 1));
+          StaticType l = script->types[ast.child(id, 0)];
+          StaticType r = script->types[ast.child(id, 1)];
+          if (l == StaticType::Int && r == StaticType::Int)
+               return eval_int_op(ast.op(id), left.int_val(), right.int_val());
+          if (l == StaticType::Float && r == StaticType::Float)
+               return eval_float_op(ast.op(id), left.float_val(), right.float_val());
+          return eval_binary_op(ast.op(id), left, right);
      }
      case NodeType::If:
      {
-          auto condition = evaluate(node->children[0]);
+          auto condition = evaluate(ast.child(id, 0));
           if (is_true(condition))
-               return evaluate_block(node->children[1]);
+               return evaluate_block(ast.child(id, 1));
           return Value();
      }
      case NodeType::For:
-          return execute_for(node);
+          return execute_for(id);
+     case NodeType::ParallelFor:
+          return execute_parallel_for(id);
      case NodeType::While:
-          return execute_while(node->children[0], node->children[1]);
+          return execute_while(ast.child(id, 0), ast.child(id, 1));
      case NodeType::FunctionCall:
-          return function_manager.call(node->value, node->children, *this);
+          return function_manager.call(call_target(id), ast.children(id), *this);
      case NodeType::FunctionDecl:
-          function_manager.register_function(node->value, node);
+          function_manager.register_function(std::string(ast.text(id)), *script, id);
           return Value();
      case NodeType::Return:
-          throw ReturnSignal{evaluate(node->children[0])};
+          return evaluate_return(id);
      default:
           throw std::runtime_error("Unknown AST node type");
      }
 }
 
-Value Evaluator::evaluate_block(const std::shared_ptr<ASTNode> &block)
+Value Evaluator::evaluate_block(NodeId block)
 {
      Value last;
-     for (const auto &stmt : block->children)
+     for (NodeId stmt : script->ast->children(block))
+     {
           last = evaluate(stmt);
+          if (flow != Flow::Normal)
+               break;
+     }
      return last;
 }
 
-Value Evaluator::execute_for(const std::shared_ptr<ASTNode> &node)
+Value Evaluator::execute_for(NodeId node)
 {
-     auto &first = node->children[0];
-     auto &body = node->children[1];
+     const Ast &ast = *script->ast;
+     NodeId first = ast.child(node, 0);
+     NodeId body = ast.child(node, 1);
 
-     if (first->type == NodeType::While)
-          return execute_while(first->children[0], body);
+     if (ast.type(first) == NodeType::While)
+          return execute_while(ast.child(first, 0), body);
 
-     if (first->type == NodeType::ForLoop)
+     if (ast.type(first) == NodeType::ForLoop)
      {
-          if (first->children.size() != 2)
+          if (ast.children(first).size() != 2)
                throw std::runtime_error("Malformed for loop");
 
-          evaluate(first->children[0]);
-
-          auto assign = first->children[0];
-          std::string var_name = assign->children[0]->value;
+          NodeId assign = ast.child(first, 0);
+          if (ast.type(assign) != NodeType::Assignment)
+               throw std::runtime_error("Malformed for loop");
+          evaluate(assign);
 
-          return execute_for_loop(body, first->children[1], var_name);
+          if (script->invariant_limits[node])
+               return execute_counted_loop(body, ast.child(first, 1), ast.child(assign, 0));
+          return execute_for_loop(body, ast.child(first, 1), ast.child(assign, 0));
      }
 
      throw std::runtime_error("Invalid for-loop structure");
 }
 
-Value Evaluator::execute_for_loop(const std::shared_ptr<ASTNode> &body,
-                                  const std::shared_ptr<ASTNode> &limit,
-                                  const std::string &var_name)
+Value Evaluator::execute_for_loop(NodeId body, NodeId limit, NodeId var)
 {
+     const VarRef &ref = script->resolution[var];
+     auto var_name = script->ast->text(var);
      while (true)
      {
-          Value current = scope_mgr.get(var_name);
+          Value current = scope_mgr.get(ref.depth, ref.slot, var_name);
           Value max_val = evaluate(limit);
 
           if (max_val.is_array())
           {
-               max_val = Value(static_cast<int>(max_val.array_val.size()));
+               max_val = Value(static_cast<int64_t>(max_val.array_size()));
           }
           if (!current.is_number() || !max_val.is_number())
                throw std::runtime_error("Loop bounds must be numeric");
 
-          if (current.int_val >= max_val.int_val)
+          if (current.int_val() >= max_val.int_val())
                break;
 
           evaluate_block(body);
-          scope_mgr.set(var_name, Value(current.int_val + 1));
+          if (flow != Flow::Normal)
+               break;
+          scope_mgr.slot(ref.depth, ref.slot).value = Value(current.int_val() + 1);
      }
      return Value();
 }
 
-Value Evaluator::execute_while(const std::shared_ptr<ASTNode> &cond,
-                               const std::shared_ptr<ASTNode> &body)
+// A loop whose limit cannot change: the limit is evaluated once and the
+// counter is kept here, so each iteration just stores the next value in
+// the slot. As above, that discards anything the body assigned to it.
+Value Evaluator::execute_counted_loop(NodeId body, NodeId limit, NodeId var)
+{
+     const VarRef &ref = script->resolution[var];
+     const Value &start = scope_mgr.get(ref.depth, ref.slot, script->ast->text(var));
+     bool numeric = start.is_number();
+     int64_t current = start.int_val();
+
+     Value max_val = evaluate(limit);
+     if (max_val.is_array())
+          max_val = Value(static_cast<int64_t>(max_val.array_size()));
+     if (!numeric || !max_val.is_number())
+          throw std::runtime_error("Loop bounds must be numeric");
+
+     for (int64_t end = max_val.int_val(); current < end;)
+     {
+          evaluate_block(body);
+          if (flow != Flow::Normal)
+               break;
+          scope_mgr.slot(ref.depth, ref.slot).value = Value(++current);
+     }
+     return Value();
+}
+
+Value Evaluator::execute_parallel_for(NodeId node)
+{
+     const Ast &ast = *script->ast;
+     NodeId head = ast.child(node, 0);
+     if (ast.type(head) != NodeType::ForLoop || ast.type(ast.child(head, 0)) != NodeType::Assignment)
+          throw std::runtime_error("Malformed pfor loop");
+     evaluate(ast.child(head, 0));
+     Value limit = evaluate(ast.child(head, 1));
+
+     ParallelScope scope{&scope_mgr.global_slots(), scope_mgr.frame_slots(), scope_mgr.frame_size()};
+     run_parallel_for({script, &function_manager, pool, max_call_depth, item_log}, scope, node, std::move(limit));
+     return Value();
+}
+
+Value Evaluator::execute_while(NodeId cond, NodeId body)
 {
      while (is_true(evaluate(cond)))
+     {
           evaluate_block(body);
+          if (flow != Flow::Normal)
+               break;
+     }
      return Value();
 }
 
-Value Evaluator::eval_binary_op(const std::string &op, const Value &lhs, const Value &rhs)
+Value Evaluator::eval_binary_op(Operator op, const Value &lhs, const Value &rhs)
 {
+     Value::Type l = lhs.type();
+     Value::Type r = rhs.type();
+     if (l == Value::Type::Int && r == Value::Type::Int)
+          return eval_int_op(op, lhs.int_val(), rhs.int_val());
+     if (l == Value::Type::Float && r == Value::Type::Float)
+          return eval_float_op(op, lhs.float_val(), rhs.float_val());
      if (lhs.is_number() && rhs.is_number())
-          return eval_number_op(lhs, op, rhs);
-     if (lhs.type == Value::Type::Bool && rhs.type == Value::Type::Bool)
-          return eval_bool_op(lhs, op, rhs);
-     if (lhs.type == Value::Type::String && rhs.type == Value::Type::String)
-          return eval_string_op(lhs, op, rhs);
+     {
+          double ld = l == Value::Type::Float ? lhs.float_val() : static_cast<double>(lhs.int_val());
+          double rd = r == Value::Type::Float ? rhs.float_val() : static_cast<double>(rhs.int_val());
+          return eval_float_op(op, ld, rd);
+     }
+     if (l == Value::Type::Bool && r == Value::Type::Bool)
+          return eval_bool_op(op, lhs.bool_val(), rhs.bool_val());
+     if (l == Value::Type::String && r == Value::Type::String)
+          return eval_string_op(op, lhs, rhs);
 
      throw std::runtime_error("Unsupported binary op for operand types");
 }
 
-Value Evaluator::eval_number_op(const Value &lhs, const std::string &op, const Value &rhs)
+// Stays in integer registers; Div is the one operator with a float
+// result. Overflow is an error rather than a silent wrap.
+Value Evaluator::eval_int_op(Operator op, int64_t lhs, int64_t rhs)
 {
-     double l = lhs.type == Value::Type::Float ? lhs.float_val : lhs.int_val;
-     double r = rhs.type == Value::Type::Float ? rhs.float_val : rhs.int_val;
+     int64_t result;
+     switch (op)
+     {
+     case Operator::Add:
+          if (__builtin_add_overflow(lhs, rhs, &result))
+               throw_overflow(op, lhs, rhs);
+          return Value(result);
+     case Operator::Sub:
+          if (__builtin_sub_overflow(lhs, rhs, &result))
+               throw_overflow(op, lhs, rhs);
+          return Value(result);
+     case Operator::Mul:
+          if (__builtin_mul_overflow(lhs, rhs, &result))
+               throw_overflow(op, lhs, rhs);
+          return Value(result);
+     case Operator::Div:
+          return Value(static_cast<double>(lhs) / static_cast<double>(rhs));
+     case Operator::Equal:
+          return Value(lhs == rhs);
+     case Operator::NotEqual:
+          return Value(lhs != rhs);
+     case Operator::Less:
+          return Value(lhs < rhs);
+     case Operator::LessEqual:
+          return Value(lhs <= rhs);
+     case Operator::Greater:
+          return Value(lhs > rhs);
+     case Operator::GreaterEqual:
+          return Value(lhs >= rhs);
+     default:
+          throw std::runtime_error(std::string("Unsupported numeric operator: ") + to_string(op));
+     }
+}
 
-     auto result = [&](double val) -> Value
+void Evaluator::throw_overflow(Operator op, int64_t lhs, int64_t rhs)
+{
+     throw std::runtime_error("Integer overflow: " + std::to_string(lhs) + " " + to_string(op) + " " +
+                              std::to_string(rhs));
+}
+
+void Evaluator::store_item(Value &array, const Value &index, Value item)
+{
+     if (!array.is_array())
+          throw std::runtime_error("Indexing a non-array value");
+     if (index.int_val() < 0 || static_cast<size_t>(index.int_val()) >= array.array_size())
+          throw std::runtime_error("Array index out of range: " + std::to_string(index.int_val()));
+     array.set_array_item(static_cast<size_t>(index.int_val()), std::move(item));
+}
+
+// A whole result becomes an int when it fits one.
+Value Evaluator::eval_float_op(Operator op, double l, double r)
+{
+     auto result = [](double val) -> Value
      {
-          return std::floor(val) == val ? Value((int)val) : Value(val);
+          if (std::floor(val) == val && val >= -0x1p63 && val < 0x1p63)
+               return Value(static_cast<int64_t>(val));
+          return Value(val);
      };
 
-     if (op == "+")
+     switch (op)
+     {
+     case Operator::Add:
           return result(l + r);
-     if (op == "-")
+     case Operator::Sub:
           return result(l - r);
-     if (op == "*")
+     case Operator::Mul:
           return result(l * r);
-     if (op == "/")
+     case Operator::Div:
           return Value(l / r);
-     if (op == "==")
+     case Operator::Equal:
           return Value(l == r);
-     if (op == "!=")
+     case Operator::NotEqual:
           return Value(l != r);
-     if (op == "<")
+     case Operator::Less:
           return Value(l < r);
-     if (op == "<=")
+     case Operator::LessEqual:
           return Value(l <= r);
-     if (op == ">")
+     case Operator::Greater:
           return Value(l > r);
-     if (op == ">=")
+     case Operator::GreaterEqual:
           return Value(l >= r);
-
-     throw std::runtime_error("Unsupported numeric operator: " + op);
+     default:
+          throw std::runtime_error(std::string("Unsupported numeric operator: ") + to_string(op));
+     }
 }
 
-Value Evaluator::eval_string_op(const Value &lhs, const std::string &op, const Value &rhs)
+Value Evaluator::eval_string_op(Operator op, const Value &lhs, const Value &rhs)
 {
-     if (op == "+")
-          return Value(lhs.str_val + rhs.str_val);
-     throw std::runtime_error("Unsupported string operator: " + op);
+     if (op == Operator::Add)
+          return Value(lhs.str_val() + rhs.str_val());
+     throw std::runtime_error(std::string("Unsupported string operator: ") + to_string(op));
 }
 
-Value Evaluator::eval_bool_op(const Value &lhs, const std::string &op, const Value &rhs)
+Value Evaluator::eval_bool_op(Operator op, bool lhs, bool rhs)
 {
-     if (op == "&&")
-          return Value(lhs.bool_val && rhs.bool_val);
-     if (op == "||")
-          return Value(lhs.bool_val || rhs.bool_val);
-     throw std::runtime_error("Unsupported boolean operator: " + op);
+     switch (op)
+     {
+     case Operator::And:
+          return Value(lhs && rhs);
+     case Operator::Or:
+          return Value(lhs || rhs);
+     default:
+          throw std::runtime_error(std::string("Unsupported boolean operator: ") + to_string(op));
+     }
 }
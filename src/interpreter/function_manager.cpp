@@ -1,22 +1,84 @@
 #include "interpreter/function_manager.hpp"
 #include "interpreter/evaluator.hpp"
+#include "interpreter/profiler.hpp"
 #include <iostream>
 #include <stdexcept>
 
-void FunctionManager::register_function(const std::string &name, const std::shared_ptr<ASTNode> &func_def)
+FunctionEntry &FunctionManager::entry(const std::string &name)
 {
-     user_functions[name] = func_def;
+     FunctionEntry &found = functions[name];
+     if (found.name.empty())
+          found.name = name;
+     return found;
+}
+
+const FunctionEntry &FunctionManager::register_function(const std::string &name, const Script &script, NodeId func_def)
+{
+     const Ast &ast = *script.ast;
+     NodeRange children = ast.children(func_def);
+
+     FunctionSignature signature;
+     for (NodeId param : ast.children(children[0]))
+     {
+          signature.param_slots.push_back(script.resolution[param].slot);
+          signature.param_types.push_back(
+              Value::string_to_type(extract_name_and_type(std::string(ast.text(param))).second));
+     }
+     if (children.size() == 3)
+     {
+          signature.has_return_type = true;
+          signature.return_type = Value::string_to_type(extract_name_and_type(std::string(ast.text(children[1]))).second);
+     }
+     signature.frame_size = script.resolution[func_def].slot;
+
+     FunctionEntry &target = entry(name);
+     if (target.script && (target.script != &script || target.decl != func_def))
+          for (auto &[key, function] : functions)
+               function.jit.reset();
+     target.script = &script;
+     target.decl = func_def;
+     target.body = children.back();
+     target.signature = std::move(signature);
+     return target;
 }
 
 void FunctionManager::register_native(const std::string &name, NativeFunc func)
 {
-     native_functions[name] = func;
+     entry(name).native = std::move(func);
+}
+
+void FunctionManager::register_update(const std::string &name, NativeUpdate func)
+{
+     entry(name).update = std::move(func);
+}
+
+const FunctionEntry &FunctionManager::resolve(const std::string &name) const
+{
+     auto found = functions.find(name);
+     if (found == functions.end())
+          throw std::runtime_error("Function not found: " + name);
+     return found->second;
 }
 
-std::vector<Value> FunctionManager::evaluate_args(const std::vector<std::shared_ptr<ASTNode>> &args, Evaluator &evaluator)
+const FunctionManager::NativeFunc *FunctionManager::find_native(const std::string &name) const
 {
-     std::vector<Value> evaluated;
-     for (const auto &arg : args)
+     auto found = functions.find(name);
+     return found == functions.end() || !found->second.native ? nullptr : &found->second.native;
+}
+
+const NativeUpdate *FunctionManager::find_update(const std::string &name) const
+{
+     auto found = functions.find(name);
+     return found == functions.end() || !found->second.update ? nullptr : &found->second.update;
+}
+
+// Starts from the evaluator's spare buffer, which the caller hands back
+// once the native returns.
+std::vector<Value> FunctionManager::evaluate_args(NodeRange args, Evaluator &evaluator)
+{
+     std::vector<Value> evaluated = evaluator.take_spare_args();
+     evaluated.reserve(args.size());
+     for (NodeId arg : args)
           evaluated.push_back(evaluator.evaluate(arg));
      return evaluated;
 }
@@ -32,54 +94,122 @@ std::pair<std::string, std::string> extract_name_and_type(const std::string &s)
      return {name, type};
 }
 
-Value FunctionManager::call(const std::string &name, const std::vector<std::shared_ptr<ASTNode>> &args, Evaluator &evaluator)
+std::vector<Value> FunctionManager::bind_args(const FunctionEntry &func, NodeRange args, Evaluator &evaluator)
 {
-     if (native_functions.find(name) != native_functions.end())
+     if (!func.script)
+          throw std::runtime_error("Function not found: " + func.name);
+
+     const FunctionSignature &signature = func.signature;
+     if (signature.param_types.size() != args.size())
+          throw std::runtime_error("Argument count mismatch in function: " + func.name);
+
+     const std::vector<StaticType> &types = evaluator.current_script()->types;
+     std::vector<Value> arg_vals;
+     arg_vals.reserve(args.size());
+     for (size_t i = 0; i < args.size(); ++i)
      {
-          return native_functions.at(name)(evaluate_args(args, evaluator));
+          arg_vals.push_back(evaluator.evaluate(args[i]));
+          if (!proves(types[args[i]], signature.param_types[i]))
+               arg_vals.back().check_type(signature.param_types[i]);
      }
+     return arg_vals;
+}
 
-     if (user_functions.find(name) == user_functions.end())
-          throw std::runtime_error("Function not found: " + name);
+Value FunctionManager::call(const FunctionEntry &func, NodeRange args, Evaluator &evaluator)
+{
+     if (func.update)
+     {
+          std::vector<Value> arg_vals = evaluate_args(NodeRange{args.begin() + 1, args.end()}, evaluator);
+          ProfileScope profile(evaluator.profiler(), func.name);
+          Value result = func.update(evaluator.variable(args[0]), arg_vals);
+          evaluator.give_back_spare_args(std::move(arg_vals));
+          return result;
+     }
+     if (func.is_native())
+     {
+          std::vector<Value> arg_vals = evaluate_args(args, evaluator);
+          ProfileScope profile(evaluator.profiler(), func.name);
+          Value result = func.native(arg_vals);
+          evaluator.give_back_spare_args(std::move(arg_vals));
+          return result;
+     }
+     std::vector<Value> arg_vals = bind_args(func, args, evaluator);
+     Value result;
+     if (!evaluator.profiler() && run_native(func, arg_vals.data(), evaluator.call_depth_left(), result))
+          return result;
+     return invoke(func, std::move(arg_vals), evaluator);
+}
 
-     const auto &func_def = user_functions.at(name);
-     auto &params_node = func_def->children[0];
-     auto &body_node = func_def->children.back();
+void FunctionManager::set_jit(bool enabled)
+{
+     jit_enabled = enabled && Jit::supported();
+}
 
-     if (params_node->children.size() != args.size())
-          throw std::runtime_error("Argument count mismatch in function: " + name);
+bool FunctionManager::run_native(const FunctionEntry &func, const Value *args, size_t depth_left, Value &result)
+{
+     if (!jit_enabled)
+          return false;
+     JitFunction code = func.jit.code.load(std::memory_order_acquire);
+     if (!code)
+     {
+          if (func.jit.calls.load(std::memory_order_relaxed) >= jit_call_threshold ||
+              func.jit.calls.fetch_add(1, std::memory_order_relaxed) + 1 != jit_call_threshold ||
+              !jit.compile(func, *this))
+               return false;
+          code = func.jit.code.load(std::memory_order_acquire);
+     }
+     return Jit::run(func, code, args, depth_left, result);
+}
 
-     evaluator.push_scope();
+// Runs a user function, and every tail call it makes, in one native frame.
+Value FunctionManager::invoke(const FunctionEntry &func, std::vector<Value> args, Evaluator &evaluator)
+{
+     Profiler *profiler = evaluator.profiler();
+     ProfileScope profile(profiler, func.name);
+     Evaluator::ActiveCall call{&func};
+     evaluator.push_frame(func.signature.frame_size);
+     const Script *caller = evaluator.set_script(func.script);
+     Evaluator::ActiveCall *outer = evaluator.enter_call(&call);
+     Value result;
      try
      {
-          for (size_t i = 0; i < args.size(); ++i)
+          while (true)
           {
-               auto [param_name, param_type] = extract_name_and_type(params_node->children[i]->value);
-               Value arg_val = evaluator.evaluate(args[i]);
+               const FunctionSignature &signature = call.function->signature;
+               for (size_t i = 0; i < args.size(); ++i)
+                    evaluator.define_local(signature.param_slots[i], std::move(args[i]));
+               result = evaluator.evaluate_block(call.function->body);
+               if (!evaluator.tail_calling())
+                    break;
 
-               Value::Type expected_type = Value::string_to_type(param_type);
-               arg_val.check_type(expected_type);
-
-               evaluator.define_variable(param_name, arg_val);
+               const FunctionEntry *next = evaluator.take_tail_call(args);
+               evaluator.pop_frame();
+               evaluator.push_frame(next->signature.frame_size);
+               evaluator.set_script(next->script);
+               call.function = next;
+               if (profiler)
+               {
+                    profiler->leave();
+                    profiler->enter(next->name);
+               }
           }
-
-          Value result = evaluator.evaluate_block(body_node);
-          evaluator.pop_scope();
-          return result;
-     }
-     catch (const ReturnSignal &ret)
-     {
-          evaluator.pop_scope();
-
-          auto [_, ret_type]  = extract_name_and_type(func_def->children[1]->value);
-          auto expected_type = Value::string_to_type(ret_type);
-          ret.value.check_type(expected_type);
-
-          return ret.value;
      }
      catch (...)
      {
-          evaluator.pop_scope();
+          evaluator.clear_flow();
+          evaluator.enter_call(outer);
+          evaluator.pop_frame();
+          evaluator.set_script(caller);
           throw;
      }
-}
\ No newline at end of file
+     evaluator.enter_call(outer);
+     evaluator.pop_frame();
+     evaluator.set_script(caller);
+
+     // The `return` statement already checked the declared type.
+     if (evaluator.returning())
+          result = evaluator.take_return();
+     if (call.check_result)
+          result.check_type(call.result_type);
+     return result;
+}
@@ -1,16 +1,136 @@
 #include "interpreter/interpreter.hpp"
 #include "interpreter/builtins.hpp"
+#include "interpreter/loop_analysis.hpp"
+#include "interpreter/optimizer.hpp"
+#include <iostream>
+#include <stdexcept>
 
-Interpreter::Interpreter()
-    : evaluator(function_manager) 
+Interpreter::Interpreter(ExecutionMode mode)
+    : mode(mode), script_output(std::make_unique<StreamSink>(std::cout)),
+      evaluator(function_manager), resolver(function_manager), checker(function_manager), compiler(function_manager),
+      vm(function_manager)
 {
-     function_manager.register_native("cout", builtin_cout);
+     function_manager.register_native("cout", [this](const std::vector<Value> &args)
+                                      { return builtin_cout(script_output, args); });
+     function_manager.register_native("sum", builtin_sum);
+     function_manager.register_native("min", builtin_min);
+     function_manager.register_native("max", builtin_max);
+     function_manager.register_native("dot", builtin_dot);
+     function_manager.register_native("scale", builtin_scale);
+     function_manager.register_native("add", builtin_add);
+     function_manager.register_native("prefix_sum", builtin_prefix_sum);
+     function_manager.register_native("argmax", builtin_argmax);
+     function_manager.register_update("push", builtin_push);
+     function_manager.register_update("pop", builtin_pop);
+     function_manager.register_update("reserve", builtin_reserve);
+     set_threads(0);
 }
 
-void Interpreter::interpret(const std::vector<std::shared_ptr<ASTNode>> &nodes)
+Output &Interpreter::output()
 {
-     for (const auto &node : nodes)
+     return script_output;
+}
+
+void Interpreter::set_dump_bytecode(bool enabled)
+{
+     dump_bytecode = enabled;
+}
+
+void Interpreter::set_max_call_depth(size_t depth)
+{
+     evaluator.set_max_call_depth(depth);
+     vm.set_max_call_depth(depth);
+}
+
+void Interpreter::set_profiler(Profiler *profiler)
+{
+     evaluator.set_profiler(profiler);
+     vm.set_profiler(profiler);
+}
+
+void Interpreter::set_threads(size_t threads)
+{
+     pool = std::make_unique<ThreadPool>(threads);
+     evaluator.set_thread_pool(pool.get());
+     vm.set_thread_pool(pool.get());
+}
+
+void Interpreter::set_jit(bool enabled)
+{
+     function_manager.set_jit(enabled);
+}
+
+const InterpretStats &Interpreter::last_stats() const
+{
+     return stats;
+}
+
+void Interpreter::interpret(std::shared_ptr<const Ast> ast)
+{
+     auto script = std::make_unique<Script>();
+     script->ast = ast.get();
+     script->owner = std::move(ast);
+     run(std::move(script));
+}
+
+void Interpreter::interpret(const Ast &ast)
+{
+     auto script = std::make_unique<Script>();
+     script->ast = &ast;
+     run(std::move(script));
+}
+
+void Interpreter::run(std::unique_ptr<Script> script)
+{
+     using Clock = std::chrono::steady_clock;
+     stats = InterpretStats();
+     auto start = Clock::now();
+
+     const Ast &ast = *script->ast;
+     script->resolution = resolver.resolve(ast);
+     script->call_targets = std::vector<std::atomic<const FunctionEntry *>>(ast.size());
+     for (const Literal &literal : ast.literals())
+          script->constants.push_back(literal_to_value(literal, ast.symbols()));
+     auto resolved = Clock::now();
+     stats.resolve = resolved - start;
+     script->types = checker.check(*script);
+     script->invariant_limits = find_invariant_limits(*script, function_manager);
+     scripts.push_back(std::move(script));
+     const Script &current = *scripts.back();
+     auto checked = Clock::now();
+     stats.check = checked - resolved;
+
+     if (mode == ExecutionMode::TreeWalker)
+     {
+          evaluator.resize_globals(resolver.global_count());
+          evaluator.set_script(&current);
+          for (NodeId node : current.ast->roots())
+          {
+               evaluator.evaluate(node);
+               if (evaluator.returning())
+               {
+                    evaluator.take_return();
+                    throw std::runtime_error("Return outside of function");
+               }
+          }
+          stats.execute = Clock::now() - checked;
+          return;
+     }
+
+     programs.push_back(compiler.compile(current, resolver.global_names()));
+     const Program &program = *programs.back();
+     stats.instructions = program.main.chunk.code.size();
+     for (const auto &fn : program.functions)
+          stats.instructions += fn->chunk.code.size();
+     auto compiled = Clock::now();
+     stats.compile = compiled - checked;
+
+     if (dump_bytecode)
      {
-          evaluator.evaluate(node);
+          std::cerr << disassemble(program.main);
+          for (const auto &fn : program.functions)
+               std::cerr << disassemble(*fn);
      }
+     vm.run(program);
+     stats.execute = Clock::now() - compiled;
 }
@@ -0,0 +1,1188 @@
+#include "interpreter/jit.hpp"
+#include "interpreter/function_manager.hpp"
+#include "interpreter/native_stack.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__)) && (defined(__GNUC__) || defined(__clang__))
+#define KARAMEL_JIT 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+void JitState::reset()
+{
+     calls.store(0, std::memory_order_relaxed);
+     bailouts.store(0, std::memory_order_relaxed);
+     code.store(nullptr, std::memory_order_release);
+}
+
+bool Jit::supported()
+{
+#ifdef KARAMEL_JIT
+     return true;
+#else
+     return false;
+#endif
+}
+
+#ifndef KARAMEL_JIT
+
+Jit::~Jit() = default;
+
+bool Jit::compile(const FunctionEntry &, const FunctionManager &)
+{
+     return false;
+}
+
+bool Jit::run(const FunctionEntry &, JitFunction, const Value *, size_t, Value &)
+{
+     return false;
+}
+
+#else
+
+namespace
+{
+constexpr size_t max_params = 16;
+constexpr int64_t max_native_depth = 100000;
+// Native frames stop this far below the frame that entered the JIT, or
+// at the thread's stack floor if the interpreter is already close to it.
+constexpr uintptr_t native_stack_budget = 512 * 1024;
+
+// Thrown while compiling a function the JIT does not handle.
+struct Unsupported
+{
+};
+
+// Static type of a value in native code. Num is the result of flo
+// arithmetic: the interpreter narrows a whole result to num, so its
+// dynamic type follows from the double itself, which is kept canonical
+// (a whole Num is exactly the double of its int).
+enum class Kind : uint8_t
+{
+     Unknown,
+     Int,
+     Float,
+     Num,
+     Bool,
+};
+
+Kind kind_of(Value::Type type)
+{
+     switch (type)
+     {
+     case Value::Type::Int:
+          return Kind::Int;
+     case Value::Type::Float:
+          return Kind::Float;
+     case Value::Type::Bool:
+          return Kind::Bool;
+     default:
+          throw Unsupported{};
+     }
+}
+
+bool numeric(Kind kind)
+{
+     return kind == Kind::Int || kind == Kind::Float || kind == Kind::Num;
+}
+
+// Whether the interpreter would narrow `value` to a num.
+bool num_is_int(double value)
+{
+     return std::floor(value) == value && value >= -0x1p63 && value < 0x1p63;
+}
+
+// Largest int a Num can carry: every int up to here has an exact double.
+constexpr int64_t max_exact_int = int64_t(1) << 53;
+
+// Add, Sub and Mul on anything but two ints, with the same dispatch and
+// narrowing as Evaluator::eval_binary_op. Called from generated code,
+// which passes ints as exact doubles; `code` packs the operator and both
+// operand kinds. Gives up on an overflow, which the interpreter reports,
+// and on an int result too large to carry exactly as a Num.
+double arith(uint32_t code, JitContext *context, double lhs, double rhs)
+{
+     Operator op = static_cast<Operator>(code & 0xff);
+     Kind lk = static_cast<Kind>((code >> 8) & 0xff);
+     Kind rk = static_cast<Kind>((code >> 16) & 0xff);
+     bool l_int = lk == Kind::Int || (lk == Kind::Num && num_is_int(lhs));
+     bool r_int = rk == Kind::Int || (rk == Kind::Num && num_is_int(rhs));
+     if (l_int && r_int)
+     {
+          int64_t l = static_cast<int64_t>(lhs);
+          int64_t r = static_cast<int64_t>(rhs);
+          int64_t v;
+          bool overflow = op == Operator::Add   ? __builtin_add_overflow(l, r, &v)
+                          : op == Operator::Sub ? __builtin_sub_overflow(l, r, &v)
+                                                : __builtin_mul_overflow(l, r, &v);
+          if (overflow || v > max_exact_int || v < -max_exact_int)
+          {
+               context->bailed = 1;
+               return 0;
+          }
+          return static_cast<double>(v);
+     }
+     double v = op == Operator::Add ? lhs + rhs : op == Operator::Sub ? lhs - rhs : lhs * rhs;
+     // Whole results become ints, which also turns -0.0 into 0.
+     return num_is_int(v) ? static_cast<double>(static_cast<int64_t>(v)) : v;
+}
+
+uint64_t to_bits(const Value &value)
+{
+     switch (value.type())
+     {
+     case Value::Type::Int:
+          return static_cast<uint64_t>(value.int_val());
+     case Value::Type::Float:
+     {
+          double v = value.float_val();
+          uint64_t bits;
+          std::memcpy(&bits, &v, sizeof(bits));
+          return bits;
+     }
+     default:
+          return value.bool_val() ? 1 : 0;
+     }
+}
+
+Value from_bits(uint64_t bits, Value::Type type)
+{
+     switch (type)
+     {
+     case Value::Type::Int:
+          return Value(static_cast<int64_t>(bits));
+     case Value::Type::Float:
+     {
+          double v;
+          std::memcpy(&v, &bits, sizeof(v));
+          return Value(v);
+     }
+     default:
+          return Value(bits != 0);
+     }
+}
+
+enum Reg : uint8_t
+{
+     rax,
+     rcx,
+     rdx,
+     rbx,
+     rsp,
+     rbp,
+     rsi,
+     rdi,
+};
+
+enum Xmm : uint8_t
+{
+     xmm0,
+     xmm1,
+     xmm2,
+};
+
+// x86 condition codes, as used by Jcc and SETcc.
+enum Cond : uint8_t
+{
+     overflow = 0x0,
+     below = 0x2,
+     above_equal = 0x3,
+     equal = 0x4,
+     not_equal = 0x5,
+     above = 0x7,
+     sign = 0x8,
+     parity = 0xa,
+     no_parity = 0xb,
+     less = 0xc,
+     greater_equal = 0xd,
+     less_equal = 0xe,
+     greater = 0xf,
+};
+
+struct Label
+{
+     int64_t pos = -1;
+     std::vector<size_t> fixups;
+};
+
+// Emits the handful of instructions the code generator needs. Memory
+// operands are always [base + disp32]; only the low eight registers are
+// used, so no REX prefix carries register bits.
+class Assembler
+{
+public:
+     std::vector<uint8_t> code;
+
+     size_t size() const { return code.size(); }
+
+     void byte(uint8_t b) { code.push_back(b); }
+     void dword(uint32_t v)
+     {
+          for (int i = 0; i < 4; ++i)
+               byte(static_cast<uint8_t>(v >> (8 * i)));
+     }
+     void qword(uint64_t v)
+     {
+          for (int i = 0; i < 8; ++i)
+               byte(static_cast<uint8_t>(v >> (8 * i)));
+     }
+     void patch32(size_t at, uint32_t v)
+     {
+          for (int i = 0; i < 4; ++i)
+               code[at + i] = static_cast<uint8_t>(v >> (8 * i));
+     }
+
+     void bind(Label &label)
+     {
+          label.pos = static_cast<int64_t>(size());
+          for (size_t at : label.fixups)
+               patch32(at, static_cast<uint32_t>(label.pos - static_cast<int64_t>(at + 4)));
+          label.fixups.clear();
+     }
+
+     void push(Reg r) { byte(0x50 + r); }
+     void leave() { byte(0xc9); }
+     void ret() { byte(0xc3); }
+
+     void mov_load64(Reg dst, Reg base, int32_t disp) { rex_w(); op_mem(0x8b, dst, base, disp); }
+     void mov_store64(Reg base, int32_t disp, Reg src) { rex_w(); op_mem(0x89, src, base, disp); }
+     void mov_reg64(Reg dst, Reg src) { rex_w(); byte(0x89); reg_reg(src, dst); }
+     void mov_imm32(Reg dst, uint32_t v) { byte(0xb8 + dst); dword(v); }
+     void mov_imm64(Reg dst, uint64_t v) { rex_w(); byte(0xb8 + dst); qword(v); }
+     void lea(Reg dst, Reg base, int32_t disp) { rex_w(); op_mem(0x8d, dst, base, disp); }
+
+     // Sign-extended immediates on 64-bit memory.
+     void store_imm64(Reg base, int32_t disp, int32_t v) { rex_w(); op_mem(0xc7, 0, base, disp); dword(v); }
+     void add_mem_imm8(Reg base, int32_t disp, int8_t v) { rex_w(); op_mem(0x83, 0, base, disp); byte(v); }
+     void sub_mem_imm8(Reg base, int32_t disp, int8_t v) { rex_w(); op_mem(0x83, 5, base, disp); byte(v); }
+     void cmp_mem_imm8(Reg base, int32_t disp, int8_t v) { rex_w(); op_mem(0x83, 7, base, disp); byte(v); }
+     void cmp_reg_mem64(Reg r, Reg base, int32_t disp) { rex_w(); op_mem(0x3b, r, base, disp); }
+     void sub_rsp_imm32(uint32_t v) { rex_w(); byte(0x81); reg_reg(5, rsp); dword(v); }
+
+     // Register forms; `opcode` is the "r/m, reg" encoding. Ints and
+     // bools are 64-bit, so only the 64-bit forms are needed.
+     void alu64(uint8_t opcode, Reg dst, Reg src) { rex_w(); byte(opcode); reg_reg(src, dst); }
+     void add64(Reg dst, Reg src) { alu64(0x01, dst, src); }
+     void sub64(Reg dst, Reg src) { alu64(0x29, dst, src); }
+     void and64(Reg dst, Reg src) { alu64(0x21, dst, src); }
+     void or64(Reg dst, Reg src) { alu64(0x09, dst, src); }
+     void cmp64(Reg lhs, Reg rhs) { alu64(0x39, lhs, rhs); }
+     void test64(Reg lhs, Reg rhs) { alu64(0x85, lhs, rhs); }
+     void imul64(Reg dst, Reg src) { rex_w(); byte(0x0f); byte(0xaf); reg_reg(dst, src); }
+     void add_imm8(Reg dst, int8_t v) { rex_w(); byte(0x83); reg_reg(0, dst); byte(v); }
+
+     // Byte registers: al, cl, dl.
+     void setcc(Cond c, Reg dst) { byte(0x0f); byte(0x90 + c); reg_reg(0, dst); }
+     void and8(Reg dst, Reg src) { byte(0x20); reg_reg(src, dst); }
+     void or8(Reg dst, Reg src) { byte(0x08); reg_reg(src, dst); }
+     void cmp8(Reg lhs, Reg rhs) { byte(0x38); reg_reg(rhs, lhs); }
+     void movzx8(Reg dst, Reg src) { byte(0x0f); byte(0xb6); reg_reg(dst, src); }
+
+     void movsd_load(Xmm dst, Reg base, int32_t disp) { sse_mem(0xf2, 0x10, dst, base, disp); }
+     void movsd_store(Reg base, int32_t disp, Xmm src) { sse_mem(0xf2, 0x11, src, base, disp); }
+     void movapd(Xmm dst, Xmm src) { sse(0x66, 0x28, dst, src); }
+     void addsd(Xmm dst, Xmm src) { sse(0xf2, 0x58, dst, src); }
+     void divsd(Xmm dst, Xmm src) { sse(0xf2, 0x5e, dst, src); }
+     void ucomisd(Xmm lhs, Xmm rhs) { sse(0x66, 0x2e, lhs, rhs); }
+     void cvtsi2sd(Xmm dst, Reg src) { sse(0xf2, 0x2a, dst, src, true); }
+     void cvttsd2si(Reg dst, Xmm src) { sse(0xf2, 0x2c, dst, src, true); }
+     void movq_to_xmm(Xmm dst, Reg src) { byte(0x66); rex_w(); byte(0x0f); byte(0x6e); reg_reg(dst, src); }
+     void movq_from_xmm(Reg dst, Xmm src) { byte(0x66); rex_w(); byte(0x0f); byte(0x7e); reg_reg(src, dst); }
+
+     void jmp(Label &target) { byte(0xe9); ref(target); }
+     void jcc(Cond c, Label &target) { byte(0x0f); byte(0x80 + c); ref(target); }
+     void call(Label &target) { byte(0xe8); ref(target); }
+     void call(Reg target) { byte(0xff); reg_reg(2, target); }
+
+private:
+     void rex_w() { byte(0x48); }
+     void reg_reg(uint8_t reg, uint8_t rm) { byte(static_cast<uint8_t>(0xc0 | (reg << 3) | rm)); }
+     void mem(uint8_t reg, Reg base, int32_t disp)
+     {
+          byte(static_cast<uint8_t>(0x80 | (reg << 3) | base));
+          if (base == rsp)
+               byte(0x24);
+          dword(static_cast<uint32_t>(disp));
+     }
+     void op_mem(uint8_t opcode, uint8_t reg, Reg base, int32_t disp) { byte(opcode), mem(reg, base, disp); }
+     void sse(uint8_t prefix, uint8_t opcode, uint8_t reg, uint8_t rm, bool wide = false)
+     {
+          byte(prefix);
+          if (wide)
+               rex_w();
+          byte(0x0f);
+          byte(opcode);
+          reg_reg(reg, rm);
+     }
+     void sse_mem(uint8_t prefix, uint8_t opcode, uint8_t reg, Reg base, int32_t disp)
+     {
+          byte(prefix);
+          byte(0x0f);
+          op_mem(opcode, reg, base, disp);
+     }
+     void ref(Label &target)
+     {
+          if (target.pos >= 0)
+               dword(static_cast<uint32_t>(target.pos - static_cast<int64_t>(size() + 4)));
+          else
+          {
+               target.fixups.push_back(size());
+               dword(0);
+          }
+     }
+};
+
+constexpr int32_t ctx_bailed = offsetof(JitContext, bailed);
+constexpr int32_t ctx_depth_left = offsetof(JitContext, depth_left);
+constexpr int32_t ctx_stack_floor = offsetof(JitContext, stack_floor);
+constexpr int32_t ctx_bailed_in = offsetof(JitContext, bailed_in);
+
+// Compiles one function. Values live in rax (num, bool) or xmm0 (flo and
+// Num) between nodes; every local has a value and a "defined" word in the
+// frame, and binary operands and call arguments are spilled to temporary
+// frame slots, so nothing stays in a register across a call. rbx holds the
+// JitContext.
+//
+// Frame, below the saved rbp: saved rbx, then per local a flag word and a
+// value word, then the temporaries.
+class FunctionCompiler
+{
+public:
+     FunctionCompiler(const FunctionEntry &function, const FunctionManager &functions)
+         : function(function), functions(functions), script(*function.script), ast(*script.ast)
+     {
+     }
+
+     // Gives every local one static type, or throws Unsupported.
+     void analyze()
+     {
+          const FunctionSignature &signature = function.signature;
+          if (!signature.has_return_type || signature.param_types.size() > max_params)
+               throw Unsupported{};
+          return_kind = kind_of(signature.return_type);
+          locals.assign(signature.frame_size, Kind::Unknown);
+          is_param.assign(signature.frame_size, false);
+          for (size_t i = 0; i < signature.param_types.size(); ++i)
+          {
+               locals.at(signature.param_slots[i]) = kind_of(signature.param_types[i]);
+               is_param[signature.param_slots[i]] = true;
+          }
+          do
+          {
+               changed = false;
+               infer_block(function.body);
+          } while (changed);
+     }
+
+     const std::vector<const FunctionEntry *> &callees() const { return called; }
+
+     std::vector<uint8_t> generate()
+     {
+          const FunctionSignature &signature = function.signature;
+          Label start;
+          as.bind(start);
+          self = &start;
+          as.push(rbp);
+          as.mov_reg64(rbp, rsp);
+          as.push(rbx);
+          as.sub_rsp_imm32(0);
+          size_t frame_patch = as.size() - 4;
+          as.mov_reg64(rbx, rsi);
+          as.cmp_reg_mem64(rsp, rbx, ctx_stack_floor);
+          as.jcc(below, bail);
+          as.sub_mem_imm8(rbx, ctx_depth_left, 1);
+          as.jcc(sign, bail);
+
+          // A self tail call jumps back here with rdi pointing at its
+          // arguments, which also starts a fresh frame.
+          as.bind(params);
+          for (size_t i = 0; i < signature.param_types.size(); ++i)
+          {
+               uint32_t slot = signature.param_slots[i];
+               as.mov_load64(rax, rdi, static_cast<int32_t>(8 * i));
+               if (locals[slot] == Kind::Num && kind_of(signature.param_types[i]) == Kind::Int)
+               {
+                    to_double(xmm0, rax);
+                    as.movsd_store(rbp, value_disp(slot), xmm0);
+               }
+               else
+               {
+                    as.mov_store64(rbp, value_disp(slot), rax);
+               }
+               as.store_imm64(rbp, flag_disp(slot), 1);
+          }
+          for (uint32_t slot = 0; slot < locals.size(); ++slot)
+               if (!is_param[slot])
+                    as.store_imm64(rbp, flag_disp(slot), 0);
+
+          gen_block(function.body);
+          // Falling off the end returns the last statement's value, which
+          // is left to the interpreter.
+          as.jmp(bail);
+
+          as.bind(finish);
+          as.add_mem_imm8(rbx, ctx_depth_left, 1);
+          as.bind(unwind);
+          as.mov_load64(rbx, rbp, -8);
+          as.leave();
+          as.ret();
+
+          as.bind(bail);
+          as.mov_imm64(rax, reinterpret_cast<uint64_t>(&function));
+          as.mov_store64(rbx, ctx_bailed_in, rax);
+          as.store_imm64(rbx, ctx_bailed, 1);
+          as.jmp(unwind);
+
+          // rsp must stay 16-byte aligned at calls: the pushes of rbp and
+          // rbx leave it 8 bytes off.
+          uint32_t frame = static_cast<uint32_t>(16 * locals.size() + 8 * max_temps);
+          if (frame % 16 == 0)
+               frame += 8;
+          as.patch32(frame_patch, frame);
+          return std::move(as.code);
+     }
+
+private:
+     const FunctionEntry &function;
+     const FunctionManager &functions;
+     const Script &script;
+     const Ast &ast;
+
+     Kind return_kind = Kind::Unknown;
+     std::vector<Kind> locals;
+     std::vector<bool> is_param;
+     std::vector<const FunctionEntry *> called;
+     bool changed = false;
+
+     Assembler as;
+     Label *self = nullptr;
+     Label params, finish, unwind, bail;
+     size_t temps = 0;
+     size_t max_temps = 0;
+
+     int32_t flag_disp(uint32_t slot) const { return -16 - 16 * static_cast<int32_t>(slot); }
+     int32_t value_disp(uint32_t slot) const { return -24 - 16 * static_cast<int32_t>(slot); }
+     int32_t temp_disp(size_t temp) const
+     {
+          return -static_cast<int32_t>(8 + 16 * locals.size() + 8 * (temp + 1));
+     }
+
+     size_t push_temp()
+     {
+          max_temps = std::max(max_temps, temps + 1);
+          return temps++;
+     }
+
+     uint32_t local_slot(NodeId var) const
+     {
+          const VarRef &ref = script.resolution[var];
+          if (ref.depth != 0 || ref.slot >= locals.size())
+               throw Unsupported{};
+          return ref.slot;
+     }
+
+     const FunctionEntry &callee(NodeId call)
+     {
+          const FunctionEntry *target;
+          try
+          {
+               target = &functions.resolve(std::string(ast.text(call)));
+          }
+          catch (const std::runtime_error &)
+          {
+               throw Unsupported{};
+          }
+          const FunctionSignature &signature = target->signature;
+          if (target->update || !target->script || !signature.has_return_type ||
+              signature.param_types.size() != ast.children(call).size() ||
+              signature.param_types.size() > max_params)
+               throw Unsupported{};
+          if (target != &function && std::find(called.begin(), called.end(), target) == called.end())
+               called.push_back(target);
+          return *target;
+     }
+
+     Kind literal_kind(NodeId id) const
+     {
+          switch (ast.type(id))
+          {
+          case NodeType::Constant:
+               return kind_of(script.constants[ast.node(id).value].type());
+          case NodeType::Number:
+               return Kind::Int;
+          case NodeType::DecimalNumber:
+               return Kind::Float;
+          default:
+               return Kind::Bool;
+          }
+     }
+
+     static Kind binary_kind(Operator op, Kind lhs, Kind rhs)
+     {
+          switch (op)
+          {
+          case Operator::Add:
+          case Operator::Sub:
+          case Operator::Mul:
+               if (lhs == Kind::Int && rhs == Kind::Int)
+                    return Kind::Int;
+               if (numeric(lhs) && numeric(rhs))
+                    return Kind::Num;
+               break;
+          case Operator::Div:
+               if (numeric(lhs) && numeric(rhs))
+                    return Kind::Float;
+               break;
+          case Operator::Equal:
+          case Operator::NotEqual:
+          case Operator::Less:
+          case Operator::LessEqual:
+          case Operator::Greater:
+          case Operator::GreaterEqual:
+               if (numeric(lhs) && numeric(rhs))
+                    return Kind::Bool;
+               break;
+          case Operator::And:
+          case Operator::Or:
+               if (lhs == Kind::Bool && rhs == Kind::Bool)
+                    return Kind::Bool;
+               break;
+          default:
+               break;
+          }
+          throw Unsupported{};
+     }
+
+     // A num local may also be assigned Num values; any other mix would be
+     // a type error in the interpreter.
+     void merge(uint32_t slot, Kind kind)
+     {
+          Kind &current = locals[slot];
+          if (kind == Kind::Unknown || current == kind)
+               return;
+          if (current == Kind::Unknown)
+               current = kind;
+          else if ((current == Kind::Int && kind == Kind::Num) || (current == Kind::Num && kind == Kind::Int))
+          {
+               if (current == Kind::Num)
+                    return;
+               current = Kind::Num;
+          }
+          else
+               throw Unsupported{};
+          changed = true;
+     }
+
+     void infer_block(NodeId block)
+     {
+          for (NodeId stmt : ast.children(block))
+               infer(stmt);
+     }
+
+     Kind infer(NodeId id)
+     {
+          switch (ast.type(id))
+          {
+          case NodeType::Constant:
+          case NodeType::Number:
+          case NodeType::DecimalNumber:
+          case NodeType::Boolean:
+               return literal_kind(id);
+          case NodeType::Identifier:
+               return locals[local_slot(id)];
+          case NodeType::Assignment:
+          {
+               Kind kind = infer(ast.child(id, 1));
+               merge(local_slot(ast.child(id, 0)), kind);
+               return kind;
+          }
+          case NodeType::BinaryOp:
+          {
+               Kind lhs = infer(ast.child(id, 0));
+               Kind rhs = infer(ast.child(id, 1));
+               if (lhs == Kind::Unknown || rhs == Kind::Unknown)
+                    return Kind::Unknown;
+               return binary_kind(ast.op(id), lhs, rhs);
+          }
+          case NodeType::FunctionCall:
+          {
+               const FunctionEntry &target = callee(id);
+               for (NodeId arg : ast.children(id))
+                    infer(arg);
+               return kind_of(target.signature.return_type);
+          }
+          case NodeType::If:
+               infer(ast.child(id, 0));
+               infer_block(ast.child(id, 1));
+               return Kind::Unknown;
+          case NodeType::For:
+               for (NodeId part : ast.children(ast.child(id, 0)))
+                    infer(part);
+               infer_block(ast.child(id, 1));
+               return Kind::Unknown;
+          case NodeType::Return:
+               infer(ast.child(id, 0));
+               return Kind::Unknown;
+          default:
+               throw Unsupported{};
+          }
+     }
+
+     // Sets the flags for a Num in `value`: ZF set and PF clear when it is
+     // a whole number in num range, i.e. dynamically a num. Out of range,
+     // the conversion yields INT64_MIN, which only converts back to itself.
+     // Clobbers rsi and xmm2.
+     void test_num(Xmm value)
+     {
+          as.cvttsd2si(rsi, value);
+          as.cvtsi2sd(xmm2, rsi);
+          as.ucomisd(value, xmm2);
+     }
+
+     // Converts the int in `src` to a double, bailing out unless it is
+     // exact: the interpreter would keep working on the int. Clobbers rsi.
+     void to_double(Xmm dst, Reg src)
+     {
+          as.cvtsi2sd(dst, src);
+          as.cvttsd2si(rsi, dst);
+          as.cmp64(rsi, src);
+          as.jcc(not_equal, bail);
+     }
+
+     // Converts the value just computed to `target`, bailing out where the
+     // interpreter's type check would fail.
+     void coerce(Kind kind, Kind target)
+     {
+          if (kind == target)
+               return;
+          if (kind != Kind::Num)
+               throw Unsupported{};
+          if (target == Kind::Int)
+          {
+               test_num(xmm0);
+               as.jcc(parity, bail);
+               as.jcc(not_equal, bail);
+               as.cvttsd2si(rax, xmm0);
+          }
+          else if (target == Kind::Float)
+          {
+               Label ok;
+               test_num(xmm0);
+               as.jcc(parity, ok);
+               as.jcc(not_equal, ok);
+               as.jmp(bail);
+               as.bind(ok);
+          }
+          else
+               throw Unsupported{};
+     }
+
+     void spill(Kind kind, size_t temp)
+     {
+          if (kind == Kind::Float || kind == Kind::Num)
+               as.movsd_store(rbp, temp_disp(temp), xmm0);
+          else
+               as.mov_store64(rbp, temp_disp(temp), rax);
+     }
+
+     void test_condition(Kind kind)
+     {
+          // is_true() is false for every flo, so only num and bool qualify.
+          if (kind != Kind::Int && kind != Kind::Bool)
+               throw Unsupported{};
+          as.test64(rax, rax);
+     }
+
+     void gen_block(NodeId block)
+     {
+          for (NodeId stmt : ast.children(block))
+          {
+               switch (ast.type(stmt))
+               {
+               case NodeType::If:
+               {
+                    Label skip;
+                    test_condition(gen(ast.child(stmt, 0)));
+                    as.jcc(equal, skip);
+                    gen_block(ast.child(stmt, 1));
+                    as.bind(skip);
+                    break;
+               }
+               case NodeType::For:
+                    gen_for(stmt);
+                    break;
+               case NodeType::Return:
+                    gen_return(stmt);
+                    break;
+               default:
+                    gen(stmt);
+                    break;
+               }
+          }
+     }
+
+     void gen_for(NodeId node)
+     {
+          NodeId head = ast.child(node, 0);
+          NodeId body = ast.child(node, 1);
+          Label top, done;
+          if (ast.type(head) == NodeType::While)
+          {
+               as.bind(top);
+               test_condition(gen(ast.child(head, 0)));
+               as.jcc(equal, done);
+               gen_block(body);
+               as.jmp(top);
+               as.bind(done);
+               return;
+          }
+          if (ast.type(head) != NodeType::ForLoop || ast.children(head).size() != 2 ||
+              ast.type(ast.child(head, 0)) != NodeType::Assignment)
+               throw Unsupported{};
+
+          // Same steps as Evaluator::execute_for_loop: the limit is
+          // evaluated before every iteration unless it is invariant, and
+          // the counter is advanced from its value at the top of the
+          // iteration.
+          NodeId assign = ast.child(head, 0);
+          uint32_t slot = local_slot(ast.child(assign, 0));
+          if (locals[slot] != Kind::Int)
+               throw Unsupported{};
+          gen(assign);
+          bool invariant = script.invariant_limits[node];
+          size_t limit = push_temp();
+          size_t current = push_temp();
+          if (invariant)
+               gen_limit(ast.child(head, 1), limit);
+          as.bind(top);
+          as.mov_load64(rax, rbp, value_disp(slot));
+          as.mov_store64(rbp, temp_disp(current), rax);
+          if (!invariant)
+               gen_limit(ast.child(head, 1), limit);
+          as.mov_load64(rcx, rbp, temp_disp(limit));
+          as.mov_load64(rax, rbp, temp_disp(current));
+          as.cmp64(rax, rcx);
+          as.jcc(greater_equal, done);
+          gen_block(body);
+          // The counter is below the limit, so this cannot overflow.
+          as.mov_load64(rax, rbp, temp_disp(current));
+          as.add_imm8(rax, 1);
+          as.mov_store64(rbp, value_disp(slot), rax);
+          as.jmp(top);
+          as.bind(done);
+          temps -= 2;
+     }
+
+     void gen_limit(NodeId limit, size_t temp)
+     {
+          if (gen(limit) != Kind::Int)
+               throw Unsupported{};
+          as.mov_store64(rbp, temp_disp(temp), rax);
+     }
+
+     void gen_return(NodeId node)
+     {
+          NodeId result = ast.child(node, 0);
+          if (ast.type(result) == NodeType::FunctionCall && &callee(result) == &function)
+          {
+               gen_call(result, true);
+               return;
+          }
+          coerce(gen(result), return_kind);
+          if (return_kind == Kind::Float)
+               as.movq_from_xmm(rax, xmm0);
+          as.jmp(finish);
+     }
+
+     Kind gen_call(NodeId call, bool tail)
+     {
+          const FunctionEntry &target = callee(call);
+          const FunctionSignature &signature = target.signature;
+          NodeRange args = ast.children(call);
+          size_t count = args.size();
+          size_t base = temps;
+          temps += count;
+          max_temps = std::max(max_temps, temps);
+          // Arguments go in ascending addresses, and temporaries grow down.
+          for (size_t i = 0; i < count; ++i)
+          {
+               Kind param = kind_of(signature.param_types[i]);
+               coerce(gen(args[i]), param);
+               spill(param, base + count - 1 - i);
+          }
+          if (count > 0)
+               as.lea(rdi, rbp, temp_disp(base + count - 1));
+          temps = base;
+
+          if (tail)
+          {
+               as.jmp(params);
+               return Kind::Unknown;
+          }
+          as.mov_reg64(rsi, rbx);
+          if (&target == &function)
+               as.call(*self);
+          else
+          {
+               // Entries never move, and a redefinition clears every
+               // entry's code, so the pointer is either current or null.
+               as.mov_imm64(rax, reinterpret_cast<uint64_t>(&target.jit.code));
+               as.mov_load64(rax, rax, 0);
+               as.test64(rax, rax);
+               as.jcc(equal, bail);
+               as.call(rax);
+          }
+          as.cmp_mem_imm8(rbx, ctx_bailed, 0);
+          as.jcc(not_equal, unwind);
+
+          Kind result = kind_of(signature.return_type);
+          if (result == Kind::Float)
+               as.movq_to_xmm(xmm0, rax);
+          return result;
+     }
+
+     void gen_store(uint32_t slot, Kind kind)
+     {
+          Kind local = locals[slot];
+          if (local == kind)
+          {
+               if (kind == Kind::Num)
+               {
+                    // A Num local keeps whichever of num or flo it was
+                    // first given.
+                    Label fresh;
+                    as.cmp_mem_imm8(rbp, flag_disp(slot), 0);
+                    as.jcc(equal, fresh);
+                    test_num(xmm0);
+                    as.setcc(equal, rcx);
+                    as.setcc(no_parity, rdx);
+                    as.and8(rcx, rdx);
+                    as.movsd_load(xmm1, rbp, value_disp(slot));
+                    test_num(xmm1);
+                    as.setcc(equal, rax);
+                    as.setcc(no_parity, rdx);
+                    as.and8(rax, rdx);
+                    as.cmp8(rax, rcx);
+                    as.jcc(not_equal, bail);
+                    as.bind(fresh);
+               }
+               if (kind == Kind::Float || kind == Kind::Num)
+                    as.movsd_store(rbp, value_disp(slot), xmm0);
+               else
+                    as.mov_store64(rbp, value_disp(slot), rax);
+          }
+          else if (local == Kind::Num && kind == Kind::Int)
+          {
+               Label fresh;
+               as.cmp_mem_imm8(rbp, flag_disp(slot), 0);
+               as.jcc(equal, fresh);
+               as.movsd_load(xmm1, rbp, value_disp(slot));
+               test_num(xmm1);
+               as.jcc(parity, bail);
+               as.jcc(not_equal, bail);
+               as.bind(fresh);
+               to_double(xmm1, rax);
+               as.movsd_store(rbp, value_disp(slot), xmm1);
+          }
+          else
+               throw Unsupported{};
+          as.store_imm64(rbp, flag_disp(slot), 1);
+     }
+
+     void gen_literal(NodeId id)
+     {
+          Value value;
+          switch (ast.type(id))
+          {
+          case NodeType::Constant:
+               value = script.constants[ast.node(id).value];
+               break;
+          case NodeType::Number:
+               try
+               {
+                    value = Value(static_cast<int64_t>(std::stoll(std::string(ast.text(id)))));
+               }
+               catch (const std::exception &)
+               {
+                    throw Unsupported{};
+               }
+               break;
+          case NodeType::DecimalNumber:
+               try
+               {
+                    value = Value(std::stod(std::string(ast.text(id))));
+               }
+               catch (const std::exception &)
+               {
+                    throw Unsupported{};
+               }
+               break;
+          default:
+               value = Value(ast.text(id) == "true");
+               break;
+          }
+          if (value.type() == Value::Type::Bool)
+               as.mov_imm32(rax, static_cast<uint32_t>(to_bits(value)));
+          else
+               as.mov_imm64(rax, to_bits(value));
+          if (value.type() == Value::Type::Float)
+               as.movq_to_xmm(xmm0, rax);
+     }
+
+     Kind gen_binary(NodeId id)
+     {
+          Kind lhs = gen(ast.child(id, 0));
+          size_t temp = push_temp();
+          spill(lhs, temp);
+          Kind rhs = gen(ast.child(id, 1));
+          temps--;
+          Operator op = ast.op(id);
+          Kind result = binary_kind(op, lhs, rhs);
+
+          if (op != Operator::Div && lhs == rhs && (lhs == Kind::Int || lhs == Kind::Bool))
+          {
+               // The interpreter reports an overflow, so native code leaves
+               // it to the interpreter.
+               as.mov_reg64(rcx, rax);
+               as.mov_load64(rax, rbp, temp_disp(temp));
+               switch (op)
+               {
+               case Operator::Add:
+                    as.add64(rax, rcx);
+                    as.jcc(overflow, bail);
+                    return result;
+               case Operator::Sub:
+                    as.sub64(rax, rcx);
+                    as.jcc(overflow, bail);
+                    return result;
+               case Operator::Mul:
+                    as.imul64(rax, rcx);
+                    as.jcc(overflow, bail);
+                    return result;
+               case Operator::And:
+                    as.and64(rax, rcx);
+                    return result;
+               case Operator::Or:
+                    as.or64(rax, rcx);
+                    return result;
+               default:
+                    break;
+               }
+               static const Cond conditions[] = {equal, not_equal, less, less_equal, greater, greater_equal};
+               as.cmp64(rax, rcx);
+               as.setcc(conditions[static_cast<int>(op) - static_cast<int>(Operator::Equal)], rax);
+               as.movzx8(rax, rax);
+               return result;
+          }
+
+          if (rhs == Kind::Int)
+               to_double(xmm1, rax);
+          else
+               as.movapd(xmm1, xmm0);
+          if (lhs == Kind::Int)
+          {
+               as.mov_load64(rax, rbp, temp_disp(temp));
+               to_double(xmm0, rax);
+          }
+          else
+               as.movsd_load(xmm0, rbp, temp_disp(temp));
+
+          switch (op)
+          {
+          case Operator::Div:
+               as.divsd(xmm0, xmm1);
+               return result;
+          case Operator::Add:
+          case Operator::Sub:
+          case Operator::Mul:
+               as.mov_imm32(rdi, static_cast<uint32_t>(op) | static_cast<uint32_t>(lhs) << 8 |
+                                      static_cast<uint32_t>(rhs) << 16);
+               as.mov_reg64(rsi, rbx);
+               as.mov_imm64(rax, reinterpret_cast<uint64_t>(&arith));
+               as.call(rax);
+               as.cmp_mem_imm8(rbx, ctx_bailed, 0);
+               as.jcc(not_equal, bail);
+               return result;
+          case Operator::Equal:
+          case Operator::NotEqual:
+               as.ucomisd(xmm0, xmm1);
+               as.setcc(op == Operator::Equal ? equal : not_equal, rax);
+               as.setcc(op == Operator::Equal ? no_parity : parity, rcx);
+               if (op == Operator::Equal)
+                    as.and8(rax, rcx);
+               else
+                    as.or8(rax, rcx);
+               break;
+          // Unordered compares set CF, so testing "above" with the operands
+          // in the right order makes every NaN comparison false.
+          case Operator::Less:
+               as.ucomisd(xmm1, xmm0);
+               as.setcc(above, rax);
+               break;
+          case Operator::LessEqual:
+               as.ucomisd(xmm1, xmm0);
+               as.setcc(above_equal, rax);
+               break;
+          case Operator::Greater:
+               as.ucomisd(xmm0, xmm1);
+               as.setcc(above, rax);
+               break;
+          default:
+               as.ucomisd(xmm0, xmm1);
+               as.setcc(above_equal, rax);
+               break;
+          }
+          as.movzx8(rax, rax);
+          return result;
+     }
+
+     Kind gen(NodeId id)
+     {
+          switch (ast.type(id))
+          {
+          case NodeType::Constant:
+          case NodeType::Number:
+          case NodeType::DecimalNumber:
+          case NodeType::Boolean:
+          {
+               Kind kind = literal_kind(id);
+               gen_literal(id);
+               return kind;
+          }
+          case NodeType::Identifier:
+          {
+               uint32_t slot = local_slot(id);
+               Kind kind = locals[slot];
+               if (kind == Kind::Unknown)
+                    throw Unsupported{};
+               if (!is_param[slot])
+               {
+                    as.cmp_mem_imm8(rbp, flag_disp(slot), 0);
+                    as.jcc(equal, bail);
+               }
+               if (kind == Kind::Float || kind == Kind::Num)
+                    as.movsd_load(xmm0, rbp, value_disp(slot));
+               else
+                    as.mov_load64(rax, rbp, value_disp(slot));
+               return kind;
+          }
+          case NodeType::Assignment:
+          {
+               Kind kind = gen(ast.child(id, 1));
+               gen_store(local_slot(ast.child(id, 0)), kind);
+               return kind;
+          }
+          case NodeType::BinaryOp:
+               return gen_binary(id);
+          case NodeType::FunctionCall:
+               return gen_call(id, false);
+          default:
+               throw Unsupported{};
+          }
+     }
+};
+
+void give_up(const FunctionEntry &function)
+{
+     if (function.jit.bailouts.fetch_add(1, std::memory_order_relaxed) + 1 >= jit_bailout_limit)
+          function.jit.code.store(nullptr, std::memory_order_release);
+}
+}
+
+Jit::~Jit()
+{
+     for (const auto &[address, size] : regions)
+          ::munmap(address, size);
+}
+
+bool Jit::compile(const FunctionEntry &function, const FunctionManager &functions)
+{
+     std::lock_guard<std::mutex> lock(mutex);
+     std::vector<const FunctionEntry *> active;
+     return build(function, functions, active);
+}
+
+// Compiles the callees before publishing `function`, so its calls find
+// their code. A callee already being compiled further up (recursion
+// through other functions) is published before anything can call it.
+bool Jit::build(const FunctionEntry &function, const FunctionManager &functions,
+                std::vector<const FunctionEntry *> &active)
+{
+     if (function.jit.code.load(std::memory_order_acquire) ||
+         std::find(active.begin(), active.end(), &function) != active.end())
+          return true;
+     if (function.jit.bailouts.load(std::memory_order_relaxed) >= jit_bailout_limit)
+          return false;
+
+     std::vector<uint8_t> code;
+     try
+     {
+          FunctionCompiler compiler(function, functions);
+          compiler.analyze();
+          active.push_back(&function);
+          for (const FunctionEntry *callee : compiler.callees())
+               if (!build(*callee, functions, active))
+                    return false;
+          code = compiler.generate();
+     }
+     catch (const Unsupported &)
+     {
+          return false;
+     }
+
+     JitFunction entry = install(code);
+     if (!entry)
+          return false;
+     function.jit.code.store(entry, std::memory_order_release);
+     return true;
+}
+
+// Each function gets its own mapping, written once and then made
+// executable, so no page is ever writable and executable at once.
+JitFunction Jit::install(const std::vector<uint8_t> &code)
+{
+     size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+     size_t size = (code.size() + page - 1) / page * page;
+     void *address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+     if (address == MAP_FAILED)
+          return nullptr;
+     std::memcpy(address, code.data(), code.size());
+     if (::mprotect(address, size, PROT_READ | PROT_EXEC) != 0)
+     {
+          ::munmap(address, size);
+          return nullptr;
+     }
+     regions.emplace_back(address, size);
+     return reinterpret_cast<JitFunction>(address);
+}
+
+bool Jit::run(const FunctionEntry &function, JitFunction code, const Value *args, size_t depth_left, Value &result)
+{
+     uint64_t raw[max_params];
+     size_t count = function.signature.param_types.size();
+     for (size_t i = 0; i < count; ++i)
+          raw[i] = to_bits(args[i]);
+
+     JitContext context;
+     context.depth_left = static_cast<int64_t>(std::min<size_t>(depth_left, max_native_depth));
+     uintptr_t here = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+     context.stack_floor = std::max(here > native_stack_budget ? here - native_stack_budget : 0, native_stack_floor());
+     uint64_t bits = code(raw, &context);
+     if (context.bailed)
+     {
+          give_up(function);
+          if (context.bailed_in && context.bailed_in != &function)
+               give_up(*context.bailed_in);
+          return false;
+     }
+     result = from_bits(bits, function.signature.return_type);
+     return true;
+}
+
+#endif
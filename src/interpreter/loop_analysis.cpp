@@ -0,0 +1,94 @@
+#include "interpreter/loop_analysis.hpp"
+#include "interpreter/function_manager.hpp"
+#include <algorithm>
+
+namespace
+{
+class LimitScan
+{
+public:
+     LimitScan(const Script &script, const FunctionManager &functions, std::vector<bool> &invariant)
+         : ast(*script.ast), resolution(script.resolution), functions(functions), invariant(invariant)
+     {
+     }
+
+     void node(NodeId id)
+     {
+          if (ast.type(id) == NodeType::For)
+               loop(id);
+          for (NodeId child : ast.children(id))
+               node(child);
+     }
+
+private:
+     const Ast &ast;
+     const Resolution &resolution;
+     const FunctionManager &functions;
+     std::vector<bool> &invariant;
+
+     void loop(NodeId id)
+     {
+          NodeId head = ast.child(id, 0);
+          if (ast.type(head) != NodeType::ForLoop || ast.children(head).size() != 2)
+               return;
+          NodeId init = ast.child(head, 0);
+          if (ast.type(init) != NodeType::Assignment)
+               return;
+          std::vector<VarRef> written{resolution[ast.child(init, 0)]};
+          writes(ast.child(id, 1), written);
+          invariant[id] = reads_only(ast.child(head, 1), written);
+     }
+
+     // A function declared in the body assigns its own frame. Storing an
+     // element or calling an update such as push changes an array in place.
+     void writes(NodeId id, std::vector<VarRef> &written) const
+     {
+          NodeType type = ast.type(id);
+          if (type == NodeType::FunctionDecl)
+               return;
+          if (type == NodeType::Assignment || type == NodeType::ItemAssignment ||
+              (type == NodeType::FunctionCall && functions.find_update(std::string(ast.text(id)))))
+               written.push_back(resolution[ast.child(id, 0)]);
+          for (NodeId child : ast.children(id))
+               writes(child, written);
+     }
+
+     bool reads_only(NodeId id, const std::vector<VarRef> &written) const
+     {
+          switch (ast.type(id))
+          {
+          case NodeType::Number:
+          case NodeType::DecimalNumber:
+          case NodeType::String:
+          case NodeType::Boolean:
+          case NodeType::Constant:
+               return true;
+          case NodeType::Identifier:
+          {
+               const VarRef &ref = resolution[id];
+               return std::none_of(written.begin(), written.end(), [&](const VarRef &other)
+                                   { return other.depth == ref.depth && other.slot == ref.slot; });
+          }
+          case NodeType::BinaryOp:
+          case NodeType::ArrayItem:
+          case NodeType::Array:
+          {
+               NodeRange children = ast.children(id);
+               return std::all_of(children.begin(), children.end(),
+                                  [&](NodeId child) { return reads_only(child, written); });
+          }
+          default:
+               return false;
+          }
+     }
+};
+}
+
+std::vector<bool> find_invariant_limits(const Script &script, const FunctionManager &functions)
+{
+     std::vector<bool> invariant(script.ast->size(), false);
+     LimitScan scan(script, functions, invariant);
+     for (NodeId root : script.ast->roots())
+          scan.node(root);
+     return invariant;
+}
@@ -0,0 +1,41 @@
+#include "interpreter/native_stack.hpp"
+#if defined(__linux__) || defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+namespace
+{
+// Distance below the first checked frame that is assumed usable where the
+// stack bounds are unknown; even small thread stacks have this much.
+constexpr uintptr_t fallback_stack_budget = 512 * 1024;
+
+uintptr_t find_floor()
+{
+     uintptr_t low = 0;
+#if defined(__linux__)
+     pthread_attr_t attr;
+     if (pthread_getattr_np(pthread_self(), &attr) == 0)
+     {
+          void *address = nullptr;
+          size_t size = 0;
+          if (pthread_attr_getstack(&attr, &address, &size) == 0)
+               low = reinterpret_cast<uintptr_t>(address);
+          pthread_attr_destroy(&attr);
+     }
+#elif defined(__APPLE__)
+     // The reported address is the top of the stack.
+     low = reinterpret_cast<uintptr_t>(pthread_get_stackaddr_np(pthread_self())) -
+           pthread_get_stacksize_np(pthread_self());
+#endif
+     if (low)
+          return low + native_stack_reserve;
+     uintptr_t here = native_stack_position();
+     return here > fallback_stack_budget ? here - fallback_stack_budget : 0;
+}
+}
+
+uintptr_t native_stack_floor()
+{
+     thread_local const uintptr_t floor = find_floor();
+     return floor;
+}
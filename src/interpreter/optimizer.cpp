@@ -0,0 +1,260 @@
+#include "interpreter/optimizer.hpp"
+#include "interpreter/evaluator.hpp"
+#include <stdexcept>
+
+Value literal_to_value(const Literal &literal, const SymbolTable &symbols)
+{
+     switch (literal.kind)
+     {
+     case Literal::Kind::Int:
+          return Value(literal.int_val);
+     case Literal::Kind::Float:
+          return Value(literal.float_val);
+     case Literal::Kind::Bool:
+          return Value(literal.bool_val);
+     case Literal::Kind::String:
+          return Value(std::string(symbols.view(literal.str)));
+     default:
+          return Value();
+     }
+}
+
+Optimizer::Optimizer(int level) : level(level) {}
+
+Ast Optimizer::run(const Ast &source)
+{
+     in = &source;
+     out = Ast();
+     pending.clear();
+
+     for (NodeId root : source.roots())
+     {
+          size_t mark = pending.size();
+          rewrite_statement(root, false);
+          for (size_t i = mark; i < pending.size(); ++i)
+               out.add_root(pending[i]);
+          pending.resize(mark);
+     }
+
+     in = nullptr;
+     return std::move(out);
+}
+
+NodeId Optimizer::make_node(NodeId original, size_t mark)
+{
+     const Node &node = in->node(original);
+     NodeId id = out.add(node.type, out.symbols().intern(in->text(original)), node.line, node.column,
+                         pending.data() + mark, pending.size() - mark, node.op);
+     pending.resize(mark);
+     return id;
+}
+
+NodeId Optimizer::make_constant(NodeId original, const Literal &literal)
+{
+     const Node &node = in->node(original);
+     return out.add(NodeType::Constant, out.add_literal(literal), node.line, node.column, nullptr, 0);
+}
+
+bool Optimizer::constant_value(NodeId node, Value &value) const
+{
+     if (out.type(node) != NodeType::Constant)
+          return false;
+     value = literal_to_value(out.literal(node), out.symbols());
+     return true;
+}
+
+bool Optimizer::to_literal(const Value &value, Literal &literal)
+{
+     switch (value.type())
+     {
+     case Value::Type::None:
+          literal.kind = Literal::Kind::None;
+          return true;
+     case Value::Type::Int:
+          literal.kind = Literal::Kind::Int;
+          literal.int_val = value.int_val();
+          return true;
+     case Value::Type::Float:
+          literal.kind = Literal::Kind::Float;
+          literal.float_val = value.float_val();
+          return true;
+     case Value::Type::Bool:
+          literal.kind = Literal::Kind::Bool;
+          literal.bool_val = value.bool_val();
+          return true;
+     case Value::Type::String:
+          literal.kind = Literal::Kind::String;
+          literal.str = out.symbols().intern(value.str_val());
+          return true;
+     default:
+          return false;
+     }
+}
+
+NodeId Optimizer::rewrite(NodeId node)
+{
+     switch (in->type(node))
+     {
+     case NodeType::Number:
+     case NodeType::DecimalNumber:
+     case NodeType::String:
+     case NodeType::Boolean:
+          if (level >= 1)
+               return rewrite_literal(node);
+          break;
+     case NodeType::BinaryOp:
+          return rewrite_binary(node);
+     case NodeType::FunctionDecl:
+          return rewrite_function(node);
+     case NodeType::If:
+     {
+          size_t mark = pending.size();
+          pending.push_back(rewrite(in->child(node, 0)));
+          pending.push_back(rewrite_block(in->child(node, 1), true));
+          return make_node(node, mark);
+     }
+     case NodeType::For:
+     case NodeType::ParallelFor:
+     {
+          size_t mark = pending.size();
+          pending.push_back(rewrite(in->child(node, 0)));
+          pending.push_back(rewrite_block(in->child(node, 1), false));
+          return make_node(node, mark);
+     }
+     default:
+          break;
+     }
+
+     size_t mark = pending.size();
+     for (NodeId child : in->children(node))
+          pending.push_back(rewrite(child));
+     return make_node(node, mark);
+}
+
+NodeId Optimizer::rewrite_literal(NodeId node)
+{
+     Literal literal;
+     std::string text(in->text(node));
+     try
+     {
+          switch (in->type(node))
+          {
+          case NodeType::Number:
+               literal.kind = Literal::Kind::Int;
+               literal.int_val = std::stoll(text);
+               break;
+          case NodeType::DecimalNumber:
+               literal.kind = Literal::Kind::Float;
+               literal.float_val = std::stod(text);
+               break;
+          case NodeType::Boolean:
+               literal.kind = Literal::Kind::Bool;
+               literal.bool_val = text == "true";
+               break;
+          default:
+               literal.kind = Literal::Kind::String;
+               literal.str = out.symbols().intern(text);
+               break;
+          }
+     }
+     catch (const std::exception &)
+     {
+          // Leave malformed literals to fail at run time, as they would at -O0.
+          return make_node(node, pending.size());
+     }
+     return make_constant(node, literal);
+}
+
+NodeId Optimizer::rewrite_binary(NodeId node)
+{
+     size_t mark = pending.size();
+     pending.push_back(rewrite(in->child(node, 0)));
+     pending.push_back(rewrite(in->child(node, 1)));
+
+     Value lhs, rhs;
+     if (level >= 2 && constant_value(pending[mark], lhs) && constant_value(pending[mark + 1], rhs))
+     {
+          try
+          {
+               Literal folded;
+               if (to_literal(Evaluator::eval_binary_op(in->op(node), lhs, rhs), folded))
+               {
+                    pending.resize(mark);
+                    return make_constant(node, folded);
+               }
+          }
+          catch (const std::exception &)
+          {
+               // Operations that fail are kept so the error is raised when
+               // (and only if) they execute.
+          }
+     }
+     return make_node(node, mark);
+}
+
+NodeId Optimizer::rewrite_function(NodeId node)
+{
+     NodeRange children = in->children(node);
+     size_t mark = pending.size();
+     for (size_t i = 0; i + 1 < children.size(); ++i)
+          pending.push_back(rewrite(children[i]));
+     pending.push_back(rewrite_block(children.back(), true));
+     return make_node(node, mark);
+}
+
+NodeId Optimizer::rewrite_block(NodeId block, bool keeps_value)
+{
+     NodeRange stmts = in->children(block);
+     size_t mark = pending.size();
+     for (size_t i = 0; i < stmts.size(); ++i)
+          rewrite_statement(stmts[i], keeps_value && i + 1 == stmts.size());
+     return make_node(block, mark);
+}
+
+// Pushes the rewritten form of `stmt` onto `pending`; a statement may
+// disappear or expand into the statements of an always-taken branch.
+// When `is_last` is set the statement's value is the block's value, so a
+// removed statement is replaced by a null constant.
+void Optimizer::rewrite_statement(NodeId stmt, bool is_last)
+{
+     if (level < 2 || (in->type(stmt) != NodeType::If && in->type(stmt) != NodeType::For))
+     {
+          pending.push_back(rewrite(stmt));
+          return;
+     }
+
+     NodeId head = in->child(stmt, 0);
+     NodeId body = in->child(stmt, 1);
+     bool is_while = in->type(stmt) == NodeType::For && in->type(head) == NodeType::While;
+     if (in->type(stmt) == NodeType::For && !is_while)
+     {
+          pending.push_back(rewrite(stmt));
+          return;
+     }
+
+     NodeId condition = rewrite(is_while ? in->child(head, 0) : head);
+     Value known;
+     if (!constant_value(condition, known) || (is_while && Evaluator::is_true(known)))
+     {
+          size_t mark = pending.size();
+          pending.push_back(condition);
+          if (is_while)
+               pending.push_back(make_node(head, mark));
+          pending.push_back(rewrite_block(body, !is_while));
+          pending.push_back(make_node(stmt, mark));
+          return;
+     }
+
+     if (!is_while && Evaluator::is_true(known))
+     {
+          NodeRange stmts = in->children(body);
+          for (size_t i = 0; i < stmts.size(); ++i)
+               rewrite_statement(stmts[i], is_last && i + 1 == stmts.size());
+          if (stmts.empty() && is_last)
+               pending.push_back(make_constant(stmt, Literal()));
+          return;
+     }
+
+     if (is_last)
+          pending.push_back(make_constant(stmt, Literal()));
+}
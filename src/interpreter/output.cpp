@@ -0,0 +1,94 @@
+#include "interpreter/output.hpp"
+
+Output::Output(std::unique_ptr<OutputSink> sink, size_t capacity)
+    : sink(std::move(sink)), capacity(capacity)
+{
+     buffer.reserve(capacity);
+}
+
+Output::~Output()
+{
+     flush();
+}
+
+void Output::set_sink(std::unique_ptr<OutputSink> next)
+{
+     std::lock_guard<std::mutex> lock(mutex);
+     flush_buffer();
+     sink = std::move(next);
+}
+
+void Output::set_policy(FlushPolicy next)
+{
+     std::lock_guard<std::mutex> lock(mutex);
+     policy = next;
+     drain_if_full();
+}
+
+void Output::set_capacity(size_t next)
+{
+     std::lock_guard<std::mutex> lock(mutex);
+     capacity = next;
+     buffer.reserve(capacity);
+     drain_if_full();
+}
+
+void Output::write(std::string_view text)
+{
+     std::lock_guard<std::mutex> lock(mutex);
+     buffer.append(text);
+     drain_if_full();
+}
+
+void Output::write(const Value &value)
+{
+     std::lock_guard<std::mutex> lock(mutex);
+     value.append_to(buffer);
+     drain_if_full();
+}
+
+void Output::end_line()
+{
+     std::lock_guard<std::mutex> lock(mutex);
+     finish_line();
+}
+
+void Output::write_line(const std::vector<Value> &values)
+{
+     std::lock_guard<std::mutex> lock(mutex);
+     for (const Value &value : values)
+          value.append_to(buffer);
+     finish_line();
+}
+
+void Output::flush()
+{
+     std::lock_guard<std::mutex> lock(mutex);
+     flush_buffer();
+}
+
+void Output::finish_line()
+{
+     buffer.push_back('\n');
+     if (policy == FlushPolicy::Line)
+          flush_buffer();
+     else
+          drain_if_full();
+}
+
+void Output::flush_buffer()
+{
+     if (!buffer.empty() && sink)
+          sink->write(buffer);
+     buffer.clear();
+     if (sink)
+          sink->flush();
+}
+
+void Output::drain_if_full()
+{
+     if (policy == FlushPolicy::Exit || buffer.size() < capacity || !sink)
+          return;
+     sink->write(buffer);
+     buffer.clear();
+}
@@ -0,0 +1,277 @@
+#include "interpreter/parallel.hpp"
+#include "interpreter/evaluator.hpp"
+#include "interpreter/function_manager.hpp"
+#include "interpreter/thread_pool.hpp"
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+using SlotKey = std::pair<uint32_t, uint32_t>;
+
+struct Reduction
+{
+     VarRef ref;
+     Operator op;
+     std::string name;
+};
+
+// How the body of a pfor uses each variable it mentions.
+struct Usage
+{
+     size_t reads = 0;
+     size_t reductions = 0;
+     bool plain_write = false;
+     bool resized = false;
+     bool mixed = false;
+     Operator op = Operator::None;
+     NodeId name = 0;
+     std::vector<NodeId> item_writes;
+};
+
+class UsageScan
+{
+public:
+     UsageScan(const Script &script, const FunctionManager &functions)
+         : ast(*script.ast), resolution(script.resolution), functions(functions)
+     {
+     }
+
+     std::map<SlotKey, Usage> usage;
+
+     void block(NodeId block)
+     {
+          for (NodeId stmt : ast.children(block))
+               node(stmt);
+     }
+
+     void node(NodeId id)
+     {
+          switch (ast.type(id))
+          {
+          case NodeType::Identifier:
+               usage[key(id)].reads++;
+               return;
+          case NodeType::If:
+               node(ast.child(id, 0));
+               block(ast.child(id, 1));
+               return;
+          case NodeType::For:
+          case NodeType::ParallelFor:
+               for (NodeId child : ast.children(ast.child(id, 0)))
+                    node(child);
+               block(ast.child(id, 1));
+               return;
+          case NodeType::Assignment:
+               assignment(id);
+               return;
+          case NodeType::ItemAssignment:
+          {
+               Usage &found = usage[key(ast.child(id, 0))];
+               found.name = ast.child(id, 0);
+               found.item_writes.push_back(id);
+               node(ast.child(id, 1));
+               node(ast.child(id, 2));
+               return;
+          }
+          case NodeType::FunctionCall:
+               // The resolver made sure an update's target is a variable.
+               if (functions.find_update(std::string(ast.text(id))))
+               {
+                    Usage &found = usage[key(ast.child(id, 0))];
+                    found.name = ast.child(id, 0);
+                    found.resized = true;
+               }
+               for (NodeId child : ast.children(id))
+                    node(child);
+               return;
+          default:
+               for (NodeId child : ast.children(id))
+                    node(child);
+               return;
+          }
+     }
+
+private:
+     const Ast &ast;
+     const Resolution &resolution;
+     const FunctionManager &functions;
+
+     SlotKey key(NodeId var) const
+     {
+          const VarRef &ref = resolution[var];
+          return {ref.depth, ref.slot};
+     }
+
+     bool refers_to(NodeId id, SlotKey target) const
+     {
+          return ast.type(id) == NodeType::Identifier && key(id) == target;
+     }
+
+     void assignment(NodeId id)
+     {
+          NodeId target = ast.child(id, 0);
+          NodeId value = ast.child(id, 1);
+          SlotKey slot = key(target);
+          Usage &found = usage[slot];
+          found.name = target;
+
+          Operator op = ast.type(value) == NodeType::BinaryOp ? ast.op(value) : Operator::None;
+          bool folds = (op == Operator::Add || op == Operator::Mul) &&
+                       (refers_to(ast.child(value, 0), slot) || refers_to(ast.child(value, 1), slot));
+          if (!folds)
+               found.plain_write = true;
+          else
+          {
+               if (found.reductions > 0 && found.op != op)
+                    found.mixed = true;
+               found.op = op;
+               found.reductions++;
+          }
+          node(value);
+     }
+};
+
+Slot &outer_slot(ParallelScope scope, const VarRef &ref)
+{
+     if (ref.depth == 0 && scope.frame)
+          return scope.frame[ref.slot];
+     return (*scope.globals)[ref.slot];
+}
+
+Value identity(Operator op, Value::Type type)
+{
+     if (type == Value::Type::Int)
+          return Value(op == Operator::Add ? 0 : 1);
+     return Value(op == Operator::Add ? 0.0 : 1.0);
+}
+}
+
+void run_parallel_for(const ParallelContext &context, ParallelScope scope, NodeId node, Value limit)
+{
+     const Ast &ast = *context.script->ast;
+     NodeId head = ast.child(node, 0);
+     NodeId body = ast.child(node, 1);
+     if (ast.type(head) != NodeType::ForLoop || ast.type(ast.child(head, 0)) != NodeType::Assignment)
+          throw std::runtime_error("Malformed pfor loop");
+     NodeId var = ast.child(ast.child(head, 0), 0);
+     const VarRef &counter_ref = context.script->resolution[var];
+
+     Slot &counter = outer_slot(scope, counter_ref);
+     if (limit.is_array())
+          limit = Value(static_cast<int64_t>(limit.array_size()));
+     if (!counter.value.is_number() || !limit.is_number())
+          throw std::runtime_error("Loop bounds must be numeric");
+     int64_t first = counter.value.int_val();
+     int64_t last = limit.int_val();
+
+     UsageScan scan(*context.script, *context.functions);
+     scan.block(body);
+     std::vector<Reduction> reductions;
+     std::vector<NodeId> shared_items;
+     for (const auto &[slot, use] : scan.usage)
+     {
+          if (use.plain_write || slot == SlotKey{counter_ref.depth, counter_ref.slot})
+               continue;
+          std::string name(ast.text(use.name));
+          if (use.resized)
+               throw std::runtime_error("pfor cannot push, pop or reserve outer array: " + name);
+          if (use.reductions == 0)
+          {
+               shared_items.insert(shared_items.end(), use.item_writes.begin(), use.item_writes.end());
+               continue;
+          }
+          if (use.mixed)
+               throw std::runtime_error("pfor reduction on " + name + " mixes + and *");
+          if (use.reads != use.reductions)
+               throw std::runtime_error("pfor reduction variable " + name + " is read elsewhere in the loop body");
+          const Slot &outer = outer_slot(scope, context.script->resolution[use.name]);
+          if (!outer.defined)
+               throw std::runtime_error("Undefined variable: " + name);
+          if (!outer.value.is_number())
+               throw std::runtime_error("pfor reduction on a non-numeric variable: " + name);
+          reductions.push_back({context.script->resolution[use.name], use.op, std::move(name)});
+     }
+
+     std::sort(shared_items.begin(), shared_items.end());
+
+     size_t workers = context.pool ? context.pool->size() : 1;
+     std::vector<std::unique_ptr<Evaluator>> evaluators(workers);
+     std::vector<ItemWriteLog> logs(shared_items.empty() ? 0 : workers);
+     auto run = [&](size_t worker, size_t begin, size_t end)
+     {
+          std::unique_ptr<Evaluator> &evaluator = evaluators[worker];
+          if (!evaluator)
+          {
+               evaluator = std::make_unique<Evaluator>(*context.functions);
+               evaluator->set_max_call_depth(context.max_call_depth);
+               evaluator->load_scope(*scope.globals, scope.frame, scope.frame_size);
+               evaluator->set_script(context.script);
+               if (!logs.empty())
+               {
+                    logs[worker].shared = shared_items;
+                    evaluator->set_item_log(&logs[worker]);
+               }
+               for (const Reduction &reduction : reductions)
+               {
+                    Slot &partial = evaluator->slot(reduction.ref);
+                    partial.value = identity(reduction.op, partial.value.type());
+                    partial.untyped = true;
+               }
+          }
+          for (size_t i = begin; i < end; ++i)
+          {
+               Slot &index = evaluator->slot(counter_ref);
+               index.value = Value(first + static_cast<int64_t>(i));
+               index.defined = true;
+               if (!logs.empty())
+                    logs[worker].iteration = i;
+               evaluator->evaluate_block(body);
+          }
+     };
+
+     size_t count = last > first ? static_cast<size_t>(static_cast<uint64_t>(last) - static_cast<uint64_t>(first)) : 0;
+     if (context.pool)
+          context.pool->parallel_for(count, run);
+     else if (count > 0)
+          run(0, 0, count);
+
+     // Partials are folded together first, so the outer variable is
+     // assigned (and type-checked) once, with the same final value a
+     // sequential loop would give.
+     for (const Reduction &reduction : reductions)
+     {
+          Slot &outer = outer_slot(scope, reduction.ref);
+          Value total = identity(reduction.op, outer.value.type());
+          for (const auto &evaluator : evaluators)
+               if (evaluator)
+                    total = Evaluator::eval_binary_op(reduction.op, total, evaluator->slot(reduction.ref).value);
+          outer.assign(Evaluator::eval_binary_op(reduction.op, outer.value, total));
+     }
+
+     // Workers may steal ranges out of order, but each one logs its
+     // iterations in order, so a stable sort restores the sequential order.
+     std::vector<ItemWriteLog::Write> writes;
+     for (ItemWriteLog &log : logs)
+          std::move(log.writes.begin(), log.writes.end(), std::back_inserter(writes));
+     std::stable_sort(writes.begin(), writes.end(),
+                      [](const ItemWriteLog::Write &a, const ItemWriteLog::Write &b) { return a.iteration < b.iteration; });
+     for (ItemWriteLog::Write &write : writes)
+     {
+          NodeId target = ast.child(write.node, 0);
+          Evaluator::store_item(outer_slot(scope, context.script->resolution[target]).value, write.index, write.item);
+          if (context.item_log)
+               context.item_log->record(write.node, write.index, write.item);
+     }
+     outer_slot(scope, counter_ref).value = Value(std::max(first, last));
+}
+
+void ItemWriteLog::record(NodeId node, const Value &index, const Value &item)
+{
+     if (std::binary_search(shared.begin(), shared.end(), node))
+          writes.push_back({iteration, node, index, item});
+}
@@ -0,0 +1,150 @@
+#include "interpreter/profiler.hpp"
+#include <algorithm>
+#include <iomanip>
+
+Profiler::Profiler()
+{
+     paths.push_back({function_id("main"), 0});
+}
+
+uint32_t Profiler::function_id(const std::string &name)
+{
+     auto found = function_ids.find(name);
+     if (found != function_ids.end())
+          return found->second;
+     uint32_t id = static_cast<uint32_t>(functions.size());
+     function_ids.emplace(name, id);
+     functions.push_back({name});
+     return id;
+}
+
+void Profiler::enter(const std::string &name)
+{
+     uint32_t function = function_id(name);
+     uint32_t parent = stack.empty() ? 0 : stack.back().path;
+
+     uint32_t path = static_cast<uint32_t>(paths.size());
+     auto inserted = paths[parent].children.emplace(function, path);
+     if (inserted.second)
+          paths.push_back({function, parent});
+     else
+          path = inserted.first->second;
+
+     paths[path].calls++;
+     functions[function].calls++;
+     functions[function].active++;
+     stack.push_back({path, Clock::now()});
+}
+
+void Profiler::leave()
+{
+     Activation call = stack.back();
+     stack.pop_back();
+     Clock::duration elapsed = Clock::now() - call.start;
+     Clock::duration own = elapsed - call.children;
+
+     PathNode &path = paths[call.path];
+     path.exclusive += own;
+     FunctionStats &function = functions[path.function];
+     function.exclusive += own;
+     // Recursive activations are already inside the outermost one.
+     if (--function.active == 0)
+          function.inclusive += elapsed;
+
+     if (!stack.empty())
+          stack.back().children += elapsed;
+}
+
+void Profiler::unwind(size_t depth)
+{
+     while (stack.size() > depth)
+          leave();
+}
+
+void Profiler::hit(const Ast &ast, NodeId node)
+{
+     NodeHits *target = nullptr;
+     for (auto it = node_hits.rbegin(); it != node_hits.rend(); ++it)
+     {
+          if (it->ast == &ast)
+          {
+               target = &*it;
+               break;
+          }
+     }
+     if (!target)
+     {
+          node_hits.push_back({&ast, std::vector<uint64_t>(ast.size())});
+          target = &node_hits.back();
+     }
+     target->counts[node]++;
+}
+
+std::string Profiler::path_name(uint32_t path) const
+{
+     std::vector<uint32_t> chain;
+     for (uint32_t at = path; at != 0; at = paths[at].parent)
+          chain.push_back(at);
+
+     std::string name = functions[paths[0].function].name;
+     for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+          name += ";" + functions[paths[*it].function].name;
+     return name;
+}
+
+void Profiler::write_collapsed(std::ostream &out) const
+{
+     for (uint32_t i = 1; i < paths.size(); ++i)
+     {
+          auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(paths[i].exclusive).count();
+          if (ns > 0)
+               out << path_name(i) << " " << ns << "\n";
+     }
+}
+
+void Profiler::write_summary(std::ostream &out) const
+{
+     std::vector<const FunctionStats *> order;
+     for (const FunctionStats &function : functions)
+          if (function.calls > 0)
+               order.push_back(&function);
+     std::sort(order.begin(), order.end(), [](const FunctionStats *a, const FunctionStats *b)
+               { return a->inclusive > b->inclusive; });
+
+     auto ms = [](Clock::duration d)
+     { return std::chrono::duration<double, std::milli>(d).count(); };
+
+     out << std::left << std::setw(24) << "function" << std::right << std::setw(12) << "calls"
+         << std::setw(16) << "inclusive ms" << std::setw(16) << "exclusive ms" << "\n";
+     out << std::fixed << std::setprecision(3);
+     for (const FunctionStats *function : order)
+          out << std::left << std::setw(24) << function->name << std::right << std::setw(12) << function->calls
+              << std::setw(16) << ms(function->inclusive) << std::setw(16) << ms(function->exclusive) << "\n";
+     out << std::defaultfloat;
+}
+
+void Profiler::write_node_hits(std::ostream &out) const
+{
+     struct Row
+     {
+          size_t script;
+          const Ast *ast;
+          NodeId node;
+          uint64_t hits;
+     };
+
+     std::vector<Row> rows;
+     for (size_t s = 0; s < node_hits.size(); ++s)
+          for (NodeId id = 0; id < node_hits[s].counts.size(); ++id)
+               if (node_hits[s].counts[id] > 0)
+                    rows.push_back({s, node_hits[s].ast, id, node_hits[s].counts[id]});
+     std::stable_sort(rows.begin(), rows.end(), [](const Row &a, const Row &b)
+                      { return a.hits > b.hits; });
+
+     for (const Row &row : rows)
+     {
+          const Node &node = row.ast->node(row.node);
+          out << row.script << ":" << node.line << ":" << node.column << "\t"
+              << to_string(node.type) << "\t" << row.hits << "\n";
+     }
+}
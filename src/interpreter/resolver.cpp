@@ -0,0 +1,178 @@
+#include "interpreter/resolver.hpp"
+#include "interpreter/function_manager.hpp"
+#include <stdexcept>
+
+Resolver::Resolver(const FunctionManager &functions) : functions(functions) {}
+
+Resolution Resolver::resolve(const Ast &tree)
+{
+     Resolution result(tree.size());
+     ast = &tree;
+     out = &result;
+     locals = nullptr;
+     for (NodeId node : tree.roots())
+          resolve_node(node);
+     ast = nullptr;
+     out = nullptr;
+     return result;
+}
+
+size_t Resolver::global_count() const
+{
+     return names.size();
+}
+
+const std::vector<std::string> &Resolver::global_names() const
+{
+     return names;
+}
+
+uint32_t Resolver::global_slot(std::string_view name)
+{
+     std::string key(name);
+     auto found = globals.find(key);
+     if (found != globals.end())
+          return found->second;
+     uint32_t slot = static_cast<uint32_t>(names.size());
+     globals.emplace(key, slot);
+     names.push_back(std::move(key));
+     return slot;
+}
+
+void Resolver::LocalMap::declare(SymbolId name)
+{
+     if (slots.emplace(name, size).second)
+          size++;
+}
+
+void Resolver::declare_locals(NodeId node, LocalMap &frame)
+{
+     if (ast->type(node) == NodeType::FunctionDecl)
+          return;
+     if (ast->type(node) == NodeType::Assignment || ast->type(node) == NodeType::ItemAssignment || is_update(node))
+          frame.declare(ast->node(ast->child(node, 0)).value);
+     for (NodeId child : ast->children(node))
+          declare_locals(child, frame);
+}
+
+// A native update writes the variable named by its first argument.
+bool Resolver::is_update(NodeId node) const
+{
+     if (ast->type(node) != NodeType::FunctionCall || !functions.find_update(std::string(ast->text(node))))
+          return false;
+     NodeRange args = ast->children(node);
+     if (args.empty() || ast->type(args[0]) != NodeType::Identifier)
+          throw std::runtime_error(std::string(ast->text(node)) + " expects a variable as its first argument");
+     return true;
+}
+
+void Resolver::resolve_variable(NodeId node)
+{
+     VarRef &ref = (*out)[node];
+     if (locals)
+     {
+          auto found = locals->slots.find(ast->node(node).value);
+          if (found != locals->slots.end())
+          {
+               ref.depth = 0;
+               ref.slot = found->second;
+               return;
+          }
+          ref.depth = 1;
+     }
+     else
+     {
+          ref.depth = 0;
+     }
+     ref.slot = global_slot(ast->text(node));
+}
+
+void Resolver::resolve_block(NodeId block)
+{
+     for (NodeId stmt : ast->children(block))
+          resolve_node(stmt);
+}
+
+void Resolver::resolve_node(NodeId node)
+{
+     switch (ast->type(node))
+     {
+     case NodeType::Identifier:
+          resolve_variable(node);
+          return;
+     case NodeType::If:
+          resolve_node(ast->child(node, 0));
+          resolve_block(ast->child(node, 1));
+          return;
+     case NodeType::ParallelFor:
+          check_parallel_body(ast->child(node, 1));
+          [[fallthrough]];
+     case NodeType::For:
+          for (NodeId child : ast->children(ast->child(node, 0)))
+               resolve_node(child);
+          resolve_block(ast->child(node, 1));
+          return;
+     case NodeType::FunctionDecl:
+          resolve_function(node);
+          return;
+     case NodeType::FunctionCall:
+          // Checks the target of an update outside functions too.
+          is_update(node);
+          for (NodeId child : ast->children(node))
+               resolve_node(child);
+          return;
+     default:
+          for (NodeId child : ast->children(node))
+               resolve_node(child);
+          return;
+     }
+}
+
+// Workers share the function table and cannot hand control back out of
+// the loop, so a pfor body may neither declare functions nor return.
+void Resolver::check_parallel_body(NodeId node)
+{
+     for (NodeId child : ast->children(node))
+     {
+          if (ast->type(child) == NodeType::FunctionDecl)
+               throw std::runtime_error("Function declared inside pfor: " + std::string(ast->text(child)));
+          if (ast->type(child) == NodeType::Return)
+               throw std::runtime_error("Return inside pfor");
+          check_parallel_body(child);
+     }
+}
+
+void Resolver::resolve_function(NodeId node)
+{
+     std::string name(ast->text(node));
+     if (functions.find_update(name))
+          throw std::runtime_error("Cannot redeclare built-in function: " + name);
+
+     // A parameter that is never referenced has no symbol of its own, but
+     // it still takes a slot so arguments bind by position.
+     LocalMap frame;
+     std::vector<std::string> param_names;
+     for (NodeId param : ast->children(ast->child(node, 0)))
+     {
+          auto param_name = extract_name_and_type(std::string(ast->text(param))).first;
+          for (const auto &seen : param_names)
+               if (seen == param_name)
+                    throw std::runtime_error("Duplicate parameter: " + param_name);
+          param_names.push_back(param_name);
+
+          SymbolId id = ast->symbols().find(param_name);
+          if (id != no_symbol)
+               frame.slots.emplace(id, frame.size);
+          (*out)[param].slot = frame.size++;
+     }
+
+     NodeId body = ast->children(node).back();
+     declare_locals(body, frame);
+
+     LocalMap *saved = locals;
+     locals = &frame;
+     resolve_block(body);
+     locals = saved;
+
+     (*out)[node].slot = frame.size;
+}
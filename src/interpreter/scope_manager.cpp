@@ -1,67 +1,54 @@
 #include "interpreter/scope_manager.hpp"
 #include <stdexcept>
 
-void ScopeManager::push_scope()
+void Slot::assign(Value v)
 {
-     scopes.emplace_back();
+     if (defined && !untyped)
+          value.check_type(v.type());
+     value = std::move(v);
+     defined = true;
 }
 
-void ScopeManager::pop_scope()
+void ScopeManager::resize_globals(size_t count)
 {
-     if (scopes.empty())
-          throw std::runtime_error("No scopes to pop");
-     scopes.pop_back();
+     if (count > globals.size())
+          globals.resize(count);
 }
 
-bool ScopeManager::has(const std::string &name) const
+void ScopeManager::push_frame(size_t size)
 {
-     for (auto it = scopes.rbegin(); it != scopes.rend(); ++it)
-     {
-          if (it->find(name) != it->end())
-               return true;
-     }
-     return false;
+     frames.push_back(locals.size());
+     locals.resize(locals.size() + size);
 }
 
-bool ScopeManager::has_in_current(const std::string &name) const
+void ScopeManager::pop_frame()
 {
-     if (scopes.empty())
-          return false;
-     return scopes.back().find(name) != scopes.back().end();
+     if (frames.empty())
+          throw std::runtime_error("No frames to pop");
+     locals.resize(frames.back());
+     frames.pop_back();
 }
 
-void ScopeManager::define(const std::string &name, const Value &value)
+void ScopeManager::load(const std::vector<Slot> &global_copy, const Slot *frame, size_t size)
 {
-     if (scopes.empty())
-          throw std::runtime_error("No active scope to define variable: " + name);
-
-     auto &current = scopes.back();
-     if (current.find(name) != current.end())
-          throw std::runtime_error("Variable already defined in current scope: " + name);
-
-     current[name] = value;
+     globals = global_copy;
+     locals.assign(frame, frame + size);
+     frames.clear();
+     if (frame)
+          frames.push_back(0);
 }
 
-void ScopeManager::set(const std::string &name, const Value &value)
+Slot &ScopeManager::slot(uint32_t depth, uint32_t index)
 {
-     for (auto it = scopes.rbegin(); it != scopes.rend(); ++it)
-     {
-          if (it->find(name) != it->end())
-          {
-               (*it)[name] = value;
-               return;
-          }
-     }
-     throw std::runtime_error("Undefined variable: " + name);
+     if (depth == 0 && !frames.empty())
+          return locals[frames.back() + index];
+     return globals[index];
 }
 
-Value ScopeManager::get(const std::string &name) const
+const Value &ScopeManager::get(uint32_t depth, uint32_t index, std::string_view name)
 {
-     for (auto it = scopes.rbegin(); it != scopes.rend(); ++it)
-     {
-          auto found = it->find(name);
-          if (found != it->end())
-               return found->second;
-     }
-     throw std::runtime_error("Undefined variable: " + name);
+     const Slot &found = slot(depth, index);
+     if (!found.defined)
+          throw std::runtime_error("Undefined variable: " + std::string(name));
+     return found.value;
 }
@@ -0,0 +1,146 @@
+#include "interpreter/thread_pool.hpp"
+#include <algorithm>
+
+// Enough chunks per worker that stealing can even out uneven iterations.
+static constexpr size_t chunks_per_worker = 8;
+
+// Asking the OS is a system call, and every interpreter makes a pool.
+static size_t hardware_threads()
+{
+     static const size_t count = std::max<size_t>(1, std::thread::hardware_concurrency());
+     return count;
+}
+
+ThreadPool::ThreadPool(size_t workers)
+    : worker_count(workers ? workers : hardware_threads())
+{
+}
+
+ThreadPool::~ThreadPool()
+{
+     {
+          std::lock_guard<std::mutex> lock(mutex);
+          stopping = true;
+     }
+     wake.notify_all();
+     for (std::thread &thread : threads)
+          thread.join();
+}
+
+void ThreadPool::start()
+{
+     for (size_t i = 0; i < worker_count; ++i)
+          queues.push_back(std::make_unique<Queue>());
+     for (size_t i = 1; i < worker_count; ++i)
+          threads.emplace_back([this, i]
+                               { worker_loop(i); });
+}
+
+void ThreadPool::parallel_for(size_t count, const RangeBody &body)
+{
+     if (count == 0)
+          return;
+     size_t chunks = std::min(count, worker_count * chunks_per_worker);
+     if (worker_count == 1 || chunks == 1)
+     {
+          body(0, 0, count);
+          return;
+     }
+     if (threads.empty())
+          start();
+
+     for (size_t c = 0; c < chunks; ++c)
+     {
+          Range range{count * c / chunks, count * (c + 1) / chunks};
+          queues[c * worker_count / chunks]->ranges.push_back(range);
+     }
+
+     job = &body;
+     error = nullptr;
+     failed.store(false, std::memory_order_relaxed);
+     {
+          std::lock_guard<std::mutex> lock(mutex);
+          generation++;
+          busy = worker_count - 1;
+     }
+     wake.notify_all();
+
+     drain(0);
+     {
+          std::unique_lock<std::mutex> lock(mutex);
+          done.wait(lock, [this]
+                    { return busy == 0; });
+     }
+     job = nullptr;
+     if (error)
+          std::rethrow_exception(error);
+}
+
+void ThreadPool::worker_loop(size_t worker)
+{
+     uint64_t seen = 0;
+     while (true)
+     {
+          {
+               std::unique_lock<std::mutex> lock(mutex);
+               wake.wait(lock, [&]
+                         { return stopping || generation != seen; });
+               if (stopping)
+                    return;
+               seen = generation;
+          }
+          drain(worker);
+          std::lock_guard<std::mutex> lock(mutex);
+          if (--busy == 0)
+               done.notify_one();
+     }
+}
+
+void ThreadPool::drain(size_t worker)
+{
+     Range range;
+     while (take(worker, range))
+     {
+          if (failed.load(std::memory_order_relaxed))
+               continue;
+          try
+          {
+               (*job)(worker, range.first, range.second);
+          }
+          catch (...)
+          {
+               std::lock_guard<std::mutex> lock(error_mutex);
+               if (!error)
+                    error = std::current_exception();
+               failed.store(true, std::memory_order_relaxed);
+          }
+     }
+}
+
+// Chunks are never added while a job runs, so finding every queue empty
+// means this worker is done.
+bool ThreadPool::take(size_t worker, Range &range)
+{
+     {
+          Queue &own = *queues[worker];
+          std::lock_guard<std::mutex> lock(own.mutex);
+          if (!own.ranges.empty())
+          {
+               range = own.ranges.front();
+               own.ranges.pop_front();
+               return true;
+          }
+     }
+     for (size_t i = 1; i < worker_count; ++i)
+     {
+          Queue &victim = *queues[(worker + i) % worker_count];
+          std::lock_guard<std::mutex> lock(victim.mutex);
+          if (!victim.ranges.empty())
+          {
+               range = victim.ranges.back();
+               victim.ranges.pop_back();
+               return true;
+          }
+     }
+     return false;
+}
@@ -0,0 +1,402 @@
+#include "interpreter/type_checker.hpp"
+#include "interpreter/function_manager.hpp"
+#include <stdexcept>
+
+namespace
+{
+bool is_numeric(StaticType type)
+{
+     return type == StaticType::Int || type == StaticType::Float || type == StaticType::Number;
+}
+
+// The type of a slot that may hold either value.
+StaticType join(StaticType a, StaticType b)
+{
+     if (a == StaticType::Never || a == b)
+          return b;
+     if (b == StaticType::Never)
+          return a;
+     if (is_numeric(a) && is_numeric(b))
+          return StaticType::Number;
+     return StaticType::Unknown;
+}
+
+StaticType from_value_type(Value::Type type)
+{
+     switch (type)
+     {
+     case Value::Type::Int:
+          return StaticType::Int;
+     case Value::Type::Float:
+          return StaticType::Float;
+     case Value::Type::Bool:
+          return StaticType::Bool;
+     case Value::Type::String:
+          return StaticType::String;
+     case Value::Type::Array:
+          return StaticType::Array;
+     default:
+          return StaticType::Unknown;
+     }
+}
+
+std::string type_name(StaticType type)
+{
+     switch (type)
+     {
+     case StaticType::Int:
+          return "num";
+     case StaticType::Float:
+          return "flo";
+     case StaticType::Number:
+          return "num or flo";
+     case StaticType::Bool:
+          return "bool";
+     case StaticType::String:
+          return "str";
+     case StaticType::Array:
+          return "arr";
+     default:
+          return "unknown";
+     }
+}
+
+bool is_comparison(Operator op)
+{
+     return op == Operator::Equal || op == Operator::NotEqual || op == Operator::Less ||
+            op == Operator::LessEqual || op == Operator::Greater || op == Operator::GreaterEqual;
+}
+}
+
+TypeChecker::TypeChecker(const FunctionManager &functions) : functions(functions) {}
+
+std::vector<StaticType> TypeChecker::check(const Script &script)
+{
+     std::vector<StaticType> result(script.ast->size(), StaticType::Unknown);
+     ast = script.ast;
+     resolution = &script.resolution;
+     types = &result;
+     frame = nullptr;
+     function = nullptr;
+     final_pass = true;
+
+     for (NodeId node : ast->roots())
+          declare_functions(node);
+     for (NodeId node : ast->roots())
+          infer(node);
+
+     ast = nullptr;
+     resolution = nullptr;
+     types = nullptr;
+     return result;
+}
+
+void TypeChecker::fail(NodeId node, const std::string &message) const
+{
+     const Node &at = ast->node(node);
+     throw std::runtime_error(message + " at " + std::to_string(at.line) + ":" + std::to_string(at.column));
+}
+
+TypeChecker::Signature TypeChecker::signature_of(NodeId decl) const
+{
+     NodeRange children = ast->children(decl);
+     Signature signature;
+     for (NodeId param : ast->children(children[0]))
+          signature.param_types.push_back(
+              Value::string_to_type(extract_name_and_type(std::string(ast->text(param))).second));
+     if (children.size() == 3)
+     {
+          signature.has_return_type = true;
+          signature.return_type = Value::string_to_type(extract_name_and_type(std::string(ast->text(children[1]))).second);
+     }
+     return signature;
+}
+
+void TypeChecker::declare_functions(NodeId node)
+{
+     if (ast->type(node) == NodeType::FunctionDecl)
+     {
+          Signature &known = signatures[std::string(ast->text(node))];
+          if (known.declarations++ == 0)
+          {
+               known = signature_of(node);
+               known.declarations = 1;
+          }
+     }
+     for (NodeId child : ast->children(node))
+          declare_functions(child);
+}
+
+// Local types only grow, so passes over the body repeat until none of them
+// changes; the last pass then sees final types everywhere and reports.
+void TypeChecker::check_function(NodeId node)
+{
+     Signature signature = signature_of(node);
+     Frame locals;
+     locals.slots.assign((*resolution)[node].slot, StaticType::Never);
+     locals.declared.assign((*resolution)[node].slot, StaticType::Unknown);
+     NodeRange params = ast->children(ast->child(node, 0));
+     for (size_t i = 0; i < params.size(); ++i)
+     {
+          uint32_t slot = (*resolution)[params[i]].slot;
+          locals.slots[slot] = locals.declared[slot] = from_value_type(signature.param_types[i]);
+     }
+
+     Frame *outer_frame = frame;
+     const Signature *outer_function = function;
+     bool outer_final = final_pass;
+     frame = &locals;
+     function = &signature;
+     NodeId body = ast->children(node).back();
+     final_pass = false;
+     do
+     {
+          changed = false;
+          infer_block(body);
+     } while (changed);
+     final_pass = true;
+     infer_block(body);
+     frame = outer_frame;
+     function = outer_function;
+     final_pass = outer_final;
+}
+
+void TypeChecker::infer_block(NodeId block)
+{
+     for (NodeId stmt : ast->children(block))
+          infer(stmt);
+}
+
+StaticType TypeChecker::infer(NodeId node)
+{
+     StaticType type = StaticType::Unknown;
+     switch (ast->type(node))
+     {
+     case NodeType::Number:
+          type = StaticType::Int;
+          break;
+     case NodeType::DecimalNumber:
+          type = StaticType::Float;
+          break;
+     case NodeType::String:
+          type = StaticType::String;
+          break;
+     case NodeType::Boolean:
+          type = StaticType::Bool;
+          break;
+     case NodeType::Constant:
+          switch (ast->literal(node).kind)
+          {
+          case Literal::Kind::Int:
+               type = StaticType::Int;
+               break;
+          case Literal::Kind::Float:
+               type = StaticType::Float;
+               break;
+          case Literal::Kind::Bool:
+               type = StaticType::Bool;
+               break;
+          case Literal::Kind::String:
+               type = StaticType::String;
+               break;
+          case Literal::Kind::None:
+               break;
+          }
+          break;
+     case NodeType::Array:
+          for (NodeId child : ast->children(node))
+               infer(child);
+          type = StaticType::Array;
+          break;
+     case NodeType::ArrayItem:
+     {
+          StaticType array = infer(ast->child(node, 0));
+          infer(ast->child(node, 1));
+          if (is_exact(array) && array != StaticType::Array)
+          {
+               if (final_pass)
+                    fail(node, "Indexing a non-array value of type " + type_name(array));
+               type = StaticType::Never;
+          }
+          break;
+     }
+     case NodeType::Identifier:
+     {
+          const VarRef &ref = (*resolution)[node];
+          if (frame && ref.depth == 0)
+               type = frame->slots[ref.slot];
+          break;
+     }
+     case NodeType::Assignment:
+          type = infer(ast->child(node, 1));
+          assign(ast->child(node, 0), type);
+          break;
+     case NodeType::ItemAssignment:
+     {
+          StaticType array = infer(ast->child(node, 0));
+          infer(ast->child(node, 1));
+          type = infer(ast->child(node, 2));
+          if (is_exact(array) && array != StaticType::Array)
+          {
+               if (final_pass)
+                    fail(node, "Indexing a non-array value of type " + type_name(array));
+               type = StaticType::Never;
+          }
+          break;
+     }
+     case NodeType::BinaryOp:
+          type = infer_binary(node);
+          break;
+     case NodeType::If:
+          infer(ast->child(node, 0));
+          infer_block(ast->child(node, 1));
+          break;
+     case NodeType::For:
+     case NodeType::ParallelFor:
+     {
+          NodeId head = ast->child(node, 0);
+          for (NodeId child : ast->children(head))
+               infer(child);
+          assign_counter(head);
+          infer_block(ast->child(node, 1));
+          break;
+     }
+     case NodeType::FunctionCall:
+          infer_call(node);
+          break;
+     case NodeType::FunctionDecl:
+          if (final_pass)
+               check_function(node);
+          break;
+     case NodeType::Return:
+          infer_return(node);
+          break;
+     default:
+          for (NodeId child : ast->children(node))
+               infer(child);
+          break;
+     }
+     (*types)[node] = type;
+     return type;
+}
+
+// Mirrors Evaluator::eval_binary_op: when both operand types are exact
+// the result type is too, or the operation always fails. Otherwise some
+// operators still fix the result type.
+StaticType TypeChecker::infer_binary(NodeId node)
+{
+     StaticType lhs = infer(ast->child(node, 0));
+     StaticType rhs = infer(ast->child(node, 1));
+     if (lhs == StaticType::Never || rhs == StaticType::Never)
+          return StaticType::Never;
+
+     Operator op = ast->op(node);
+     bool logical = op == Operator::And || op == Operator::Or;
+     bool supported = true;
+     if (is_numeric(lhs) && is_numeric(rhs))
+     {
+          if (is_comparison(op))
+               return StaticType::Bool;
+          if (op == Operator::Div)
+               return StaticType::Float;
+          if (op == Operator::Add || op == Operator::Sub || op == Operator::Mul)
+               return lhs == StaticType::Int && rhs == StaticType::Int ? StaticType::Int : StaticType::Number;
+          supported = false;
+     }
+     else if (lhs == StaticType::Bool && rhs == StaticType::Bool)
+     {
+          if (logical)
+               return StaticType::Bool;
+          supported = false;
+     }
+     else if (lhs == StaticType::String && rhs == StaticType::String)
+     {
+          if (op == Operator::Add)
+               return StaticType::String;
+          supported = false;
+     }
+     else if (lhs != StaticType::Unknown && rhs != StaticType::Unknown)
+     {
+          supported = false;
+     }
+
+     if (!supported)
+     {
+          if (final_pass)
+               fail(node, std::string("Unsupported operator ") + to_string(op) + " for " + type_name(lhs) + " and " +
+                              type_name(rhs));
+          return StaticType::Never;
+     }
+     if (is_comparison(op) || logical)
+          return StaticType::Bool;
+     if (op == Operator::Div)
+          return StaticType::Float;
+     if (op == Operator::Sub || op == Operator::Mul)
+          return StaticType::Number;
+     return StaticType::Unknown;
+}
+
+void TypeChecker::infer_call(NodeId node)
+{
+     NodeRange args = ast->children(node);
+     std::vector<StaticType> arg_types;
+     arg_types.reserve(args.size());
+     for (NodeId arg : args)
+          arg_types.push_back(infer(arg));
+     if (!final_pass)
+          return;
+
+     std::string name(ast->text(node));
+     auto found = signatures.find(name);
+     if (found == signatures.end() || found->second.declarations != 1 || functions.find_native(name) ||
+         functions.find_update(name))
+          return;
+     const Signature &signature = found->second;
+     if (signature.param_types.size() != args.size())
+          fail(node, "Argument count mismatch in function: " + name);
+     for (size_t i = 0; i < args.size(); ++i)
+          if (is_exact(arg_types[i]) && !proves(arg_types[i], signature.param_types[i]))
+               fail(args[i], "Type mismatch in call to " + name + ": argument " + std::to_string(i + 1) + " is " +
+                                 type_name(arg_types[i]) + ", expected " +
+                                 type_name(from_value_type(signature.param_types[i])));
+}
+
+void TypeChecker::infer_return(NodeId node)
+{
+     StaticType type = infer(ast->child(node, 0));
+     if (final_pass && function && function->has_return_type && is_exact(type) &&
+         !proves(type, function->return_type))
+          fail(node, "Type mismatch in return: got " + type_name(type) + ", expected " +
+                         type_name(from_value_type(function->return_type)));
+}
+
+// Only function locals are tracked. A parameter already holds a value of
+// its declared type, so assigning it another type always fails.
+void TypeChecker::assign(NodeId var, StaticType type)
+{
+     const VarRef &ref = (*resolution)[var];
+     if (!frame || ref.depth != 0)
+          return;
+     StaticType declared = frame->declared[ref.slot];
+     if (final_pass && is_exact(type) && is_exact(declared) && type != declared)
+          fail(var, "Type mismatch assigning " + type_name(type) + " to parameter " + std::string(ast->text(var)) +
+                        " of type " + type_name(declared));
+     StaticType &slot = frame->slots[ref.slot];
+     StaticType merged = join(slot, type);
+     if (merged != slot)
+     {
+          slot = merged;
+          changed = true;
+     }
+     (*types)[var] = slot;
+}
+
+// Both loop forms advance their counter by storing an int directly.
+void TypeChecker::assign_counter(NodeId head)
+{
+     if (ast->type(head) != NodeType::ForLoop || ast->children(head).size() != 2)
+          return;
+     NodeId init = ast->child(head, 0);
+     if (ast->type(init) == NodeType::Assignment)
+          assign(ast->child(init, 0), StaticType::Int);
+}
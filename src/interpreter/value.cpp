@@ -1,52 +1,414 @@
 #include "interpreter/value.hpp"
+#include <charconv>
 #include <stdexcept>
 
-Value::Value() : type(Type::None), int_val(0), float_val(0.0), bool_val(false) {}
-Value::Value(int v) : type(Type::Int), int_val(v), float_val(0.0), bool_val(false) {}
-Value::Value(double v) : type(Type::Float), int_val(0), float_val(v), bool_val(false) {}
-Value::Value(const std::string &v) : type(Type::String), int_val(0), float_val(0.0), str_val(v), bool_val(false) {}
-Value::Value(bool v) : type(Type::Bool), int_val(0), float_val(0.0), bool_val(v) {}
-Value::Value(const std::vector<Value> &v) : type(Type::Array), int_val(0), float_val(0.0), bool_val(false), array_val(v) {}
+struct Value::StringCell : RefCounted
+{
+     std::string data;
+     explicit StringCell(std::string v) : data(std::move(v)) {}
+};
+
+// Only the vector named by `elements` is in use.
+struct Value::ArrayCell : RefCounted
+{
+     Elements elements = Elements::Mixed;
+     std::vector<Value> values;
+     std::vector<int64_t> ints;
+     std::vector<double> floats;
+     std::vector<uint8_t> bools;
+
+     explicit ArrayCell(std::vector<Value> v);
+     explicit ArrayCell(std::vector<int64_t> v) : elements(Elements::Int), ints(std::move(v)) {}
+     explicit ArrayCell(std::vector<double> v) : elements(Elements::Float), floats(std::move(v)) {}
+     ArrayCell(const ArrayCell &other)
+         : elements(other.elements), values(other.values), ints(other.ints), floats(other.floats), bools(other.bools)
+     {
+     }
+
+     size_t size() const;
+     size_t capacity() const;
+     void reserve(size_t count);
+     Value at(size_t index) const;
+     void unpack();
+};
+
+static Value::Elements element_kind(Value::Type type)
+{
+     switch (type)
+     {
+     case Value::Type::Int:
+          return Value::Elements::Int;
+     case Value::Type::Float:
+          return Value::Elements::Float;
+     case Value::Type::Bool:
+          return Value::Elements::Bool;
+     default:
+          return Value::Elements::Mixed;
+     }
+}
+
+Value::ArrayCell::ArrayCell(std::vector<Value> v)
+{
+     Elements common = v.empty() ? Elements::Mixed : element_kind(v[0].type());
+     for (const Value &item : v)
+     {
+          if (element_kind(item.type()) != common)
+          {
+               common = Elements::Mixed;
+               break;
+          }
+     }
+
+     elements = common;
+     switch (common)
+     {
+     case Elements::Int:
+          ints.reserve(v.size());
+          for (const Value &item : v)
+               ints.push_back(item.payload.i);
+          break;
+     case Elements::Float:
+          floats.reserve(v.size());
+          for (const Value &item : v)
+               floats.push_back(item.payload.f);
+          break;
+     case Elements::Bool:
+          bools.reserve(v.size());
+          for (const Value &item : v)
+               bools.push_back(item.payload.b);
+          break;
+     case Elements::Mixed:
+          values = std::move(v);
+          break;
+     }
+}
+
+size_t Value::ArrayCell::size() const
+{
+     switch (elements)
+     {
+     case Elements::Int:
+          return ints.size();
+     case Elements::Float:
+          return floats.size();
+     case Elements::Bool:
+          return bools.size();
+     default:
+          return values.size();
+     }
+}
+
+size_t Value::ArrayCell::capacity() const
+{
+     switch (elements)
+     {
+     case Elements::Int:
+          return ints.capacity();
+     case Elements::Float:
+          return floats.capacity();
+     case Elements::Bool:
+          return bools.capacity();
+     default:
+          return values.capacity();
+     }
+}
+
+void Value::ArrayCell::reserve(size_t count)
+{
+     switch (elements)
+     {
+     case Elements::Int:
+          ints.reserve(count);
+          break;
+     case Elements::Float:
+          floats.reserve(count);
+          break;
+     case Elements::Bool:
+          bools.reserve(count);
+          break;
+     case Elements::Mixed:
+          values.reserve(count);
+          break;
+     }
+}
+
+Value Value::ArrayCell::at(size_t index) const
+{
+     switch (elements)
+     {
+     case Elements::Int:
+          return Value(ints[index]);
+     case Elements::Float:
+          return Value(floats[index]);
+     case Elements::Bool:
+          return Value(bools[index] != 0);
+     default:
+          return values[index];
+     }
+}
+
+void Value::ArrayCell::unpack()
+{
+     if (elements == Elements::Mixed)
+          return;
+     std::vector<Value> items;
+     items.reserve(capacity());
+     for (size_t i = 0; i < size(); ++i)
+          items.push_back(at(i));
+     values = std::move(items);
+     ints = {};
+     floats = {};
+     bools = {};
+     elements = Elements::Mixed;
+}
+
+Value::Value(const char *v) : kind(Type::String) { payload.s = new StringCell(v); }
+Value::Value(const std::string &v) : kind(Type::String) { payload.s = new StringCell(v); }
+Value::Value(std::string &&v) : kind(Type::String) { payload.s = new StringCell(std::move(v)); }
+Value::Value(const std::vector<Value> &v) : kind(Type::Array) { payload.a = new ArrayCell(v); }
+Value::Value(std::vector<Value> &&v) : kind(Type::Array) { payload.a = new ArrayCell(std::move(v)); }
+Value::Value(std::vector<int64_t> &&v) : kind(Type::Array) { payload.a = new ArrayCell(std::move(v)); }
+Value::Value(std::vector<double> &&v) : kind(Type::Array) { payload.a = new ArrayCell(std::move(v)); }
+
+Value &Value::assign_heap(const Value &other)
+{
+     if (this != &other)
+     {
+          Value copy(other);
+          *this = std::move(copy);
+     }
+     return *this;
+}
+
+void Value::release_heap()
+{
+     if (payload.h->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+          return;
+     if (kind == Type::String)
+          delete payload.s;
+     else
+          delete payload.a;
+}
+
+const std::string &Value::str_val() const
+{
+     static const std::string empty;
+     return kind == Type::String ? payload.s->data : empty;
+}
+
+size_t Value::array_size() const
+{
+     return kind == Type::Array ? payload.a->size() : 0;
+}
+
+Value Value::array_at(size_t index) const
+{
+     return payload.a->at(index);
+}
+
+Value::Elements Value::array_elements() const
+{
+     return kind == Type::Array ? payload.a->elements : Elements::Mixed;
+}
+
+const int64_t *Value::int_elements() const
+{
+     return array_elements() == Elements::Int ? payload.a->ints.data() : nullptr;
+}
+
+const double *Value::float_elements() const
+{
+     return array_elements() == Elements::Float ? payload.a->floats.data() : nullptr;
+}
+
+const uint8_t *Value::bool_elements() const
+{
+     return array_elements() == Elements::Bool ? payload.a->bools.data() : nullptr;
+}
+
+std::string &Value::mutable_str()
+{
+     if (kind != Type::String)
+          throw std::runtime_error("Value is not a string");
+     if (payload.s->refs.load(std::memory_order_acquire) != 1)
+     {
+          StringCell *copy = new StringCell(payload.s->data);
+          release_heap();
+          payload.s = copy;
+     }
+     return payload.s->data;
+}
+
+Value::ArrayCell &Value::writable_array()
+{
+     if (kind != Type::Array)
+          throw std::runtime_error("Value is not an array");
+     if (payload.a->refs.load(std::memory_order_acquire) != 1)
+     {
+          ArrayCell *copy = new ArrayCell(*payload.a);
+          release_heap();
+          payload.a = copy;
+     }
+     return *payload.a;
+}
+
+std::vector<Value> &Value::mutable_array()
+{
+     ArrayCell &cell = writable_array();
+     cell.unpack();
+     return cell.values;
+}
+
+void Value::set_array_item(size_t index, Value item)
+{
+     ArrayCell &cell = writable_array();
+     if (cell.elements != Elements::Mixed && element_kind(item.type()) != cell.elements)
+          cell.unpack();
+     switch (cell.elements)
+     {
+     case Elements::Int:
+          cell.ints[index] = item.payload.i;
+          break;
+     case Elements::Float:
+          cell.floats[index] = item.payload.f;
+          break;
+     case Elements::Bool:
+          cell.bools[index] = item.payload.b;
+          break;
+     case Elements::Mixed:
+          cell.values[index] = std::move(item);
+          break;
+     }
+}
+
+void Value::push_array_item(Value item)
+{
+     ArrayCell &cell = writable_array();
+     Elements kind = element_kind(item.type());
+     if (cell.size() == 0 && cell.elements != kind)
+     {
+          // Capacity reserved before the element type was known carries over.
+          size_t capacity = cell.capacity();
+          cell.values = {};
+          cell.ints = {};
+          cell.floats = {};
+          cell.bools = {};
+          cell.elements = kind;
+          cell.reserve(capacity);
+     }
+     else if (cell.elements != Elements::Mixed && kind != cell.elements)
+     {
+          cell.unpack();
+     }
+     switch (cell.elements)
+     {
+     case Elements::Int:
+          cell.ints.push_back(item.payload.i);
+          break;
+     case Elements::Float:
+          cell.floats.push_back(item.payload.f);
+          break;
+     case Elements::Bool:
+          cell.bools.push_back(item.payload.b);
+          break;
+     case Elements::Mixed:
+          cell.values.push_back(std::move(item));
+          break;
+     }
+}
+
+Value Value::pop_array_item()
+{
+     ArrayCell &cell = writable_array();
+     Value last = cell.at(cell.size() - 1);
+     switch (cell.elements)
+     {
+     case Elements::Int:
+          cell.ints.pop_back();
+          break;
+     case Elements::Float:
+          cell.floats.pop_back();
+          break;
+     case Elements::Bool:
+          cell.bools.pop_back();
+          break;
+     case Elements::Mixed:
+          cell.values.pop_back();
+          break;
+     }
+     return last;
+}
+
+void Value::reserve_array(size_t capacity)
+{
+     writable_array().reserve(capacity);
+}
 
 bool Value::is_number() const
 {
-     return type == Type::Int || type == Type::Float;
+     return kind == Type::Int || kind == Type::Float;
 }
 
 std::string Value::to_string() const
 {
-     switch (type)
+     std::string result;
+     append_to(result);
+     return result;
+}
+
+// Floats keep std::to_string's fixed six-digit format.
+void Value::append_to(std::string &out) const
+{
+     switch (kind)
      {
      case Type::Int:
-          return std::to_string(int_val);
+     {
+          char digits[24];
+          auto end = std::to_chars(digits, digits + sizeof(digits), payload.i).ptr;
+          out.append(digits, end);
+          return;
+     }
      case Type::Float:
-          return std::to_string(float_val);
+     {
+          char digits[400];
+          auto end = std::to_chars(digits, digits + sizeof(digits), payload.f, std::chars_format::fixed, 6).ptr;
+          out.append(digits, end);
+          return;
+     }
      case Type::Bool:
-          return bool_val ? "true" : "false";
+          out.append(payload.b ? "true" : "false");
+          return;
      case Type::String:
-          return str_val;
+          out.append(payload.s->data);
+          return;
      case Type::Array:
      {
-          std::string result = "[";
-          for (size_t i = 0; i < array_val.size(); ++i)
+          const ArrayCell &cell = *payload.a;
+          size_t count = cell.size();
+          out.push_back('[');
+          for (size_t i = 0; i < count; ++i)
           {
-               result += array_val[i].to_string();
-               if (i < array_val.size() - 1)
-                    result += ", ";
+               if (i > 0)
+                    out.append(", ");
+               if (cell.elements == Elements::Mixed)
+                    cell.values[i].append_to(out);
+               else
+                    cell.at(i).append_to(out);
           }
-          result += "]";
-          return result;
+          out.push_back(']');
+          return;
      }
      default:
-          return "null";
+          out.append("null");
+          return;
      }
 }
 
 void Value::check_type(Type expected) const
 {
-     if (type != expected)
+     if (kind != expected)
      {
-          throw std::runtime_error("Type mismatch. Expected: " + std::to_string((int)expected) + ", got: " + std::to_string((int)type));
+          throw std::runtime_error("Type mismatch. Expected: " + std::to_string((int)expected) + ", got: " + std::to_string((int)kind));
      }
 }
 
@@ -67,5 +429,5 @@ Value::Type Value::string_to_type(const std::string &type_str)
 
 bool Value::is_array() const
 {
-     return type == Type::Array;
+     return kind == Type::Array;
 }
@@ -0,0 +1,469 @@
+#include "interpreter/vm.hpp"
+#include "interpreter/evaluator.hpp"
+#include "interpreter/parallel.hpp"
+#include "interpreter/profiler.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+VM::VM(FunctionManager &fn_manager)
+    : function_manager(fn_manager)
+{
+}
+
+Value VM::pop()
+{
+     Value v = std::move(stack.back());
+     stack.pop_back();
+     return v;
+}
+
+int64_t VM::for_limit(const Value &current, Value limit)
+{
+     if (limit.is_array())
+          limit = Value(static_cast<int64_t>(limit.array_size()));
+     if (!current.is_number() || !limit.is_number())
+          throw std::runtime_error("Loop bounds must be numeric");
+     return limit.int_val();
+}
+
+void VM::set_max_call_depth(size_t depth)
+{
+     max_call_depth = depth;
+}
+
+// A tail call hands the callee's result straight to this function's
+// caller, so the type check this function's `return` would have made
+// moves to the reused frame. A frame holds one pending check; when two
+// would conflict the call is made normally instead.
+bool VM::carry_result_check(CallFrame &frame, const FunctionProto &function) const
+{
+     if (!function.has_return_type)
+          return true;
+     if (frame.check_result && frame.result_type != function.return_type)
+          return false;
+     frame.check_result = true;
+     frame.result_type = function.return_type;
+     return true;
+}
+
+static Operator binary_operator(OpCode op)
+{
+     switch (op)
+     {
+     case OpCode::Add:
+          return Operator::Add;
+     case OpCode::Sub:
+          return Operator::Sub;
+     case OpCode::Mul:
+          return Operator::Mul;
+     case OpCode::Div:
+          return Operator::Div;
+     case OpCode::Equal:
+          return Operator::Equal;
+     case OpCode::NotEqual:
+          return Operator::NotEqual;
+     case OpCode::Less:
+          return Operator::Less;
+     case OpCode::LessEqual:
+          return Operator::LessEqual;
+     case OpCode::Greater:
+          return Operator::Greater;
+     case OpCode::GreaterEqual:
+          return Operator::GreaterEqual;
+     case OpCode::And:
+          return Operator::And;
+     case OpCode::Or:
+          return Operator::Or;
+     default:
+          return Operator::None;
+     }
+}
+
+Value VM::binary(OpCode op, const Value &lhs, const Value &rhs) const
+{
+     if (lhs.type() == Value::Type::Int && rhs.type() == Value::Type::Int)
+          return int_binary(op, lhs.int_val(), rhs.int_val());
+     return Evaluator::eval_binary_op(binary_operator(op), lhs, rhs);
+}
+
+// Inlined copy of Evaluator::eval_int_op for the common operators.
+Value VM::int_binary(OpCode op, int64_t lhs, int64_t rhs)
+{
+     int64_t result;
+     switch (op)
+     {
+     case OpCode::Add:
+          if (__builtin_add_overflow(lhs, rhs, &result))
+               Evaluator::throw_overflow(Operator::Add, lhs, rhs);
+          return Value(result);
+     case OpCode::Sub:
+          if (__builtin_sub_overflow(lhs, rhs, &result))
+               Evaluator::throw_overflow(Operator::Sub, lhs, rhs);
+          return Value(result);
+     case OpCode::Mul:
+          if (__builtin_mul_overflow(lhs, rhs, &result))
+               Evaluator::throw_overflow(Operator::Mul, lhs, rhs);
+          return Value(result);
+     case OpCode::Equal:
+          return Value(lhs == rhs);
+     case OpCode::NotEqual:
+          return Value(lhs != rhs);
+     case OpCode::Less:
+          return Value(lhs < rhs);
+     case OpCode::LessEqual:
+          return Value(lhs <= rhs);
+     case OpCode::Greater:
+          return Value(lhs > rhs);
+     case OpCode::GreaterEqual:
+          return Value(lhs >= rhs);
+     default:
+          return Evaluator::eval_binary_op(binary_operator(op), Value(lhs), Value(rhs));
+     }
+}
+
+void VM::set_profiler(Profiler *attached)
+{
+     profiler = attached;
+}
+
+void VM::set_thread_pool(ThreadPool *attached)
+{
+     pool = attached;
+}
+
+void VM::run(const Program &program)
+{
+     size_t profile_depth = profiler ? profiler->depth() : 0;
+     try
+     {
+          execute(program);
+     }
+     catch (...)
+     {
+          if (profiler)
+               profiler->unwind(profile_depth);
+          throw;
+     }
+}
+
+void VM::execute(const Program &program)
+{
+     stack.clear();
+     locals.clear();
+     frames.clear();
+     globals.resize(program.global_names.size());
+     functions.resize(program.function_names.size(), nullptr);
+     entries.resize(program.function_names.size(), nullptr);
+     for (size_t i = natives.size(); i < program.function_names.size(); ++i)
+          natives.push_back(function_manager.find_native(program.function_names[i]));
+     for (size_t i = updates.size(); i < program.function_names.size(); ++i)
+          updates.push_back(function_manager.find_update(program.function_names[i]));
+
+     frames.push_back({&program.main, 0, 0, 0});
+     const FunctionProto *fn = &program.main;
+     const Instruction *code = fn->chunk.code.data();
+     size_t ip = 0;
+     size_t base = 0;
+     // A defined variable, to update in place.
+     auto variable = [&](bool global, uint32_t slot) -> Value &
+     {
+          Slot &found = global ? globals[slot] : locals[base + slot];
+          if (!found.defined)
+               throw std::runtime_error("Undefined variable: " +
+                                        (global ? program.global_names[slot] : fn->local_names[slot]));
+          return found.value;
+     };
+
+     while (true)
+     {
+          const Instruction &ins = code[ip++];
+          switch (ins.op)
+          {
+          case OpCode::Constant:
+               stack.push_back(fn->chunk.constants[ins.arg]);
+               break;
+          case OpCode::Nil:
+               stack.emplace_back();
+               break;
+          case OpCode::Pop:
+               stack.pop_back();
+               break;
+
+          case OpCode::LoadGlobal:
+          {
+               const Slot &slot = globals[ins.arg];
+               if (!slot.defined)
+                    throw std::runtime_error("Undefined variable: " + program.global_names[ins.arg]);
+               stack.push_back(slot.value);
+               break;
+          }
+          case OpCode::StoreGlobal:
+               if (ins.aux & store_keep)
+                    globals[ins.arg].assign(stack.back());
+               else
+                    globals[ins.arg].assign(pop());
+               break;
+          case OpCode::LoadLocal:
+          {
+               const Slot &slot = locals[base + ins.arg];
+               if (!slot.defined)
+                    throw std::runtime_error("Undefined variable: " + fn->local_names[ins.arg]);
+               stack.push_back(slot.value);
+               break;
+          }
+          case OpCode::StoreLocal:
+          {
+               Slot &slot = locals[base + ins.arg];
+               Value value = ins.aux & store_keep ? stack.back() : pop();
+               if (ins.aux & store_unchecked)
+               {
+                    slot.value = std::move(value);
+                    slot.defined = true;
+               }
+               else
+               {
+                    slot.assign(std::move(value));
+               }
+               break;
+          }
+
+          case OpCode::Add:
+          case OpCode::Sub:
+          case OpCode::Mul:
+          case OpCode::Div:
+          case OpCode::Equal:
+          case OpCode::NotEqual:
+          case OpCode::Less:
+          case OpCode::LessEqual:
+          case OpCode::Greater:
+          case OpCode::GreaterEqual:
+          case OpCode::And:
+          case OpCode::Or:
+          {
+               Value rhs = pop();
+               if (ins.aux)
+                    stack.back() = int_binary(ins.op, stack.back().int_val(), rhs.int_val());
+               else
+                    stack.back() = binary(ins.op, stack.back(), rhs);
+               break;
+          }
+
+          case OpCode::MakeArray:
+          {
+               std::vector<Value> items(std::make_move_iterator(stack.end() - ins.arg),
+                                        std::make_move_iterator(stack.end()));
+               stack.resize(stack.size() - ins.arg);
+               stack.emplace_back(items);
+               break;
+          }
+          case OpCode::Index:
+          {
+               Value index = pop();
+               const Value &arr = stack.back();
+               if (!arr.is_array())
+                    throw std::runtime_error("Indexing a non-array value");
+               if (index.int_val() < 0 || static_cast<size_t>(index.int_val()) >= arr.array_size())
+                    throw std::runtime_error("Array index out of range: " + std::to_string(index.int_val()));
+               stack.back() = arr.array_at(static_cast<size_t>(index.int_val()));
+               break;
+          }
+          case OpCode::StoreItemGlobal:
+          case OpCode::StoreItemLocal:
+          {
+               Value value = pop();
+               Value index = pop();
+               if (ins.aux & store_keep)
+                    stack.push_back(value);
+               Evaluator::store_item(variable(ins.op == OpCode::StoreItemGlobal, ins.arg), index, std::move(value));
+               break;
+          }
+
+          case OpCode::Jump:
+               ip = ins.arg;
+               break;
+          case OpCode::JumpIfFalse:
+               if (!Evaluator::is_true(pop()))
+                    ip = ins.arg;
+               break;
+          case OpCode::ForTestGlobal:
+          case OpCode::ForTestLocal:
+          {
+               bool local = ins.op == OpCode::ForTestLocal;
+               const Slot &slot = local ? locals[base + ins.arg] : globals[ins.arg];
+               if (!slot.defined)
+                    throw std::runtime_error("Undefined variable: " +
+                                             (local ? fn->local_names[ins.arg] : program.global_names[ins.arg]));
+               Value limit = pop();
+               bool more = slot.value.int_val() < for_limit(slot.value, std::move(limit));
+               stack.push_back(slot.value);
+               stack.emplace_back(more);
+               break;
+          }
+          case OpCode::ForNextGlobal:
+               globals[ins.arg].value = Value(pop().int_val() + 1);
+               break;
+          case OpCode::ForNextLocal:
+               locals[base + ins.arg].value = Value(pop().int_val() + 1);
+               break;
+          case OpCode::ForEnterGlobal:
+          case OpCode::ForEnterLocal:
+          {
+               bool local = ins.op == OpCode::ForEnterLocal;
+               const Slot &slot = local ? locals[base + ins.arg] : globals[ins.arg];
+               if (!slot.defined)
+                    throw std::runtime_error("Undefined variable: " +
+                                             (local ? fn->local_names[ins.arg] : program.global_names[ins.arg]));
+               stack.back() = Value(for_limit(slot.value, std::move(stack.back())));
+               stack.emplace_back(slot.value.int_val());
+               break;
+          }
+          case OpCode::ForLoop:
+               if (stack.back().int_val() >= stack[stack.size() - 2].int_val())
+                    ip = ins.arg;
+               break;
+          case OpCode::ForStepGlobal:
+          case OpCode::ForStepLocal:
+          {
+               Value &counter = stack.back();
+               counter = Value(counter.int_val() + 1);
+               (ins.op == OpCode::ForStepLocal ? locals[base + ins.arg] : globals[ins.arg]).value = counter;
+               break;
+          }
+
+          case OpCode::ParallelFor:
+          {
+               Value limit = pop();
+               bool in_function = frames.size() > 1;
+               ParallelScope scope{&globals, in_function ? locals.data() + base : nullptr,
+                                   in_function ? fn->local_names.size() : 0};
+               // The body runs on tree-walkers, which stop on their own
+               // before the worker's stack runs out.
+               run_parallel_for({program.script, &function_manager, pool, max_call_depth, nullptr}, scope, ins.arg,
+                                std::move(limit));
+               break;
+          }
+
+          case OpCode::UpdateGlobal:
+          case OpCode::UpdateLocal:
+          {
+               // Natives and updates never call back into the VM, so one
+               // argument buffer serves them all without allocating.
+               native_args.assign(std::make_move_iterator(stack.end() - ins.aux), std::make_move_iterator(stack.end()));
+               stack.resize(stack.size() - ins.aux);
+               ProfileScope profile(profiler, program.function_names[ins.function]);
+               Value result = (*updates[ins.function])(variable(ins.op == OpCode::UpdateGlobal, ins.arg), native_args);
+               native_args.clear();
+               stack.push_back(std::move(result));
+               break;
+          }
+
+          case OpCode::DefineFunction:
+          {
+               const FunctionProto *proto = program.functions[ins.arg].get();
+               functions[proto->id] = proto;
+               entries[proto->id] = &function_manager.register_function(proto->name, *program.script, proto->decl);
+               break;
+          }
+          case OpCode::Call:
+          case OpCode::TailCall:
+          {
+               size_t argc = ins.aux;
+               if (natives[ins.arg] && !functions[ins.arg])
+               {
+                    native_args.assign(std::make_move_iterator(stack.end() - argc),
+                                       std::make_move_iterator(stack.end()));
+                    stack.resize(stack.size() - argc);
+                    ProfileScope profile(profiler, program.function_names[ins.arg]);
+                    Value result = (*natives[ins.arg])(native_args);
+                    native_args.clear();
+                    stack.push_back(std::move(result));
+                    break;
+               }
+
+               const FunctionProto *callee = functions[ins.arg];
+               if (!callee)
+                    throw std::runtime_error("Function not found: " + program.function_names[ins.arg]);
+               if (callee->param_types.size() != argc)
+                    throw std::runtime_error("Argument count mismatch in function: " + callee->name);
+
+               size_t first_arg = stack.size() - argc;
+               if (!ins.function || ins.function != callee->serial)
+                    for (size_t i = 0; i < argc; ++i)
+                         stack[first_arg + i].check_type(callee->param_types[i]);
+
+               // Native code runs the whole call; a TAIL_CALL is always
+               // followed by a RETURN that checks the result type.
+               Value result;
+               size_t depth_left = max_call_depth > frames.size() ? max_call_depth - frames.size() : 0;
+               if (!profiler && function_manager.run_native(*entries[ins.arg], &stack[first_arg], depth_left, result))
+               {
+                    stack.resize(first_arg);
+                    stack.push_back(std::move(result));
+                    break;
+               }
+
+               bool tail = ins.op == OpCode::TailCall && frames.size() > 1 && carry_result_check(frames.back(), *fn);
+               if (!tail)
+               {
+                    if (frames.size() >= max_call_depth)
+                         throw std::runtime_error("Maximum call depth of " + std::to_string(max_call_depth) +
+                                                  " exceeded in function: " + callee->name);
+                    frames.back().ip = ip;
+                    frames.push_back({callee, 0, locals.size(), first_arg});
+               }
+               else if (profiler)
+               {
+                    profiler->leave();
+               }
+               if (profiler)
+                    profiler->enter(callee->name);
+
+               CallFrame &frame = frames.back();
+               frame.function = callee;
+               locals.resize(frame.locals_base);
+               locals.resize(frame.locals_base + callee->local_names.size());
+               for (size_t i = 0; i < argc; ++i)
+               {
+                    locals[frame.locals_base + i].value = std::move(stack[first_arg + i]);
+                    locals[frame.locals_base + i].defined = true;
+               }
+               stack.resize(frame.stack_base);
+
+               fn = callee;
+               code = fn->chunk.code.data();
+               ip = 0;
+               base = frame.locals_base;
+               break;
+          }
+          case OpCode::Return:
+          {
+               if (frames.size() == 1)
+                    throw std::runtime_error("Return outside of function");
+
+               Value result = pop();
+               if (ins.aux && fn->has_return_type)
+                    result.check_type(fn->return_type);
+
+               const CallFrame &frame = frames.back();
+               if (frame.check_result)
+                    result.check_type(frame.result_type);
+               stack.resize(frame.stack_base);
+               locals.resize(frame.locals_base);
+               frames.pop_back();
+               if (profiler)
+                    profiler->leave();
+
+               const CallFrame &caller = frames.back();
+               fn = caller.function;
+               code = fn->chunk.code.data();
+               ip = caller.ip;
+               base = caller.locals_base;
+               stack.push_back(std::move(result));
+               break;
+          }
+          case OpCode::Halt:
+               frames.clear();
+               return;
+          }
+     }
+}
@@ -1,15 +1,146 @@
 #include "lexer.hpp"
 #include <cctype>
 
-const std::unordered_set<std::string> Lexer::control_keywords = {
-    "if", "else", "for", "return"};
+const std::string_view Lexer::function_keyword = "fn";
 
-const std::unordered_set<std::string> Lexer::types = {
-    "num", "flo", "str", "bool", "arr"};
+Operator operator_from_string(std::string_view text)
+{
+     if (text == "+")
+          return Operator::Add;
+     if (text == "-")
+          return Operator::Sub;
+     if (text == "*")
+          return Operator::Mul;
+     if (text == "/")
+          return Operator::Div;
+     if (text == "==")
+          return Operator::Equal;
+     if (text == "!=")
+          return Operator::NotEqual;
+     if (text == "<")
+          return Operator::Less;
+     if (text == "<=")
+          return Operator::LessEqual;
+     if (text == ">")
+          return Operator::Greater;
+     if (text == ">=")
+          return Operator::GreaterEqual;
+     if (text == "&&")
+          return Operator::And;
+     if (text == "||")
+          return Operator::Or;
+     if (text == "=")
+          return Operator::Assign;
+     if (text == "!")
+          return Operator::Not;
+     return Operator::None;
+}
 
-const std::string Lexer::function_keyword = "fn";
+const char *to_string(Operator op)
+{
+     switch (op)
+     {
+     case Operator::Add:
+          return "+";
+     case Operator::Sub:
+          return "-";
+     case Operator::Mul:
+          return "*";
+     case Operator::Div:
+          return "/";
+     case Operator::Equal:
+          return "==";
+     case Operator::NotEqual:
+          return "!=";
+     case Operator::Less:
+          return "<";
+     case Operator::LessEqual:
+          return "<=";
+     case Operator::Greater:
+          return ">";
+     case Operator::GreaterEqual:
+          return ">=";
+     case Operator::And:
+          return "&&";
+     case Operator::Or:
+          return "||";
+     case Operator::Assign:
+          return "=";
+     case Operator::Not:
+          return "!";
+     default:
+          return "?";
+     }
+}
 
-Lexer::Lexer(std::string source) : source(std::move(source)) {}
+std::string Token::to_string() const
+{
+     std::string type_str;
+     switch (type)
+     {
+     case TokenType::Identifier:
+          type_str = "Identifier";
+          break;
+     case TokenType::Function:
+          type_str = "Function";
+          break;
+     case TokenType::Type:
+          type_str = "Type";
+          break;
+     case TokenType::If:
+          type_str = "If";
+          break;
+     case TokenType::Else:
+          type_str = "Else";
+          break;
+     case TokenType::For:
+          type_str = "For";
+          break;
+     case TokenType::ParallelFor:
+          type_str = "ParallelFor";
+          break;
+     case TokenType::Return:
+          type_str = "Return";
+          break;
+     case TokenType::Boolean:
+          type_str = "Boolean";
+          break;
+     case TokenType::Integer:
+          type_str = "Integer";
+          break;
+     case TokenType::Float:
+          type_str = "Float";
+          break;
+     case TokenType::String:
+          type_str = "String";
+          break;
+     case TokenType::Operator:
+          type_str = "Operator";
+          break;
+     case TokenType::Punctuation:
+          type_str = "Punctuation";
+          break;
+     case TokenType::EndOfFile:
+          type_str = "EOF";
+          break;
+     case TokenType::OfType:
+          type_str = "OfType";
+          break;
+     case TokenType::Unknown:
+          type_str = "Unknown";
+          break;
+     }
+
+     return type_str + "('" + std::string(value) + "') at " +
+            std::to_string(line) + ":" + std::to_string(column);
+}
+
+Lexer::Lexer(std::string source) : Lexer(SourceBuffer::from_string(std::move(source))) {}
+
+Lexer::Lexer(std::shared_ptr<const SourceBuffer> buffer)
+    : buffer(std::move(buffer)), source(this->buffer->text())
+{
+}
 
 void Lexer::reset()
 {
@@ -42,15 +173,27 @@ char Lexer::get()
      return c;
 }
 
+std::string_view Lexer::slice(size_t start) const
+{
+     return source.substr(start, pos - start);
+}
+
 void Lexer::skip_whitespace()
 {
-     while (std::isspace(peek()))
-          get();
+     while (true)
+     {
+          while (std::isspace(static_cast<unsigned char>(peek())))
+               get();
+          if (peek() != '#')
+               return;
+          while (peek() != '\0' && peek() != '\n')
+               get();
+     }
 }
 
-bool Lexer::is_keyword(const std::string &str) const
+bool Lexer::is_type_name(std::string_view word)
 {
-     return control_keywords.find(str) != control_keywords.end();
+     return word == "num" || word == "flo" || word == "str" || word == "bool" || word == "arr";
 }
 
 Token Lexer::next_token()
@@ -59,6 +202,7 @@ Token Lexer::next_token()
 
      size_t token_line = line;
      size_t token_col = column;
+     size_t start = pos;
      char c = peek();
 
      if (c == '\0')
@@ -66,108 +210,73 @@ Token Lexer::next_token()
           return {TokenType::EndOfFile, "", token_line, token_col};
      }
 
-     if (c == '#')
+     if (std::isalpha(static_cast<unsigned char>(c)) || c == '_')
      {
-          while (peek() != '\0' && peek() != '\n')
-          {
+          while (std::isalnum(static_cast<unsigned char>(peek())) || peek() == '_')
                get();
-          }
-          return next_token();
-     }
-
-     if (std::isalpha(c) || c == '_')
-     {
-          std::string ident;
-          while (std::isalnum(peek()) || peek() == '_')
-          {
-               ident += get();
-          }
+          std::string_view ident = slice(start);
 
           if (ident == function_keyword)
-          {
                return {TokenType::Function, ident, token_line, token_col};
-          }
-          if (types.find(ident) != types.end())
-          {
+          if (is_type_name(ident))
                return {TokenType::Type, ident, token_line, token_col};
-          }
-          if (control_keywords.find(ident) != control_keywords.end())
-          {
-               if (ident == "if")
-                    return {TokenType::If, ident, token_line, token_col};
-               if (ident == "else")
-                    return {TokenType::Else, ident, token_line, token_col};
-               if (ident == "for")
-                    return {TokenType::For, ident, token_line, token_col};
-               if (ident == "return")
-                    return {TokenType::Return, ident, token_line, token_col};
-          }
-
+          if (ident == "if")
+               return {TokenType::If, ident, token_line, token_col};
+          if (ident == "else")
+               return {TokenType::Else, ident, token_line, token_col};
+          if (ident == "for")
+               return {TokenType::For, ident, token_line, token_col};
+          if (ident == "pfor")
+               return {TokenType::ParallelFor, ident, token_line, token_col};
+          if (ident == "return")
+               return {TokenType::Return, ident, token_line, token_col};
           if (ident == "true" || ident == "false")
-          {
                return {TokenType::Boolean, ident, token_line, token_col};
-          }
 
           return {TokenType::Identifier, ident, token_line, token_col};
      }
 
-     if (std::isdigit(c) )
+     if (std::isdigit(static_cast<unsigned char>(c)))
      {
-          std::string number;
           bool has_dot = false;
-
-          while (std::isdigit(peek()) || (peek() == '.' && !has_dot))
+          while (std::isdigit(static_cast<unsigned char>(peek())) || (peek() == '.' && !has_dot))
           {
                if (peek() == '.')
-               {
                     has_dot = true;
-               }
-               number += get();
+               get();
           }
-
-          return {has_dot ? TokenType::Float : TokenType::Integer, number, token_line, token_col};
+          return {has_dot ? TokenType::Float : TokenType::Integer, slice(start), token_line, token_col};
      }
 
      if (c == '"' || c == '\'')
      {
           char quote = get();
-          std::string str;
+          size_t text_start = pos;
           while (peek() != quote && peek() != '\0' && peek() != '\n')
-          {
-               str += get();
-          }
+               get();
+          std::string_view text = source.substr(text_start, pos - text_start);
           if (peek() == quote)
-          {
                get();
-          }
-          return {TokenType::String, str, token_line, token_col};
+          return {TokenType::String, text, token_line, token_col};
      }
 
-     if (std::string("+-*/=<>!").find(c) != std::string::npos)
+     if (std::string_view("+-*/=<>!").find(c) != std::string_view::npos)
      {
-          std::string op;
-          op += get();
-          if (std::string("=<>!").find(op[0]) != std::string::npos && peek() == '=')
-          {
-               op += get();
-          }
-          return {TokenType::Operator, op, token_line, token_col};
+          get();
+          if (std::string_view("=<>!").find(c) != std::string_view::npos && peek() == '=')
+               get();
+          std::string_view op = slice(start);
+          return {TokenType::Operator, op, token_line, token_col, operator_from_string(op)};
      }
 
      if (c == ':')
      {
-          char colon = get();
-          return {TokenType::OfType, std::string(1, colon), token_line, token_col};
-     }
-
-     if (std::string("(){}[],;").find(c) != std::string::npos)
-     {
-          std::string punct;
-          punct += get();
-          return {TokenType::Punctuation, punct, token_line, token_col};
+          get();
+          return {TokenType::OfType, slice(start), token_line, token_col};
      }
 
-     std::string unknown;
-     unknown += get();
-     return {TokenType::Unknown, unknown, token_line, token_col};
-}
\ No newline at end of file
+     get();
+     if (std::string_view("(){}[],;").find(c) != std::string_view::npos)
+          return {TokenType::Punctuation, slice(start), token_line, token_col};
+     return {TokenType::Unknown, slice(start), token_line, token_col};
+}
@@ -0,0 +1,69 @@
+#include "source.hpp"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define KARAMEL_HAVE_MMAP 1
+#endif
+
+std::shared_ptr<const SourceBuffer> SourceBuffer::from_string(std::string text)
+{
+     std::shared_ptr<SourceBuffer> buffer(new SourceBuffer());
+     buffer->owned = std::move(text);
+     buffer->data = buffer->owned.data();
+     buffer->size = buffer->owned.size();
+     return buffer;
+}
+
+std::shared_ptr<const SourceBuffer> SourceBuffer::map_file(const std::string &path)
+{
+#ifdef KARAMEL_HAVE_MMAP
+     int fd = ::open(path.c_str(), O_RDONLY);
+     if (fd < 0)
+          throw std::runtime_error("Cannot open script: " + path);
+
+     struct stat info;
+     if (::fstat(fd, &info) != 0)
+     {
+          ::close(fd);
+          throw std::runtime_error("Cannot read script: " + path);
+     }
+
+     // Empty files cannot be mapped, and pipes or devices have no size to
+     // map; those are read the ordinary way below.
+     if (S_ISREG(info.st_mode) && info.st_size > 0)
+     {
+          void *addr = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+          ::close(fd);
+          if (addr == MAP_FAILED)
+               throw std::runtime_error("Cannot map script: " + path);
+
+          std::shared_ptr<SourceBuffer> buffer(new SourceBuffer());
+          buffer->data = static_cast<const char *>(addr);
+          buffer->size = static_cast<size_t>(info.st_size);
+          buffer->mapped = true;
+          return buffer;
+     }
+     ::close(fd);
+#endif
+
+     std::ifstream in(path, std::ios::binary);
+     if (!in)
+          throw std::runtime_error("Cannot open script: " + path);
+     std::ostringstream contents;
+     contents << in.rdbuf();
+     return from_string(contents.str());
+}
+
+SourceBuffer::~SourceBuffer()
+{
+#ifdef KARAMEL_HAVE_MMAP
+     if (mapped)
+          ::munmap(const_cast<char *>(data), size);
+#endif
+}
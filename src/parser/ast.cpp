@@ -0,0 +1,59 @@
+#include "ast.hpp"
+#include <cstring>
+
+SymbolId SymbolTable::intern(std::string_view text)
+{
+     auto found = index.find(text);
+     if (found != index.end())
+          return found->second;
+
+     std::string_view stored(store(text), text.size());
+     SymbolId id = static_cast<SymbolId>(symbols.size());
+     symbols.push_back(stored);
+     index.emplace(stored, id);
+     return id;
+}
+
+SymbolId SymbolTable::find(std::string_view text) const
+{
+     auto found = index.find(text);
+     return found == index.end() ? no_symbol : found->second;
+}
+
+const char *SymbolTable::store(std::string_view text)
+{
+     if (text.empty())
+          return "";
+     if (text.size() > block_size / 4)
+     {
+          blocks.emplace_back(new char[text.size()]);
+          std::memcpy(blocks.back().get(), text.data(), text.size());
+          return blocks.back().get();
+     }
+     if (block_used + text.size() > block_size)
+     {
+          blocks.emplace_back(new char[block_size]);
+          current_block = blocks.back().get();
+          block_used = 0;
+     }
+     char *dest = current_block + block_used;
+     std::memcpy(dest, text.data(), text.size());
+     block_used += text.size();
+     return dest;
+}
+
+NodeId Ast::add(NodeType type, SymbolId value, uint32_t line, uint32_t column,
+                const NodeId *children, size_t count, Operator op)
+{
+     NodeId id = static_cast<NodeId>(nodes.size());
+     uint32_t first = static_cast<uint32_t>(child_ids.size());
+     child_ids.insert(child_ids.end(), children, children + count);
+     nodes.push_back({type, op, value, first, static_cast<uint32_t>(count), line, column});
+     return id;
+}
+
+uint32_t Ast::add_literal(const Literal &literal)
+{
+     literal_pool.push_back(literal);
+     return static_cast<uint32_t>(literal_pool.size() - 1);
+}
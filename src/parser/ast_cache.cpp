@@ -0,0 +1,400 @@
+#include "ast_cache.hpp"
+#include "source.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+constexpr char cache_magic[4] = {'K', 'R', 'M', 'C'};
+constexpr uint32_t byte_order_mark = 0x01020304;
+
+// Every field is fixed-width and naturally aligned, so the header has no
+// padding. Sections follow it in this order: nodes, children (the child
+// lists of all nodes, in node order), roots, literals, symbol lengths and
+// symbol text. `checksum` is hash_bytes() of everything after the header.
+struct Header
+{
+     char magic[4];
+     uint32_t version;
+     uint32_t byte_order;
+     uint32_t opt_level;
+     uint64_t source_hash;
+     uint64_t source_size;
+     uint32_t node_count;
+     uint32_t child_count;
+     uint32_t root_count;
+     uint32_t literal_count;
+     uint32_t symbol_count;
+     uint32_t reserved;
+     uint64_t string_bytes;
+     uint64_t checksum;
+};
+
+struct NodeRecord
+{
+     uint8_t type;
+     uint8_t op;
+     uint16_t reserved;
+     uint32_t value;
+     uint32_t child_count;
+     uint32_t line;
+     uint32_t column;
+};
+
+struct LiteralRecord
+{
+     uint8_t kind;
+     uint8_t reserved[7];
+     uint64_t bits;
+};
+
+// Word-at-a-time multiply/xor-shift mixing: not cryptographic, but fast
+// enough to run over a whole script or cache file on every load.
+uint64_t hash_bytes(std::string_view bytes)
+{
+     uint64_t hash = 0x9e3779b97f4a7c15ull ^ bytes.size();
+     size_t i = 0;
+     for (; i + 8 <= bytes.size(); i += 8)
+     {
+          uint64_t word;
+          std::memcpy(&word, bytes.data() + i, sizeof(word));
+          hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+          hash ^= hash >> 32;
+     }
+     if (i < bytes.size())
+     {
+          uint64_t word = 0;
+          std::memcpy(&word, bytes.data() + i, bytes.size() - i);
+          hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+     }
+     hash ^= hash >> 33;
+     hash *= 0xc4ceb9fe1a85ec53ull;
+     hash ^= hash >> 33;
+     return hash;
+}
+
+// Whether a node has the shape the parser gives it. The resolver, the
+// type checker and both engines index children by position without
+// checking, so a file that passes the checksum must still not be able to
+// send them out of range.
+bool well_formed(NodeType type, const std::vector<NodeId> &children, const std::vector<NodeRecord> &records)
+{
+     auto is = [&](size_t i, NodeType expected) { return records[children[i]].type == static_cast<uint8_t>(expected); };
+     auto is_name = [&](size_t i) { return is(i, NodeType::Identifier) && records[children[i]].child_count == 0; };
+     size_t count = children.size();
+     switch (type)
+     {
+     case NodeType::Number:
+     case NodeType::DecimalNumber:
+     case NodeType::String:
+     case NodeType::Boolean:
+     case NodeType::Constant:
+          return count == 0;
+     case NodeType::Return:
+     case NodeType::While:
+          return count == 1;
+     case NodeType::If:
+     case NodeType::BinaryOp:
+     case NodeType::ForLoop:
+          return count == 2;
+     case NodeType::For:
+          return count == 2 && (is(0, NodeType::ForLoop) || is(0, NodeType::While));
+     case NodeType::ParallelFor:
+          return count == 2 && is(0, NodeType::ForLoop);
+     case NodeType::Assignment:
+     case NodeType::ArrayItem:
+          return count == 2 && is_name(0);
+     case NodeType::ItemAssignment:
+          return count == 3 && is_name(0);
+     case NodeType::FunctionDecl:
+          return (count == 2 || count == 3) && is(0, NodeType::ParamList) && (count == 2 || is_name(1));
+     case NodeType::ParamList:
+          for (size_t i = 0; i < count; ++i)
+               if (!is_name(i))
+                    return false;
+          return true;
+     default:
+          return true;
+     }
+}
+
+template <typename T>
+void put(std::string &out, const T &record)
+{
+     out.append(reinterpret_cast<const char *>(&record), sizeof(T));
+}
+
+// Bounds-checked cursor over the mapped file.
+class Reader
+{
+public:
+     explicit Reader(std::string_view data) : data(data) {}
+
+     template <typename T>
+     bool get(T &record)
+     {
+          if (data.size() - pos < sizeof(T))
+               return false;
+          std::memcpy(&record, data.data() + pos, sizeof(T));
+          pos += sizeof(T);
+          return true;
+     }
+
+     bool take(size_t size, std::string_view &out)
+     {
+          if (data.size() - pos < size)
+               return false;
+          out = data.substr(pos, size);
+          pos += size;
+          return true;
+     }
+
+     bool at_end() const { return pos == data.size(); }
+
+private:
+     std::string_view data;
+     size_t pos = 0;
+};
+
+bool read_ast(std::string_view file, const AstCacheKey &key, Ast &ast)
+{
+     Reader in(file);
+     Header header;
+     if (!in.get(header) || std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+         header.version != cache_format_version || header.byte_order != byte_order_mark ||
+         header.opt_level != key.opt_level || header.source_hash != key.source_hash ||
+         header.source_size != key.source_size)
+          return false;
+     if (hash_bytes(file.substr(sizeof(Header))) != header.checksum)
+          return false;
+     uint64_t expected = sizeof(Header) + static_cast<uint64_t>(header.node_count) * sizeof(NodeRecord) +
+                         (static_cast<uint64_t>(header.child_count) + header.root_count) * sizeof(NodeId) +
+                         static_cast<uint64_t>(header.literal_count) * sizeof(LiteralRecord) +
+                         static_cast<uint64_t>(header.symbol_count) * sizeof(uint32_t) + header.string_bytes;
+     if (expected != file.size())
+          return false;
+
+     // Children are always created before their parent, so every child id
+     // must be below its parent's; that also rules out cycles.
+     std::vector<NodeRecord> records(header.node_count);
+     for (NodeRecord &record : records)
+          if (!in.get(record) || record.type > static_cast<uint8_t>(NodeType::Constant) ||
+              record.op > static_cast<uint8_t>(Operator::Not))
+               return false;
+
+     ast.reserve(header.node_count, header.child_count, header.literal_count);
+     ast.symbols().reserve(header.symbol_count);
+     std::vector<NodeId> children;
+     uint64_t children_seen = 0;
+     for (uint32_t id = 0; id < header.node_count; ++id)
+     {
+          const NodeRecord &record = records[id];
+          children_seen += record.child_count;
+          if (children_seen > header.child_count)
+               return false;
+          children.resize(record.child_count);
+          for (NodeId &child : children)
+               if (!in.get(child) || child >= id)
+                    return false;
+          NodeType type = static_cast<NodeType>(record.type);
+          if (!well_formed(type, children, records))
+               return false;
+          uint32_t limit = type == NodeType::Constant ? header.literal_count : header.symbol_count;
+          if (record.value >= limit)
+               return false;
+          ast.add(type, record.value, record.line, record.column, children.data(), children.size(),
+                  static_cast<Operator>(record.op));
+     }
+     if (children_seen != header.child_count)
+          return false;
+
+     for (uint32_t i = 0; i < header.root_count; ++i)
+     {
+          NodeId root;
+          if (!in.get(root) || root >= header.node_count)
+               return false;
+          ast.add_root(root);
+     }
+
+     for (uint32_t i = 0; i < header.literal_count; ++i)
+     {
+          LiteralRecord record;
+          if (!in.get(record) || record.kind > static_cast<uint8_t>(Literal::Kind::String))
+               return false;
+          Literal literal;
+          literal.kind = static_cast<Literal::Kind>(record.kind);
+          switch (literal.kind)
+          {
+          case Literal::Kind::Int:
+               literal.int_val = static_cast<int64_t>(record.bits);
+               break;
+          case Literal::Kind::Float:
+               std::memcpy(&literal.float_val, &record.bits, sizeof(double));
+               break;
+          case Literal::Kind::Bool:
+               literal.bool_val = record.bits != 0;
+               break;
+          case Literal::Kind::String:
+               if (record.bits >= header.symbol_count)
+                    return false;
+               literal.str = static_cast<SymbolId>(record.bits);
+               break;
+          case Literal::Kind::None:
+               break;
+          }
+          ast.add_literal(literal);
+     }
+
+     std::vector<uint32_t> lengths(header.symbol_count);
+     uint64_t total = 0;
+     for (uint32_t &length : lengths)
+     {
+          if (!in.get(length))
+               return false;
+          total += length;
+     }
+     if (total != header.string_bytes)
+          return false;
+     for (uint32_t i = 0; i < header.symbol_count; ++i)
+     {
+          std::string_view text;
+          if (!in.take(lengths[i], text) || ast.symbols().intern(text) != i)
+               return false;
+     }
+     return in.at_end();
+}
+}
+
+AstCacheKey ast_cache_key(std::string_view source, int opt_level)
+{
+     // A stale hit also needs a matching length.
+     AstCacheKey key;
+     key.source_hash = hash_bytes(source);
+     key.source_size = source.size();
+     key.opt_level = static_cast<uint32_t>(opt_level);
+     return key;
+}
+
+std::string ast_cache_path(const std::string &dir, const AstCacheKey &key)
+{
+     char name[40];
+     std::snprintf(name, sizeof(name), "%016llx-O%u.krmc", static_cast<unsigned long long>(key.source_hash),
+                   key.opt_level);
+     if (dir.empty() || dir.back() == '/')
+          return dir + name;
+     return dir + "/" + name;
+}
+
+void save_ast_cache(const std::string &path, const Ast &ast, const AstCacheKey &key)
+{
+     const SymbolTable &symbols = ast.symbols();
+     Header header{};
+     std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+     header.version = cache_format_version;
+     header.byte_order = byte_order_mark;
+     header.opt_level = key.opt_level;
+     header.source_hash = key.source_hash;
+     header.source_size = key.source_size;
+     header.node_count = static_cast<uint32_t>(ast.size());
+     header.root_count = static_cast<uint32_t>(ast.roots().size());
+     header.literal_count = static_cast<uint32_t>(ast.literals().size());
+     header.symbol_count = static_cast<uint32_t>(symbols.size());
+     for (NodeId id = 0; id < ast.size(); ++id)
+          header.child_count += static_cast<uint32_t>(ast.children(id).size());
+     for (SymbolId id = 0; id < symbols.size(); ++id)
+          header.string_bytes += symbols.view(id).size();
+
+     std::string out;
+     out.reserve(sizeof(Header) + ast.size() * sizeof(NodeRecord) + header.child_count * sizeof(NodeId) +
+                 header.literal_count * sizeof(LiteralRecord) + header.symbol_count * sizeof(uint32_t) +
+                 header.string_bytes);
+     put(out, header);
+     for (NodeId id = 0; id < ast.size(); ++id)
+     {
+          const Node &node = ast.node(id);
+          NodeRecord record{};
+          record.type = static_cast<uint8_t>(node.type);
+          record.op = static_cast<uint8_t>(node.op);
+          record.value = node.value;
+          record.child_count = node.child_count;
+          record.line = node.line;
+          record.column = node.column;
+          put(out, record);
+     }
+     for (NodeId id = 0; id < ast.size(); ++id)
+          for (NodeId child : ast.children(id))
+               put(out, child);
+     for (NodeId root : ast.roots())
+          put(out, root);
+     for (const Literal &literal : ast.literals())
+     {
+          LiteralRecord record{};
+          record.kind = static_cast<uint8_t>(literal.kind);
+          switch (literal.kind)
+          {
+          case Literal::Kind::Int:
+               record.bits = static_cast<uint64_t>(literal.int_val);
+               break;
+          case Literal::Kind::Float:
+               std::memcpy(&record.bits, &literal.float_val, sizeof(double));
+               break;
+          case Literal::Kind::Bool:
+               record.bits = literal.bool_val;
+               break;
+          case Literal::Kind::String:
+               record.bits = literal.str;
+               break;
+          case Literal::Kind::None:
+               break;
+          }
+          put(out, record);
+     }
+     for (SymbolId id = 0; id < symbols.size(); ++id)
+          put(out, static_cast<uint32_t>(symbols.view(id).size()));
+     for (SymbolId id = 0; id < symbols.size(); ++id)
+          out.append(symbols.view(id));
+     header.checksum = hash_bytes(std::string_view(out).substr(sizeof(Header)));
+     std::memcpy(out.data(), &header, sizeof(Header));
+
+     std::string temp = path + ".tmp" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+     {
+          std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+          if (!file.write(out.data(), static_cast<std::streamsize>(out.size())) || !file.flush())
+          {
+               std::remove(temp.c_str());
+               throw std::runtime_error("Cannot write cache file: " + path);
+          }
+     }
+     if (std::rename(temp.c_str(), path.c_str()) != 0)
+     {
+          std::remove(temp.c_str());
+          throw std::runtime_error("Cannot write cache file: " + path);
+     }
+}
+
+std::optional<Ast> load_ast_cache(const std::string &path, const AstCacheKey &key)
+{
+     std::shared_ptr<const SourceBuffer> file;
+     {
+          std::ifstream probe(path, std::ios::binary);
+          if (!probe)
+               return std::nullopt;
+     }
+     try
+     {
+          file = SourceBuffer::map_file(path);
+     }
+     catch (const std::runtime_error &)
+     {
+          return std::nullopt;
+     }
+
+     Ast ast;
+     if (!read_ast(file->text(), key, ast))
+          return std::nullopt;
+     return ast;
+}
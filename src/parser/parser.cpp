@@ -12,19 +12,34 @@ void Parser::advance()
      current = lexer.next_token();
 }
 
-bool Parser::match(TokenType type, const std::string &val)
+bool Parser::match(TokenType type, std::string_view val) const
 {
      return current.type == type && (val.empty() || current.value == val);
 }
 
-void Parser::expect(TokenType type, const std::string &val)
+void Parser::expect(TokenType type, std::string_view val)
 {
      if (!match(type, val))
      {
-          throw std::runtime_error("Unexpected token: " + current.to_string() + " Waited for: " + val);
+          throw std::runtime_error("Unexpected token: " + current.to_string() + " Waited for: " + std::string(val));
      }
      advance();
 }
+
+NodeId Parser::make_node(NodeType type, std::string_view value, uint32_t line, uint32_t column, size_t mark,
+                         Operator op)
+{
+     NodeId id = ast.add(type, ast.symbols().intern(value), line, column,
+                         pending.data() + mark, pending.size() - mark, op);
+     pending.resize(mark);
+     return id;
+}
+
+NodeId Parser::make_leaf(NodeType type, std::string_view value)
+{
+     return make_node(type, value, current.line, current.column, pending.size());
+}
+
 std::string node_type_to_string(NodeType type)
 {
      switch (type)
@@ -37,10 +52,14 @@ std::string node_type_to_string(NodeType type)
           return "If";
      case NodeType::For:
           return "For";
+     case NodeType::ParallelFor:
+          return "ParallelFor";
      case NodeType::Return:
           return "Return";
      case NodeType::Assignment:
           return "Assignment";
+     case NodeType::ItemAssignment:
+          return "ItemAssignment";
      case NodeType::Identifier:
           return "Identifier";
      case NodeType::Number:
@@ -59,34 +78,40 @@ std::string node_type_to_string(NodeType type)
           return "Array";
      case NodeType::ArrayItem:
           return "ArrayItem";
+     case NodeType::Constant:
+          return "Constant";
      default:
           return "???";
      }
 }
 
-void print_ast(const std::shared_ptr<ASTNode> &node, int indent = 0)
+void print_ast(const Ast &ast, NodeId node, int indent = 0)
 {
      std::string ind(indent * 2, ' ');
-     std::cout << ind << "Node: " << node->value << " type: (" + node_type_to_string(node->type) + ")\n";
-     for (const auto &child : node->children)
+     std::cout << ind << "Node: " << ast.text(node) << " type: (" + node_type_to_string(ast.type(node)) + ")\n";
+     for (NodeId child : ast.children(node))
      {
-          print_ast(child, indent + 1);
+          print_ast(ast, child, indent + 1);
      }
 }
 
-std::vector<std::shared_ptr<ASTNode>> Parser::parse()
+Ast Parser::parse()
 {
-     std::vector<std::shared_ptr<ASTNode>> nodes;
      while (!match(TokenType::EndOfFile))
      {
           auto node = parse_statement();
-          // print_ast(node);
-          nodes.push_back(node);
+          // print_ast(ast, node);
+          ast.add_root(node);
      }
-     return nodes;
+     return std::move(ast);
 }
-std::shared_ptr<ASTNode> Parser::parse_statement()
+
+NodeId Parser::parse_statement()
 {
+     uint32_t line = current.line;
+     uint32_t column = current.column;
+     size_t mark = pending.size();
+
      if (match(TokenType::Function))
      {
           return parse_function_decl();
@@ -95,54 +120,53 @@ std::shared_ptr<ASTNode> Parser::parse_statement()
      if (match(TokenType::Return))
      {
           advance();
-          auto node = std::make_shared<ASTNode>(NodeType::Return, "return");
-          node->children.push_back(parse_expression());
+          pending.push_back(parse_expression());
           expect(TokenType::Punctuation, ";");
-          return node;
+          return make_node(NodeType::Return, "return", line, column, mark);
      }
 
      if (match(TokenType::If))
      {
-          auto node = std::make_shared<ASTNode>(NodeType::If, current.value);
+          std::string_view keyword = current.value;
           advance();
           expect(TokenType::Punctuation, "(");
-          node->children.push_back(parse_expression());
+          pending.push_back(parse_expression());
           expect(TokenType::Punctuation, ")");
-          node->children.push_back(parse_block());
-          return node;
+          pending.push_back(parse_block());
+          return make_node(NodeType::If, keyword, line, column, mark);
      }
 
-     if (match(TokenType::For))
+     // `pfor` takes the same counted head as `for` but no while form.
+     if (match(TokenType::For) || match(TokenType::ParallelFor))
      {
+          bool parallel = match(TokenType::ParallelFor);
           advance();
           expect(TokenType::Punctuation, "(");
 
-          auto for_node = std::make_shared<ASTNode>(NodeType::For, "for");
-
-          auto first_expr = parse_expression();
+          size_t head_mark = pending.size();
+          pending.push_back(parse_expression());
 
           if (match(TokenType::Punctuation, ";"))
           {
                advance();
-               auto second_expr = parse_expression();
-
-               auto loop = std::make_shared<ASTNode>(NodeType::ForLoop, "loop");
-               loop->children.push_back(first_expr);
-               loop->children.push_back(second_expr);
-
-               for_node->children.push_back(loop);
+               pending.push_back(parse_expression());
+               pending.push_back(make_node(NodeType::ForLoop, "loop", line, column, head_mark));
+          }
+          else if (parallel)
+          {
+               throw std::runtime_error("Expected ';' in pfor loop, got: " + current.to_string());
           }
           else
           {
-               auto cond = std::make_shared<ASTNode>(NodeType::While, "while");
-               cond->children.push_back(first_expr);
-               for_node->children.push_back(cond);
+               pending.push_back(make_node(NodeType::While, "while", line, column, head_mark));
           }
 
           expect(TokenType::Punctuation, ")");
-          for_node->children.push_back(parse_block());
+          pending.push_back(parse_block());
 
-          return for_node;
+          if (parallel)
+               return make_node(NodeType::ParallelFor, "pfor", line, column, mark);
+          return make_node(NodeType::For, "for", line, column, mark);
      }
 
      auto expr = parse_expression();
@@ -150,33 +174,40 @@ std::shared_ptr<ASTNode> Parser::parse_statement()
      return expr;
 }
 
-std::shared_ptr<ASTNode> Parser::parse_function_decl()
+NodeId Parser::parse_function_decl()
 {
+     uint32_t line = current.line;
+     uint32_t column = current.column;
+     size_t mark = pending.size();
+
      expect(TokenType::Function);
-     std::string name = current.value;
+     std::string_view name = current.value;
      expect(TokenType::Identifier);
 
-     auto func = std::make_shared<ASTNode>(NodeType::FunctionDecl, name);
-
      expect(TokenType::Punctuation, "(");
 
-     auto param_list = std::make_shared<ASTNode>(NodeType::ParamList, "");
+     uint32_t params_line = current.line;
+     uint32_t params_column = current.column;
+     size_t params_mark = pending.size();
      if (!match(TokenType::Punctuation, ")"))
      {
           while (true)
           {
-               std::string param_name = current.value;
+               uint32_t param_line = current.line;
+               uint32_t param_column = current.column;
+               std::string_view param_name = current.value;
                expect(TokenType::Identifier);
 
                expect(TokenType::OfType);
 
-               std::string type = current.value;
+               std::string_view type = current.value;
                expect(TokenType::Type);
 
-               std::string full_param = param_name + ":" + type;
+               std::string full_param;
+               full_param.reserve(param_name.size() + 1 + type.size());
+               full_param.append(param_name).append(":").append(type);
 
-               param_list->children.push_back(
-                   std::make_shared<ASTNode>(NodeType::Identifier, full_param));
+               pending.push_back(make_node(NodeType::Identifier, full_param, param_line, param_column, pending.size()));
 
                if (match(TokenType::Punctuation, ","))
                {
@@ -194,68 +225,76 @@ std::shared_ptr<ASTNode> Parser::parse_function_decl()
      }
 
      expect(TokenType::Punctuation, ")");
-     func->children.push_back(param_list);
+     pending.push_back(make_node(NodeType::ParamList, "", params_line, params_column, params_mark));
 
      if (match(TokenType::Type))
      {
-          func->children.push_back(
-              std::make_shared<ASTNode>(NodeType::Identifier, "ret:" + current.value));
+          pending.push_back(make_leaf(NodeType::Identifier, std::string("ret:").append(current.value)));
           advance();
      }
 
-     func->children.push_back(parse_block());
+     pending.push_back(parse_block());
 
-     return func;
+     return make_node(NodeType::FunctionDecl, name, line, column, mark);
 }
 
-std::shared_ptr<ASTNode> Parser::parse_block()
+NodeId Parser::parse_block()
 {
+     uint32_t line = current.line;
+     uint32_t column = current.column;
+     size_t mark = pending.size();
+
      expect(TokenType::Punctuation, "(");
-     std::vector<std::shared_ptr<ASTNode>> stmts;
      while (!match(TokenType::Punctuation, ")"))
      {
-          stmts.push_back(parse_statement());
+          pending.push_back(parse_statement());
      }
      expect(TokenType::Punctuation, ")");
-     auto block = std::make_shared<ASTNode>(NodeType::Identifier, "block");
-     block->children = std::move(stmts);
-     return block;
+     return make_node(NodeType::Identifier, "block", line, column, mark);
 }
 
-std::shared_ptr<ASTNode> Parser::parse_expression()
+NodeId Parser::parse_expression()
 {
+     uint32_t line = current.line;
+     uint32_t column = current.column;
      auto left = parse_primary();
 
-     if (left->type == NodeType::Identifier && match(TokenType::Operator, "="))
+     if (ast.type(left) == NodeType::Identifier && match(TokenType::Operator, "="))
      {
           advance();
-          auto assign = std::make_shared<ASTNode>(NodeType::Assignment, "=");
-          assign->children.push_back(left);
-          assign->children.push_back(parse_expression());
-          return assign;
+          size_t mark = pending.size();
+          pending.push_back(left);
+          pending.push_back(parse_expression());
+          return make_node(NodeType::Assignment, "=", line, column, mark);
      }
 
-     if (left->type == NodeType::Identifier && match(TokenType::Punctuation, "["))
+     if (ast.type(left) == NodeType::Identifier && match(TokenType::Punctuation, "["))
      {
           advance();
-          auto item = std::make_shared<ASTNode>(NodeType::ArrayItem, "");
-          item->children.push_back(left);
-          item->children.push_back(parse_expression());
+          size_t mark = pending.size();
+          pending.push_back(left);
+          pending.push_back(parse_expression());
           expect(TokenType::Punctuation, "]");
-          return item;
+          if (match(TokenType::Operator, "="))
+          {
+               advance();
+               pending.push_back(parse_expression());
+               return make_node(NodeType::ItemAssignment, "=", line, column, mark);
+          }
+          return make_node(NodeType::ArrayItem, "", line, column, mark);
      }
 
      while (true)
      {
           if (match(TokenType::Operator))
           {
-               std::string op = current.value;
+               std::string_view text = current.value;
+               Operator op = current.op;
                advance();
-               auto right = parse_primary();
-               auto bin = std::make_shared<ASTNode>(NodeType::BinaryOp, op);
-               bin->children.push_back(left);
-               bin->children.push_back(right);
-               left = bin;
+               size_t mark = pending.size();
+               pending.push_back(left);
+               pending.push_back(parse_primary());
+               left = make_node(NodeType::BinaryOp, text, line, column, mark, op);
           }
           else if (match(TokenType::Punctuation, ","))
           {
@@ -274,22 +313,24 @@ std::shared_ptr<ASTNode> Parser::parse_expression()
      return left;
 }
 
-std::shared_ptr<ASTNode> Parser::parse_primary()
+NodeId Parser::parse_primary()
 {
+     uint32_t line = current.line;
+     uint32_t column = current.column;
+
      if (match(TokenType::Identifier))
      {
-          std::string name = current.value;
+          std::string_view name = current.value;
           advance();
 
           if (match(TokenType::Punctuation, "("))
           {
                advance();
 
-               auto call = std::make_shared<ASTNode>(NodeType::FunctionCall, name);
-
+               size_t mark = pending.size();
                while (!match(TokenType::Punctuation, ")") && !match(TokenType::EndOfFile))
                {
-                    call->children.push_back(parse_expression());
+                    pending.push_back(parse_expression());
 
                     if (match(TokenType::Punctuation, ","))
                     {
@@ -302,19 +343,19 @@ std::shared_ptr<ASTNode> Parser::parse_primary()
                }
 
                expect(TokenType::Punctuation, ")");
-               return call;
+               return make_node(NodeType::FunctionCall, name, line, column, mark);
           }
 
-          return std::make_shared<ASTNode>(NodeType::Identifier, name);
+          return make_node(NodeType::Identifier, name, line, column, pending.size());
      }
 
      if (match(TokenType::Punctuation, "["))
      {
           advance();
-          auto array = std::make_shared<ASTNode>(NodeType::Array, "");
+          size_t mark = pending.size();
           while (!match(TokenType::Punctuation, "]") && !match(TokenType::EndOfFile))
           {
-               array->children.push_back(parse_expression());
+               pending.push_back(parse_expression());
                if (match(TokenType::Punctuation, ","))
                {
                     advance();
@@ -325,7 +366,7 @@ std::shared_ptr<ASTNode> Parser::parse_primary()
                }
           }
           expect(TokenType::Punctuation, "]");
-          return array;
+          return make_node(NodeType::Array, "", line, column, mark);
      }
 
      if (match(TokenType::Punctuation, "("))
@@ -338,27 +379,27 @@ std::shared_ptr<ASTNode> Parser::parse_primary()
 
      if (match(TokenType::Integer))
      {
-          auto node = std::make_shared<ASTNode>(NodeType::Number, current.value);
+          auto node = make_leaf(NodeType::Number, current.value);
           advance();
           return node;
      }
      if (match(TokenType::Float))
      {
-          auto node = std::make_shared<ASTNode>(NodeType::DecimalNumber, current.value);
+          auto node = make_leaf(NodeType::DecimalNumber, current.value);
           advance();
           return node;
      }
 
      if (match(TokenType::String))
      {
-          auto node = std::make_shared<ASTNode>(NodeType::String, current.value);
+          auto node = make_leaf(NodeType::String, current.value);
           advance();
           return node;
      }
 
      if (match(TokenType::Boolean))
      {
-          auto node = std::make_shared<ASTNode>(NodeType::Boolean, current.value);
+          auto node = make_leaf(NodeType::Boolean, current.value);
           advance();
           return node;
      }
@@ -0,0 +1,100 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include <interpreter/array_kernels.hpp>
+
+// Checks every kernel table the CPU supports against the scalar one, on
+// lengths that cover empty arrays, partial vectors and unrolled tails.
+// Integer kernels run on small values and on full-range ones that mostly
+// overflow: they must agree on whether they overflowed and, when they did
+// not, on the result. Element-wise float results must match exactly;
+// float sums may only differ by rounding.
+
+static int failures = 0;
+
+static void check(bool ok, const ArrayKernels &table, const char *kernel, size_t n)
+{
+     if (ok)
+          return;
+     std::printf("%s: %s differs from scalar for n = %zu\n", table.name, kernel, n);
+     ++failures;
+}
+
+static bool close(double a, double b, double magnitude)
+{
+     return std::fabs(a - b) <= 1e-12 * (magnitude + 1);
+}
+
+int main()
+{
+     std::vector<const ArrayKernels *> tables = all_array_kernels();
+     const ArrayKernels &scalar = *tables[0];
+     std::mt19937 random(12345);
+     std::uniform_int_distribution<int64_t> small_ints(-(1 << 20), 1 << 20);
+     std::uniform_int_distribution<int64_t> ints(std::numeric_limits<int64_t>::min(),
+                                                 std::numeric_limits<int64_t>::max());
+     std::uniform_real_distribution<double> floats(-1e6, 1e6);
+
+     for (size_t run = 0; run < 142; ++run)
+     {
+          size_t n = run / 2;
+          bool full_range = run % 2 == 1;
+          std::vector<int64_t> a(n), b(n), int_out(n), int_expected(n);
+          std::vector<double> x(n), y(n), float_out(n), float_expected(n);
+          double magnitude = 0;
+          for (size_t i = 0; i < n; ++i)
+          {
+               a[i] = full_range ? ints(random) : small_ints(random);
+               b[i] = full_range ? ints(random) : small_ints(random);
+               x[i] = floats(random);
+               y[i] = floats(random);
+               magnitude += std::fabs(x[i]) * (1 + std::fabs(y[i]));
+          }
+
+          for (size_t t = 1; t < tables.size(); ++t)
+          {
+               const ArrayKernels &table = *tables[t];
+               int64_t total = 0, expected_total = 0;
+               bool ok = table.sum_int(a.data(), n, &total);
+               check(ok == scalar.sum_int(a.data(), n, &expected_total) && (!ok || total == expected_total), table,
+                     "sum_int", n);
+               check(close(table.sum_float(x.data(), n), scalar.sum_float(x.data(), n), magnitude), table,
+                     "sum_float", n);
+               ok = table.dot_int(a.data(), b.data(), n, &total);
+               check(ok == scalar.dot_int(a.data(), b.data(), n, &expected_total) && (!ok || total == expected_total),
+                     table, "dot_int", n);
+               check(close(table.dot_float(x.data(), y.data(), n), scalar.dot_float(x.data(), y.data(), n), magnitude),
+                     table, "dot_float", n);
+               if (n > 0)
+               {
+                    check(table.min_int(a.data(), n) == scalar.min_int(a.data(), n), table, "min_int", n);
+                    check(table.max_int(a.data(), n) == scalar.max_int(a.data(), n), table, "max_int", n);
+                    check(table.min_float(x.data(), n) == scalar.min_float(x.data(), n), table, "min_float", n);
+                    check(table.max_float(x.data(), n) == scalar.max_float(x.data(), n), table, "max_float", n);
+               }
+
+               ok = table.scale_int(a.data(), n, 7, int_out.data());
+               check(ok == scalar.scale_int(a.data(), n, 7, int_expected.data()) && (!ok || int_out == int_expected),
+                     table, "scale_int", n);
+               ok = table.add_int(a.data(), b.data(), n, int_out.data());
+               check(ok == scalar.add_int(a.data(), b.data(), n, int_expected.data()) && (!ok || int_out == int_expected),
+                     table, "add_int", n);
+               table.scale_float(x.data(), n, 0.5, float_out.data());
+               scalar.scale_float(x.data(), n, 0.5, float_expected.data());
+               check(float_out == float_expected, table, "scale_float", n);
+               table.add_float(x.data(), y.data(), n, float_out.data());
+               scalar.add_float(x.data(), y.data(), n, float_expected.data());
+               check(float_out == float_expected, table, "add_float", n);
+          }
+     }
+
+     std::string names;
+     for (const ArrayKernels *table : tables)
+          names += std::string(names.empty() ? "" : ", ") + table->name;
+     std::printf("checked %s\n", names.c_str());
+     return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+#include "ast_cache.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "source.hpp"
+
+// Saves a parsed script, then damages copies of the file and checks that
+// each one is rejected instead of loaded. Offsets follow the layout in
+// ast_cache.cpp: a 72-byte header with node_count at 32 and the checksum
+// at 64, then 20-byte node records with the type at 0 and child_count
+// at 8, then the child ids.
+
+namespace
+{
+constexpr size_t header_size = 72;
+constexpr size_t node_count_offset = 32;
+constexpr size_t checksum_offset = 64;
+constexpr size_t node_size = 20;
+constexpr size_t child_count_offset = 8;
+
+const char *script = "fn add(a: num, b: num) num (\n"
+                     "    return a + b;\n"
+                     ")\n"
+                     "x = add(1, 2);\n"
+                     "cout(x);\n";
+
+int failures = 0;
+
+void check(bool ok, const char *what)
+{
+     if (ok)
+          return;
+     std::printf("failed: %s\n", what);
+     ++failures;
+}
+
+std::string read_file(const std::string &path)
+{
+     std::ifstream in(path, std::ios::binary);
+     return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void write_file(const std::string &path, const std::string &bytes)
+{
+     std::ofstream(path, std::ios::binary | std::ios::trunc) << bytes;
+}
+
+template <typename T>
+T field(const std::string &file, size_t offset)
+{
+     T value;
+     std::memcpy(&value, file.data() + offset, sizeof(T));
+     return value;
+}
+
+// The checksum is the same hash the key uses for the source text, so a
+// damaged file can be made to pass it and reach the later checks.
+void reseal(std::string &file)
+{
+     uint64_t checksum = ast_cache_key(std::string_view(file).substr(header_size), 0).source_hash;
+     std::memcpy(&file[checksum_offset], &checksum, sizeof(checksum));
+}
+} // namespace
+
+int main()
+{
+     auto source = SourceBuffer::from_string(script);
+     Parser parser{Lexer(source)};
+     Ast ast = parser.parse();
+     AstCacheKey key = ast_cache_key(source->text(), 0);
+
+     std::filesystem::path dir =
+         std::filesystem::temp_directory_path() / ("ast_cache_test-" + std::to_string(getpid()));
+     std::filesystem::create_directories(dir);
+     std::string path = ast_cache_path(dir.string(), key);
+     save_ast_cache(path, ast, key);
+     const std::string saved = read_file(path);
+
+     std::optional<Ast> loaded = load_ast_cache(path, key);
+     check(loaded && loaded->size() == ast.size(), "an intact file loads");
+     check(!load_ast_cache(path, ast_cache_key("cout(1);", 0)), "other source misses");
+     check(!load_ast_cache(path, ast_cache_key(source->text(), 2)), "another level misses");
+
+     auto rejected = [&](std::string file, const char *what) {
+          write_file(path, file);
+          check(!load_ast_cache(path, key), what);
+     };
+
+     std::string flipped = saved;
+     flipped[header_size] ^= 1;
+     rejected(flipped, "a stale checksum misses");
+     rejected(saved.substr(0, saved.size() - 1), "a truncated file misses");
+     std::string short_file = saved.substr(0, saved.size() - 1);
+     reseal(short_file);
+     rejected(short_file, "a truncated resealed file misses");
+
+     // An Identifier retyped to a BinaryOp keeps its checksum valid but
+     // has no operands for the engines to read.
+     uint32_t nodes = field<uint32_t>(saved, node_count_offset);
+     bool retyped = false;
+     for (uint32_t i = 0; i < nodes && !retyped; ++i)
+     {
+          size_t record = header_size + i * node_size;
+          if (saved[record] != static_cast<char>(NodeType::Identifier) ||
+              field<uint32_t>(saved, record + child_count_offset) != 0)
+               continue;
+          std::string file = saved;
+          file[record] = static_cast<char>(NodeType::BinaryOp);
+          reseal(file);
+          rejected(file, "a leaf retyped to an operator misses");
+          retyped = true;
+     }
+     check(retyped, "the script has an identifier to retype");
+
+     // The first child id points past its parent.
+     std::string forward = saved;
+     uint32_t past = nodes;
+     std::memcpy(&forward[header_size + nodes * node_size], &past, sizeof(past));
+     reseal(forward);
+     rejected(forward, "a child id past its parent misses");
+
+     std::filesystem::remove_all(dir);
+     std::printf("checked %u nodes\n", nodes);
+     return failures == 0 ? 0 : 1;
+}
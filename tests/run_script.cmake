@@ -0,0 +1,34 @@
+# Runs INTERPRETER with OPTIONS on SCRIPT and compares what it prints with
+# the EXPECTED file. The script must succeed, unless the ERROR file exists:
+# then it must fail with a message containing that file's text. With CACHE
+# set, a first run fills that cache directory and the checked run must
+# load the script from it.
+separate_arguments(options UNIX_COMMAND "${OPTIONS}")
+if(DEFINED CACHE)
+    file(REMOVE_RECURSE ${CACHE})
+    file(MAKE_DIRECTORY ${CACHE})
+    execute_process(COMMAND ${INTERPRETER} ${options} --cache=${CACHE} ${SCRIPT} OUTPUT_QUIET ERROR_QUIET)
+    list(APPEND options --cache=${CACHE} --stats)
+endif()
+execute_process(
+    COMMAND ${INTERPRETER} ${options} ${SCRIPT}
+    OUTPUT_VARIABLE actual
+    ERROR_VARIABLE errors
+    RESULT_VARIABLE status
+)
+file(READ ${EXPECTED} expected)
+if(EXISTS ${ERROR})
+    file(READ ${ERROR} error)
+    string(STRIP "${error}" error)
+    string(FIND "${errors}" "${error}" found)
+    if(status EQUAL 0 OR found EQUAL -1)
+        message(FATAL_ERROR "${OPTIONS} ${SCRIPT} should have failed with \"${error}\" (${status}):\n${errors}")
+    endif()
+elseif(NOT status EQUAL 0)
+    message(FATAL_ERROR "${OPTIONS} ${SCRIPT} failed (${status}):\n${errors}")
+elseif(DEFINED CACHE AND NOT errors MATCHES "cache_hit[ \t]+1")
+    message(FATAL_ERROR "${OPTIONS} ${SCRIPT} did not load from ${CACHE}:\n${errors}")
+endif()
+if(NOT actual STREQUAL expected)
+    message(FATAL_ERROR "${OPTIONS} ${SCRIPT} printed:\n${actual}\nexpected:\n${expected}")
+endif()